@@ -43,6 +43,8 @@ struct bmp_dib_hdr
 class Bmp
 {
 public:
-    static int write(ColorArray *color_array, std::string filename, int width, int height);
+    // Write a row major 8 bit RGB image that starts at the bottom row, as
+    // given by Framebuffer::display
+    static int write(const std::vector<uint8_t> &pixels, std::string filename, int width, int height);
     static std::shared_ptr<ColorArray> read(std::string filename);
 };
\ No newline at end of file
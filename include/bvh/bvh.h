@@ -3,6 +3,7 @@
 #include <hitables/hitable.h>
 #include <hitables/hitable_list.h>
 #include <config.h>
+#include <shared_buffer.h>
 #include <unordered_map>
 #include <mutex>
 
@@ -62,11 +63,52 @@ public:
 
 class BvhNode;
 
+// A BVH with the children of the nodes stored as indices instead of
+// pointers, so it can be written to a scene file and read back without
+// building it again. A child reference is a node, an object of the hitable
+// list or a list of objects (the leaves of the SAH tree), the type is in the
+// top bits. Nodes come after their parent.
+#define FLAT_BVH_NODE   0u
+#define FLAT_BVH_OBJECT 1u
+#define FLAT_BVH_LIST   2u
+#define FLAT_BVH_TYPE_SHIFT 30
+#define FLAT_BVH_INDEX_MASK ((1u << FLAT_BVH_TYPE_SHIFT) - 1)
+
+struct FlatBvhNode
+{
+    AABB box;
+    uint32_t left;
+    uint32_t right;
+};
+
+// A range of list_objects
+struct FlatBvhList
+{
+    uint32_t begin;
+    uint32_t end;
+};
+
+struct FlatBvh
+{
+    SharedBuffer<FlatBvhNode> nodes;
+    SharedBuffer<FlatBvhList> lists;
+    SharedBuffer<uint32_t> list_objects;
+    uint32_t root = 0;
+
+    // The size of the hitable list the BVH was built for
+    uint32_t object_count = 0;
+};
+
 class HitCacheRecord
 {
 private:
     std::vector<Hitable const *> m_objects;
 
+    // The amount of full BVH traversals that went into this record. This is
+    // counted here instead of derived from the sample index because a pixel
+    // does not necessarily start at sample 0 (e.g. when resuming a render).
+    int m_probes = 0;
+
 public:
     HitCacheRecord() {
         m_objects.reserve(5);
@@ -77,6 +119,9 @@ public:
         m_objects.push_back(object);
     }
 
+    int probes() const { return m_probes; }
+    void addProbe() { m_probes++; }
+
     bool contains(Hitable const* object)
     {
         for (const auto& obj : m_objects)
@@ -120,14 +165,24 @@ private:
     int m_cache_cutoff_sample;
     std::vector<std::vector<HitCacheRecord>> m_cache;
 
+    void setupCache(int width, int height, int samples_per_pixel);
+    void build(const HitableList &list);
+    HitablePtr unflatten(const HitableList &list, const FlatBvh &bvh);
+
 public:
     BvhManager() {}
     BvhManager(const HitableList &list, int width, int height, int samples_per_pixel);
 
+    // Use a BVH that was built before for the same list, it is only built
+    // again when it does not fit the list
+    BvhManager(const HitableList &list, const FlatBvh &bvh, int width, int height, int samples_per_pixel);
+
     BvhNode *allocate_node();
 
+    FlatBvh flatten(const HitableList &list) const;
+
 #if BVH_FIRST_HIT_CACHING
-    bool cachedHit(int x, int y, int sample, const Ray &ray, double t_min, double t_max, HitRecord &rec);
+    bool cachedHit(int x, int y, const Ray &ray, double t_min, double t_max, HitRecord &rec);
 #endif
     bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
     bool boundingBox(AABB &bounding_box) const override;
@@ -143,6 +198,8 @@ private:
 
 public:
     BvhNode() {}
+    BvhNode(const AABB &box, HitablePtr left, HitablePtr right)
+        : m_left(left), m_right(right), m_box(box) {}
     BvhNode(const HitableList &list, BvhManager &manager)
         : BvhNode(list.objects(), 0, list.objects().size(), manager) {}
 
@@ -156,6 +213,8 @@ public:
     {
         return m_left == nullptr || m_right == nullptr;
     }
+    HitablePtr left() const { return m_left; }
+    HitablePtr right() const { return m_right; }
     bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
     bool boundingBox(AABB &bounding_box) const override;
 };
\ No newline at end of file
@@ -2,7 +2,7 @@
 
 #include <vec3.h>
 #include <ray.h>
-#include <random.h>
+#include <sampler.h>
 
 class Camera
 {
@@ -51,12 +51,17 @@ public:
     double nearplane() const { return m_near_plane; }
     double farplane() const { return m_far_plane; }
 
-    Ray sendRay(double x, double y) const
+    // The angle a pixel covers when the image is image_height pixels high
+    double pixelSpread(int image_height) const { return std::atan(m_viewport_height / image_height); }
+
+    // The ray starts a cone with the given spread, see pixelSpread()
+    Ray sendRay(double x, double y, double spread = 0) const
     {
-        Point3 rd = m_aperature / 2 * randomGen.getPoint3InUnitDisk();
+        auto [u, v] = sampler->get2D();
+        Point3 rd = m_aperature / 2 * sampleUnitDisk(u, v);
         Point3 offset = rd.x() * m_u + rd.y() * m_v;
         Direction dir = lowerLeft() + x * horizontal() + y * vertical() - m_origin - offset;
-        return Ray(m_origin + offset, normalize(dir));
+        return Ray(m_origin + offset, normalize(dir), 0, spread);
     }
 
     void lookAt(Point3 lookat, Direction vup, double focus_dist)
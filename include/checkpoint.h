@@ -0,0 +1,65 @@
+#pragma once
+
+#include <core.h>
+#include <framebuffer.h>
+
+#include <stdint.h>
+
+#define CHECKPOINT_ID_0 'R'
+#define CHECKPOINT_ID_1 'T'
+#define CHECKPOINT_ID_2 'C'
+#define CHECKPOINT_ID_3 'P'
+
+#define CHECKPOINT_VERSION 3
+
+// The pixel data starts on its own page so the framebuffer can be mapped
+// straight out of the file.
+#define CHECKPOINT_DATA_OFFSET 4096
+
+PACKED(
+struct checkpoint_hdr
+{
+    char        id[4];
+    uint32_t    version;
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    samples_per_pixel;      // The amount of samples the render was started with
+    uint32_t    samples_done;           // Every pixel has at least this many samples
+    uint32_t    seed;                   // Seed of the render, every sample is a function of it
+    uint32_t    aovs;                   // The AOV planes stored after the color
+});
+
+// A checkpoint is a memory mapped file that holds the framebuffer of a
+// render. Since the renderer accumulates directly into the mapping, making
+// a checkpoint only means updating the header and asking the kernel to write
+// back the pages that changed since the last checkpoint.
+class Checkpoint
+{
+private:
+    std::string m_filename;
+    int m_fd = -1;
+    uint8_t *m_map = nullptr;
+    size_t m_size = 0;
+
+    Checkpoint(std::string filename) : m_filename(filename) {}
+    bool map(bool create);
+
+    checkpoint_hdr *header() const { return reinterpret_cast<checkpoint_hdr *>(m_map); }
+
+public:
+    ~Checkpoint();
+
+    static std::unique_ptr<Checkpoint> create(std::string filename, int width, int height, uint32_t aovs, int samples_per_pixel, uint32_t seed);
+    static std::unique_ptr<Checkpoint> open(std::string filename);
+
+    int width() const { return header()->width; }
+    int height() const { return header()->height; }
+    int samplesDone() const { return header()->samples_done; }
+    uint32_t seed() const { return header()->seed; }
+    uint32_t aovs() const { return header()->aovs; }
+
+    // A framebuffer that lives in the mapped file, it may not outlive the checkpoint
+    std::unique_ptr<Framebuffer> buffer();
+
+    void commit(int samples_per_pixel, int samples_done);
+};
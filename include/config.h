@@ -14,6 +14,16 @@
 #define AABB_HIT_BRANCHLESS         2
 #define AABB_HIT_BRANCHLESS_VECTOR  3
 
+#define TEXTURE_FILTER_NEAREST      1
+#define TEXTURE_FILTER_BILINEAR     2
+#define TEXTURE_FILTER_TRILINEAR    3
+
+// Scene files store these, only add new ones
+#define TEXEL_SRGB8     1
+#define TEXEL_RGB32F    2
+#define TEXEL_RGB16F    3
+#define TEXEL_BC1       4
+
 #if __has_include("../custom_config.h")
 #include "../custom_config.h"
 #endif
@@ -22,6 +32,22 @@
 #define WORK_SQUARE_SIZE 1
 #endif
 
+#ifndef DISTRIBUTED_TILE_SIZE
+#define DISTRIBUTED_TILE_SIZE 64
+#endif
+
+// Seconds the coordinator waits for the workers to load the scene and
+// connect, the render goes on with the workers that made it in time
+#ifndef DISTRIBUTED_START_TIMEOUT
+#define DISTRIBUTED_START_TIMEOUT 300
+#endif
+
+// Rows per band when streaming the output, a multiple of 16 keeps the ZIP
+// chunks of EXR files whole
+#ifndef STREAM_BAND_HEIGHT
+#define STREAM_BAND_HEIGHT 64
+#endif
+
 #ifndef MAX_SAMPLE_OUTPUT_COLOR
 #define MAX_SAMPLE_OUTPUT_COLOR 20
 #endif
@@ -52,4 +78,43 @@
 
 #ifndef BVH_SAH
 #define BVH_SAH TRUE
+#endif
+
+#ifndef LIGHT_BVH
+#define LIGHT_BVH TRUE
+#endif
+
+#ifndef MIS_POWER_HEURISTIC
+#define MIS_POWER_HEURISTIC TRUE
+#endif
+
+#ifndef ENVIRONMENT_HALF_RES_CDF
+#define ENVIRONMENT_HALF_RES_CDF FALSE
+#endif
+
+// How image textures are sampled: the nearest texel of the full image, the
+// mip level closest to the ray footprint, or a blend of the two levels around it
+#ifndef TEXTURE_FILTERING
+#define TEXTURE_FILTERING TEXTURE_FILTER_TRILINEAR
+#endif
+
+// How the texels of 8 bit images (TEXEL_SRGB8 or the 8 times smaller but
+// lossy TEXEL_BC1) and other images (TEXEL_RGB16F or TEXEL_RGB32F) are stored
+#ifndef TEXTURE_LDR_FORMAT
+#define TEXTURE_LDR_FORMAT TEXEL_SRGB8
+#endif
+
+#ifndef TEXTURE_HDR_FORMAT
+#define TEXTURE_HDR_FORMAT TEXEL_RGB16F
+#endif
+
+// Image textures in the texture cache are split into tiles of this many
+// texels squared, the cache is split into this many independently locked
+// parts
+#ifndef TEXTURE_TILE_SIZE
+#define TEXTURE_TILE_SIZE 64
+#endif
+
+#ifndef TEXTURE_CACHE_SHARDS
+#define TEXTURE_CACHE_SHARDS 16
 #endif
\ No newline at end of file
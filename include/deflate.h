@@ -0,0 +1,45 @@
+#pragma once
+
+#include <core.h>
+
+#include <stdint.h>
+
+#define DEFLATE_WINDOW_SIZE     32768
+#define DEFLATE_MIN_MATCH       3
+#define DEFLATE_MAX_MATCH       258
+
+// The amount of symbols collected before a block is written, every block
+// gets its own Huffman codes.
+#define DEFLATE_BLOCK_SYMBOLS   16384
+
+// zlib streams of larger input are split into segments of this size that
+// are compressed in parallel. The segments are fixed in size so the output
+// does not depend on the amount of threads.
+#define DEFLATE_SEGMENT_SIZE    (1 << 20)
+
+// A small DEFLATE (RFC 1951) compressor and decompressor and the zlib
+// (RFC 1950) wrapper around them, as used by ZIP compressed EXR files and
+// PNG images.
+//
+// Matches are found with hash chains, the symbols are written with dynamic
+// Huffman codes per block. Blocks that would not get smaller are stored as
+// is. Level 0 only writes stored blocks, higher levels search longer chains
+// for better matches.
+class Deflate
+{
+public:
+    // When final is false the stream ends on a byte boundary without a final
+    // block, so another stream can be appended to it
+    static void compress(const uint8_t *data, size_t size, int level, std::vector<uint8_t> &output, bool final = true);
+    static void zlibCompress(const uint8_t *data, size_t size, int level, std::vector<uint8_t> &output);
+
+    // Append the decompressed data to output, returns false when the stream
+    // is broken or ends early. The zlib wrapper also checks the checksum.
+    static bool decompress(const uint8_t *data, size_t size, std::vector<uint8_t> &output);
+    static bool zlibDecompress(const uint8_t *data, size_t size, std::vector<uint8_t> &output);
+
+    static uint32_t adler32(const uint8_t *data, size_t size, uint32_t adler = 1);
+
+    // The checksum of two pieces of data from the checksums of both pieces
+    static uint32_t adler32Combine(uint32_t adler1, uint32_t adler2, size_t size2);
+};
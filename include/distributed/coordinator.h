@@ -0,0 +1,54 @@
+#pragma once
+
+#include <core.h>
+#include <render_work.h>
+#include <framebuffer.h>
+
+#include <sys/types.h>
+
+#include <atomic>
+#include <deque>
+
+// Spreads render jobs over a set of local worker processes. The workers are
+// separate instances of this program that load the same scene and connect
+// back over a unix socket. When a worker dies its job is handed to another one.
+class Coordinator
+{
+private:
+    struct WorkerConnection
+    {
+        pid_t pid;
+        int fd;
+        bool busy;
+        RenderWorkBlock job;
+    };
+
+    std::vector<std::string> m_command;
+    std::string m_socket_path;
+    int m_listen_fd = -1;
+
+    std::vector<pid_t> m_pids;
+    std::vector<WorkerConnection> m_workers;
+
+    pid_t spawn();
+    bool acceptWorker(int width, int height, uint32_t aovs, int timeout_ms);
+    void lostWorker(WorkerConnection &worker, std::deque<RenderWorkBlock> &pending);
+    bool sendJob(WorkerConnection &worker, const RenderWorkBlock &block, const Framebuffer &buffer);
+    bool mergeResult(const WorkerConnection &worker, const std::vector<uint8_t> &payload, Framebuffer &buffer,
+                     std::atomic<long> &rendered_samples);
+
+public:
+    // The command (program and arguments) that starts a worker, the socket
+    // to connect to is appended as '--worker <socket>'.
+    Coordinator(std::vector<std::string> command) : m_command(command) {}
+    ~Coordinator();
+
+    // Starts the workers and waits for them to connect, at most
+    // DISTRIBUTED_START_TIMEOUT seconds. Returns false if none of them did.
+    bool start(int workers, int width, int height, uint32_t aovs);
+    int workers() const;
+
+    // Render all jobs, returns false if not every job could be finished
+    bool render(const std::vector<RenderWorkBlock> &jobs, Framebuffer &buffer,
+                std::atomic<long> &rendered_samples, std::function<bool()> stop);
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <core.h>
+#include <render_work.h>
+
+#include <stdint.h>
+
+// Messages between the coordinator and its workers. Every message starts with
+// a distributed_msg_hdr, followed by 'size' bytes of payload.
+#define DISTRIBUTED_MSG_HELLO   1   // worker -> coordinator: distributed_hello, the worker is ready
+#define DISTRIBUTED_MSG_JOB     2   // coordinator -> worker: distributed_job followed by the sample counts of the tile
+#define DISTRIBUTED_MSG_RESULT  3   // worker -> coordinator: distributed_job followed by the tile framebuffer
+#define DISTRIBUTED_MSG_QUIT    4   // coordinator -> worker: no payload
+
+PACKED(
+struct distributed_msg_hdr
+{
+    uint32_t    type;
+    uint32_t    size;
+});
+
+PACKED(
+struct distributed_hello
+{
+    int32_t     pid;
+    int32_t     width;
+    int32_t     height;
+    uint32_t    aovs;
+});
+
+PACKED(
+struct distributed_job
+{
+    int32_t     x;
+    int32_t     y;
+    int32_t     x_end;
+    int32_t     y_end;
+    int32_t     sample_start;
+    int32_t     sample_end;
+});
+
+// The sample counts of a job are an int32_t per pixel of the tile, row by
+// row. A resumed render can have pixels that are already ahead of the pass,
+// those only take the missing samples.
+//
+// The tile of a result is the storage of a Framebuffer covering the job, see
+// Framebuffer::storageSize()
+
+bool sendMessage(int fd, uint32_t type, const void *payload, size_t size);
+bool receiveMessage(int fd, distributed_msg_hdr &header, std::vector<uint8_t> &payload);
+
+distributed_job toJob(const RenderWorkBlock &block);
+RenderWorkBlock fromJob(const distributed_job &job);
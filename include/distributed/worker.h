@@ -0,0 +1,17 @@
+#pragma once
+
+#include <core.h>
+#include <renderer.h>
+
+// The worker side of distributed rendering, it renders the jobs it receives
+// from the coordinator with the regular renderer and sends back the tiles.
+class Worker
+{
+private:
+    std::string m_socket_path;
+
+public:
+    Worker(std::string socket_path) : m_socket_path(socket_path) {}
+
+    int run(Renderer &renderer);
+};
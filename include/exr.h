@@ -0,0 +1,81 @@
+#pragma once
+
+#include <core.h>
+#include <framebuffer.h>
+
+#include <stdint.h>
+#include <fstream>
+
+#define EXR_MAGIC               20000630
+#define EXR_VERSION             2
+
+// Compression level of the deflate stream in ZIP compressed files
+#define EXR_ZIP_LEVEL           4
+
+// Scanlines per chunk, fixed by the compression method
+#define EXR_NONE_SCANLINES      1
+#define EXR_ZIP_SCANLINES       16
+
+// The values match the compression attribute of the file
+enum class ExrCompression : uint8_t
+{
+    None = 0,
+    Zip = 3,
+};
+
+// OpenEXR scanline images with the linear, unclamped values of a
+// framebuffer. The color is stored as the R, G and B channels, every AOV of
+// the framebuffer becomes a layer next to it (albedo.R, normal.X, depth.Z,
+// ...), so a single file holds everything a compositor or denoiser needs.
+//
+// The color channels are stored as half or as float, depth and sample
+// counts always as float. Chunks are compressed in parallel.
+class Exr
+{
+public:
+    static int write(const Framebuffer &framebuffer, std::string filename,
+                     ExrCompression compression = ExrCompression::Zip, bool half = true);
+};
+
+struct ExrChannel
+{
+    std::string name;
+    Aov aov;        // AOV_NONE for the color
+    int component;
+    int type;
+};
+
+// Writes an EXR image band by band, from the top of the image down, so the
+// whole image never has to be in memory. The offset table is filled in
+// once the last band is written.
+class ExrWriter
+{
+private:
+    std::ofstream m_output;
+    int m_width;
+    int m_height;
+    ExrCompression m_compression;
+    std::vector<ExrChannel> m_channels;
+
+    int m_next_line = 0;
+    std::streampos m_table;
+    std::vector<uint64_t> m_offsets;
+
+public:
+    ExrWriter(std::string filename, int width, int height, uint32_t aovs,
+              ExrCompression compression = ExrCompression::Zip, bool half = true);
+    ~ExrWriter();
+
+    bool isOpen() const { return m_output.is_open(); }
+
+    // The scanlines per band have to be a multiple of linesPerChunk(),
+    // except for the last band
+    int linesPerChunk() const;
+
+    // Write the next band of the image, a framebuffer of the full width.
+    // Its top row is the next line of the file.
+    bool writeBand(const Framebuffer &band);
+
+    // Write the offset table, fails when not all lines were written
+    bool close();
+};
@@ -1,7 +1,13 @@
 #include <core.h>
 #include <fileformats/input_file_format.h>
+#include <hitables/mesh.h>
+#include <textures/texture.h>
+#include <ldr_image.h>
 #include <stdint.h>
 #include <vec4.h>
+#include <transform.h>
+
+#include <map>
 
 #include <json.h>
 using json = nlohmann::json_abi_v3_11_3::json;
@@ -11,12 +17,19 @@ using json = nlohmann::json_abi_v3_11_3::json;
 #define GLTF_CHUNK_TYPE_JSON 0x4E4F534A
 #define GLTF_CHUNK_TYPE_BIN  0x004E4942
 
+#define GLTF_ACCESSOR_COMPTYPE_UBYTE    5121
 #define GLTF_ACCESSOR_COMPTYPE_USHORT   5123
 #define GLTF_ACCESSOR_COMPTYPE_UINT     5125
 #define GLTF_ACCESSOR_COMPTYPE_FLOAT    5126
 
+#define GLTF_PRIMITIVE_MODE_TRIANGLES 4
+
 #define GLTF_UNIT_TO_RT_UNIT 1
 
+// Large primitives are split into tasks of this many vertices or indices
+// when they are decoded, so a single big mesh is spread over all threads
+#define GLTF_ELEMENTS_PER_TASK 65536
+
 /* todo: removeme, this is just to make my ide shut up */
 #ifndef PACKED
 #define PACKED(X) X
@@ -40,20 +53,98 @@ struct GLTFVec3 {
     T y;
     T z;
 
-    Point3 toPoint3() {
-        return Point3(this->x, this->y, this->z);
+    Vec3f toVec3f() {
+        return Vec3f(this->x, this->y, this->z);
     }
 });
 
+// The binary chunk of the file. The owner is the mapping, buffers that are
+// views into the chunk hold on to it so it stays mapped after the read.
+struct GLTFBuffer {
+    std::shared_ptr<const void> owner;
+    const uint8_t *data = nullptr;
+    size_t size = 0;
+};
+
+// An accessor resolved to its elements in the binary chunk. The elements
+// are read in place, byteStride apart, or tightly packed when the buffer
+// view does not have a stride.
+struct GLTFAccessor {
+    const uint8_t *data = nullptr;
+    size_t count = 0;
+    size_t stride = 0;
+    int component_type = 0;
+    int components = 0;
+
+    // Integer components that map to the 0 to 1 range
+    bool normalized = false;
+
+    uint32_t index(size_t i) const;
+    Vec3f vec3(size_t i) const;
+    TexCoord vec2(size_t i) const;
+};
+
+// The accessors of a primitive, -1 when it does not have one
+struct GLTFPrimitive {
+    int positions = -1;
+    int normals = -1;
+    int texcoords = -1;
+    int indices = -1;
+    int material = -1;
+};
+
+// A mesh of the file placed in the scene by a node
+struct GLTFInstance {
+    int mesh;
+    Transform transform;
+};
+
+// Work on part of the elements of an accessor, the result of all parts is
+// combined with max, which is what index validation needs
+struct GLTFJob {
+    size_t count;
+    std::function<uint32_t(size_t begin, size_t end)> run;
+    uint32_t result = 0;
+};
+
+// Binary glTF (.glb) files. The whole node hierarchy of the scene is
+// walked and the transforms of the nodes are applied to the meshes and
+// cameras. Positions, normals, the first set of texture coordinates and
+// PNG or JPEG color and emission textures are read.
+//
+// Every accessor is decoded once, in parallel, and shared by all primitives
+// and copies of a mesh that use it. Tightly packed positions and normals are
+// not decoded at all, the meshes use them in place in the mapped file. Only
+// copies that are transformed get their own positions and normals. Images are only decoded when a material
+// of a mesh in the scene uses them.
 class GLTF : public InputFileFormat
 {
 private:
-    Point3 parseNodeTranslation(json& node);
-    Quaternion parseNodeRotation(json& node);
-    void parseCameraNode(Scene& scene, json& node, json& file);
-    void parseMeshNode(Scene& scene, json& node, json& file, char* bin_data);
-    void* getBufferviewData(json file, char* bin_data, int bufferview_idx);
-    std::shared_ptr<Material> parseMaterial(json file, int mat_idx, bool& is_emissive);
+    const json *m_file = nullptr;
+    GLTFBuffer m_bin;
+
+    std::map<int, std::vector<GLTFPrimitive>> m_meshes;
+    std::map<int, MeshBuffer<Vec3f>> m_vec3s;
+    std::map<int, MeshBuffer<TexCoord>> m_texcoords;
+    std::map<int, MeshBuffer<uint32_t>> m_indices;
+    std::map<int, uint32_t> m_max_index;
+    std::map<size_t, MeshBuffer<uint32_t>> m_sequential;
+    std::map<int, std::shared_ptr<Material>> m_materials;
+    std::map<int, bool> m_emissive;
+    std::map<int, std::shared_ptr<Texture>> m_images;
+
+    Transform parseNodeTransform(const json& node);
+    void parseNode(Scene& scene, int node_idx, const Transform& parent, std::vector<bool>& visited, std::vector<GLTFInstance>& instances);
+    void parseCameraNode(Scene& scene, const json& node, const Transform& transform);
+    const std::vector<GLTFPrimitive>& parseMesh(int mesh_idx);
+    GLTFAccessor getAccessor(int accessor_idx);
+    void decodeAccessors(const std::vector<GLTFInstance>& instances);
+    void loadImages(const std::vector<GLTFInstance>& instances);
+    std::shared_ptr<LdrImage> decodeImage(int image_idx);
+    int textureSource(const json& texture_info);
+    std::shared_ptr<Texture> materialTexture(const json& texture_info);
+    std::shared_ptr<Material> parseMaterial(int mat_idx, bool& is_emissive);
+    void buildMeshes(Scene& scene, const std::vector<GLTFInstance>& instances);
 
 public:
     GLTF(std::string filename) : InputFileFormat(filename) {}
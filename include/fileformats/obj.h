@@ -2,17 +2,46 @@
 
 #include <core.h>
 #include <vec3.h>
+#include <hitables/mesh.h>
 #include <hitables/hitable_list.h>
 #include <fileformats/input_file_format.h>
 
-class Obj : public InputFileFormat
+#include <stdint.h>
+
+// The file is split into chunks of about this many bytes on line
+// boundaries, the chunks are parsed in parallel
+#define OBJ_BYTES_PER_CHUNK (1 << 22)
+
+// Negative indices count back from the last vertex read so far, which a
+// chunk only knows relative to its own start until all chunks are parsed.
+// Those indices are stored as the position relative to the chunk plus this
+// offset, positive indices are stored as they are (0 based).
+#define OBJ_RELATIVE_INDEX (int64_t(1) << 62)
+
+// What one chunk of the file contains. Faces are triangulated right away,
+// there are three corners per triangle. Texture and normal indices are only
+// stored when every corner of the face has them, so they line up with the
+// position indices only if the whole file has them.
+struct ObjChunk
 {
-private:
-    std::vector<Point3> m_verts;
+    std::vector<Vec3f> positions;
+    std::vector<TexCoord> texcoords;
+    std::vector<Vec3f> normals;
 
+    std::vector<int64_t> position_indices;
+    std::vector<int64_t> texcoord_indices;
+    std::vector<int64_t> normal_indices;
+
+    size_t malformed_lines = 0;
+};
+
+// Wavefront OBJ meshes with positions, texture coordinates and normals.
+// Polygons are fan triangulated, all faces end up in one mesh with the
+// default material.
+class Obj : public InputFileFormat
+{
 private:
-    Point3 parseVec(const std::vector<std::string> &parts, int start_index) const;
-    Point3 getVert(const std::string vert) const;
+    void parseChunk(const char *begin, const char *end, ObjChunk &chunk) const;
 
 public:
     Obj(std::string filename) : InputFileFormat(filename) {}
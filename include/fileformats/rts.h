@@ -0,0 +1,124 @@
+#pragma once
+
+#include <core.h>
+#include <fileformats/input_file_format.h>
+#include <bvh/bvh.h>
+#include <stdint.h>
+
+// "RTS\0"
+#define RTS_MAGIC_BYTES 0x00535452
+#define RTS_VERSION 3
+
+// Sections and the buffers in the data section start at a multiple of this,
+// so they can be used in place from the mapped file
+#define RTS_ALIGNMENT 64
+
+#define RTS_SECTION_CAMERA    1
+#define RTS_SECTION_TEXTURES  2
+#define RTS_SECTION_MATERIALS 3
+#define RTS_SECTION_MESHES    4
+#define RTS_SECTION_BVH       5
+#define RTS_SECTION_DATA      6
+
+#define RTS_TEXTURE_SOLID  1
+#define RTS_TEXTURE_SCALED 2
+#define RTS_TEXTURE_IMAGE  3
+
+#define RTS_MESH_LIGHT (1u << 0)
+
+// Buffers that a mesh does not have
+#define RTS_NO_BUFFER UINT64_MAX
+
+// Vertices, cameras and BVH nodes are stored the way they are laid out in
+// memory, the sizes tell if a file was written by a build with the same
+// layout
+struct RtsHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t point_size;
+    uint32_t texcoord_size;
+    uint32_t bvh_node_size;
+    uint32_t camera_size;
+    uint32_t section_count;
+    uint32_t reserved;
+};
+
+// The section table follows the header
+struct RtsSection
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t offset;
+    uint64_t size;
+};
+
+// Textures only refer to textures before them. Images store every mip
+// level one after the other, each row by row starting at the bottom left.
+// The format is one of the TEXEL_* layouts, levels of layouts with larger
+// blocks store rows of whole blocks.
+struct RtsTexture
+{
+    uint32_t type;
+    int32_t texture;
+    double color[3];
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t level_count;
+    uint64_t texels;
+};
+
+struct RtsMaterial
+{
+    int32_t base_color;
+    int32_t emission;
+    double roughness;
+    double transmission;
+    double emission_strength;
+    uint32_t metallic;
+    uint32_t reserved;
+};
+
+// Buffers are offsets into the data section, meshes that share vertices
+// refer to the same buffer
+struct RtsMesh
+{
+    uint32_t material;
+    uint32_t flags;
+    uint64_t vertex_count;
+    uint64_t index_count;
+    uint64_t positions;
+    uint64_t indices;
+    uint64_t normals;
+    uint64_t texcoords;
+};
+
+struct RtsBvh
+{
+    uint32_t root;
+    uint32_t object_count;
+    uint64_t node_count;
+    uint64_t list_count;
+    uint64_t list_object_count;
+    uint64_t nodes;
+    uint64_t lists;
+    uint64_t list_objects;
+};
+
+// The native scene format. Everything a loaded scene consists of (the
+// camera, materials, meshes and optionally the BVH) is stored in aligned
+// sections, so reading one maps the file and uses the vertex data and BVH
+// nodes in place instead of parsing anything. Scenes of other formats are
+// converted with --convert.
+class Rts : public InputFileFormat
+{
+public:
+    Rts(std::string filename) : InputFileFormat(filename) {}
+    void read(Scene &scene);
+
+    // Only PBR materials with solid, scaled and image textures can be
+    // stored, which is what the other scene formats create. The BVH is
+    // optional.
+    static int write(Scene &scene, const FlatBvh *bvh, std::string filename);
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <core.h>
+#include <vec3.h>
+
+#include <stdint.h>
+#include <cstdlib>
+
+// Rows and planes start on a cache line, two threads writing to different
+// tiles never touch the same line as long as the tiles start and end at a
+// multiple of Framebuffer::lineWidth() pixels.
+#define FRAMEBUFFER_ALIGNMENT 64
+
+// Optional planes next to the color, as bit flags
+enum Aov : uint32_t
+{
+    AOV_NONE    = 0,
+    AOV_ALBEDO  = 1 << 0,
+    AOV_NORMAL  = 1 << 1,
+    AOV_DEPTH   = 1 << 2,
+
+    // The sample count is always kept in the alpha channel of the color
+    // plane, so this one does not need a plane of its own.
+    AOV_SAMPLES = 1 << 3,
+
+    // The variance of the pixel estimate, from the sum of squared samples
+    AOV_VARIANCE = 1 << 4,
+};
+
+// The name of an AOV on the command line and in file names
+const char *aovName(Aov aov);
+
+// What the camera ray of a sample hit first, summed like the color
+struct AovSample
+{
+    Color albedo = Color(0);
+    Direction normal = Direction(0);
+    double depth = 0;
+    Color squared = Color(0);   // The sample color squared
+
+    AovSample &operator+=(const AovSample &other)
+    {
+        albedo += other.albedo;
+        normal += other.normal;
+        depth += other.depth;
+        squared += other.squared;
+        return *this;
+    }
+};
+
+struct FramebufferPixel
+{
+    float r, g, b, a;
+};
+
+// Linear (not gamma corrected) running sum of all samples taken per pixel,
+// stored as one contiguous row major float RGBA plane. The alpha channel
+// counts the samples of a pixel, this allows a render to be stopped at any
+// point (e.g. when the time budget runs out in the middle of a pass) and
+// still resolve to a correct image.
+//
+// A framebuffer can also cover only a tile of the image, it is still
+// addressed with image coordinates then.
+class Framebuffer
+{
+private:
+    int m_x = 0;
+    int m_y = 0;
+    int m_width = 0;
+    int m_height = 0;
+    uint32_t m_aovs = AOV_NONE;
+
+    // Rows are padded to a multiple of FRAMEBUFFER_ALIGNMENT bytes, the
+    // strides are in elements of the plane.
+    int m_stride = 0;
+    int m_depth_stride = 0;
+
+    // These either point into m_storage or into memory owned by someone else
+    // (a mapped checkpoint). Planes that are not enabled stay null.
+    FramebufferPixel *m_color = nullptr;
+    FramebufferPixel *m_albedo = nullptr;
+    FramebufferPixel *m_normal = nullptr;
+    FramebufferPixel *m_variance = nullptr;
+    float *m_depth = nullptr;
+
+    std::unique_ptr<uint8_t, decltype(&free)> m_storage{nullptr, &free};
+    size_t m_capacity = 0;
+
+    void setStorage(void *storage);
+    size_t index(int x, int y) const { return (size_t)(y - m_y) * m_stride + (x - m_x); }
+    size_t depthIndex(int x, int y) const { return (size_t)(y - m_y) * m_depth_stride + (x - m_x); }
+
+public:
+    Framebuffer() {}
+    Framebuffer(int width, int height, uint32_t aovs = AOV_NONE);
+    Framebuffer(int x, int y, int width, int height, uint32_t aovs);
+
+    // Use external, zero initialized, memory of storageSize() bytes that is
+    // aligned to FRAMEBUFFER_ALIGNMENT
+    Framebuffer(int width, int height, uint32_t aovs, void *storage);
+
+    Framebuffer(const Framebuffer &) = delete;
+    Framebuffer &operator=(const Framebuffer &) = delete;
+
+    static size_t storageSize(int width, int height, uint32_t aovs);
+
+    int x() const { return m_x; }
+    int y() const { return m_y; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    uint32_t aovs() const { return m_aovs; }
+    bool hasAov(Aov aov) const { return m_aovs & aov; }
+
+    // The pixels that share a cache line, in the plane with the smallest
+    // pixels. A line holds 4 RGBA pixels, or 16 of the depth plane.
+    int lineWidth() const { return FRAMEBUFFER_ALIGNMENT / (m_depth ? sizeof(float) : sizeof(FramebufferPixel)); }
+
+    // The raw planes, storageSize() bytes
+    uint8_t *data() { return reinterpret_cast<uint8_t *>(m_color); }
+    const uint8_t *data() const { return reinterpret_cast<const uint8_t *>(m_color); }
+    size_t size() const { return storageSize(m_width, m_height, m_aovs); }
+
+    // Move an owned framebuffer to another tile, the memory is only
+    // reallocated when the new tile is larger. The tile is cleared.
+    void setRegion(int x, int y, int width, int height);
+
+    void add(int x, int y, const Color &sum, int samples)
+    {
+        FramebufferPixel &pixel = m_color[index(x, y)];
+        pixel.r += sum.x();
+        pixel.g += sum.y();
+        pixel.b += sum.z();
+        pixel.a += samples;
+    }
+
+    void add(int x, int y, const AovSample &sum)
+    {
+        size_t idx = index(x, y);
+        if (m_albedo)
+        {
+            m_albedo[idx].r += sum.albedo.x();
+            m_albedo[idx].g += sum.albedo.y();
+            m_albedo[idx].b += sum.albedo.z();
+        }
+        if (m_normal)
+        {
+            m_normal[idx].r += sum.normal.x();
+            m_normal[idx].g += sum.normal.y();
+            m_normal[idx].b += sum.normal.z();
+        }
+        if (m_variance)
+        {
+            m_variance[idx].r += sum.squared.x();
+            m_variance[idx].g += sum.squared.y();
+            m_variance[idx].b += sum.squared.z();
+        }
+        if (m_depth)
+            m_depth[depthIndex(x, y)] += sum.depth;
+    }
+
+    int samples(int x, int y) const { return (int)m_color[index(x, y)].a; }
+
+    // The average linear color of a pixel
+    Color resolve(int x, int y) const;
+
+    // The average value of an AOV of a pixel, albedo and normal are colors,
+    // depth and samples are the same value in all channels. The variance is
+    // the one of the average color, so it goes down with more samples.
+    Color resolve(int x, int y, Aov aov) const;
+
+    // Turn the color or an AOV into a displayable 8 bit RGB image, row major
+    // starting at the bottom row. The color and albedo are gamma corrected,
+    // normals are mapped from [-1, 1], depth, samples and variance are
+    // scaled by their maximum.
+    void display(std::vector<uint8_t> &output) const;
+    void display(Aov aov, std::vector<uint8_t> &output) const;
+
+    // Add the area both framebuffers cover of other to this one, e.g. a tile
+    // to the whole image. Only the planes both have are merged. Threads may
+    // merge tiles that do not overlap at the same time.
+    void merge(const Framebuffer &other);
+
+    void clear();
+    void clear(int x, int y, int x_end, int y_end);
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <core.h>
+#include <vec3.h>
+
+#include <stdint.h>
+
+#define HDR_MIN_RLE_WIDTH   8
+#define HDR_MAX_RLE_WIDTH   0x7fff
+
+// A floating point RGB image, the pixels are stored row by row starting at
+// the top left. Floats instead of Colors keep large environment maps small.
+struct HdrImage
+{
+    int width = 0;
+    int height = 0;
+    std::vector<float> pixels;
+
+    Color at(int x, int y) const
+    {
+        const float *p = &pixels[((size_t)y * width + x) * 3];
+        return Color(p[0], p[1], p[2]);
+    }
+};
+
+// Radiance RGBE (.hdr) images, see "Real Pixels" by Greg Ward. Both flat
+// and run length encoded scanlines are supported, the old style run length
+// encoding is not.
+class Hdr
+{
+public:
+    static std::shared_ptr<HdrImage> read(std::string filename);
+};
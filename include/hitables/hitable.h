@@ -21,8 +21,15 @@ public:
     std::shared_ptr<Material> mat;
     double u;
     double v;
+
+    // The width of the ray cone at the hit in texture space
+    double footprint = 0;
     Hitable const * hitable;
 
+    // The index of the emissive triangle that was hit in the LightSampler,
+    // -1 for anything that is not sampled as a light
+    int light = -1;
+
     inline void set_face_normal(const Ray &ray, const Direction outward_normal)
     {
         front_face = dot(ray.direction(), outward_normal) < 0;
@@ -14,15 +14,20 @@ public:
     HitableList() {}
     HitableList(HitablePtr object) { add(object); }
     HitableList(const std::vector<HitablePtr>& objects) : m_objects(objects) {}
+    HitableList(std::vector<HitablePtr> objects, const AABB &box) : m_objects(std::move(objects)), m_box(box) {}
 
     void add(std::shared_ptr<HitableList> object)
     {
-        for (const auto &obj : object->objects())
-            add(obj);
+        add(object->objects(), object->m_box);
     }
     void add(HitablePtr object);
+
+    // Add objects of which the surrounding box is already known, so it is
+    // not grown one object at a time
+    void add(const std::vector<HitablePtr> &objects, AABB box);
+
     void clear() { m_objects.clear(); }
-    std::vector<HitablePtr> objects() const { return m_objects; }
+    const std::vector<HitablePtr> &objects() const { return m_objects; }
 
     bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
     bool boundingBox(AABB &bounding_box) const override;
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <hitables/hitable_list.h>
+#include <hitables/triangle.h>
+#include <shared_buffer.h>
+
+// Texture coordinates of a vertex, v goes up from the bottom of the image
+struct TexCoord
+{
+    float u;
+    float v;
+};
+
+// Vertex data can be shared between meshes, like the primitives of a glTF
+// file that use the same vertices or the copies of a mesh that are not
+// moved, or come straight from a mapped scene file, so buffers are shared
+template <typename T>
+using MeshBuffer = SharedBuffer<T>;
+
+// An indexed triangle mesh. The vertices are stored once and every triangle
+// is three 32 bit indices into them, so vertices shared between triangles
+// are not copied. The BVH still needs a hitable per triangle, those are
+// Triangles that refer back into the mesh, and the mesh is the list of them.
+//
+// Normals and texture coordinates per vertex are optional. Without normals
+// the mesh is flat shaded, without texture coordinates textures see the
+// barycentric coordinates of the hit.
+//
+// Positions and normals are stored as floats like in the scene files, so
+// they can stay in a mapped file and take half the memory. They are only
+// converted to double when a triangle is intersected.
+class Mesh : public HitableList
+{
+private:
+    MeshBuffer<Vec3f> m_positions;
+    MeshBuffer<uint32_t> m_indices;
+    MeshBuffer<Vec3f> m_normals;
+    MeshBuffer<TexCoord> m_texcoords;
+    std::shared_ptr<Material> m_mat;
+    std::vector<Triangle> m_triangles;
+
+    // The light index of every triangle, only emissive meshes have them
+    std::vector<int32_t> m_lights;
+
+public:
+    // Three indices per triangle, all of them have to be valid positions.
+    // Normals and texture coordinates need one value per position.
+    Mesh(MeshBuffer<Vec3f> positions, MeshBuffer<uint32_t> indices, std::shared_ptr<Material> mat,
+         MeshBuffer<Vec3f> normals = nullptr, MeshBuffer<TexCoord> texcoords = nullptr);
+
+    // The triangles point back at the mesh, so it cannot be copied
+    Mesh(const Mesh &) = delete;
+    Mesh &operator=(const Mesh &) = delete;
+
+    std::shared_ptr<Material> material() const { return m_mat; }
+    size_t triangleCount() const { return m_triangles.size(); }
+
+    bool hasNormals() const { return m_normals != nullptr; }
+    bool hasTexCoords() const { return m_texcoords != nullptr; }
+
+    const MeshBuffer<Vec3f> &positions() const { return m_positions; }
+    const MeshBuffer<uint32_t> &indices() const { return m_indices; }
+    const MeshBuffer<Vec3f> &normals() const { return m_normals; }
+    const MeshBuffer<TexCoord> &texcoords() const { return m_texcoords; }
+
+    uint32_t index(uint32_t triangle, int corner) const { return m_indices[3 * (size_t)triangle + corner]; }
+    Point3 vertex(uint32_t triangle, int corner) const { return Point3(m_positions[index(triangle, corner)]); }
+    Direction normal(uint32_t triangle, int corner) const { return Direction(m_normals[index(triangle, corner)]); }
+    const TexCoord &texcoord(uint32_t triangle, int corner) const { return m_texcoords[index(triangle, corner)]; }
+
+    // The index of a triangle in the LightSampler, it is handed to hits so
+    // the light that was hit does not have to be searched for. -1 when the
+    // triangle is not sampled as a light.
+    int light(uint32_t triangle) const { return m_lights.empty() ? -1 : m_lights[triangle]; }
+    void setLight(uint32_t triangle, int light)
+    {
+        m_lights.resize(m_triangles.size(), -1);
+        m_lights[triangle] = light;
+    }
+};
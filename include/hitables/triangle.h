@@ -2,23 +2,35 @@
 
 #include <hitables/hitable.h>
 
+class Mesh;
+
+// A triangle of a mesh. It only refers to the mesh and its index in it, the
+// vertices are stored once in the mesh and shared with its neighbours.
 class Triangle : public Hitable
 {
 private:
-    Point3 m_points[3];
-    std::shared_ptr<Material> m_mat;
+    const Mesh *m_mesh;
+    uint32_t m_index;
     const bool m_doublesided = true;
 
-protected:
-    virtual std::shared_ptr<Material> material() const { return m_mat; }
+    Point3 point(int corner) const;
+
+    // Normal and texture coordinates at the barycentric coordinates b1 and
+    // b2 of a hit
+    void setSurface(const Ray &r, double b1, double b2, const Direction &geometric_normal, HitRecord &rec) const;
 
 public:
-    Triangle(Point3 x, Point3 y, Point3 z, std::shared_ptr<Material> mat)
-        : m_points{x, y, z}, m_mat(mat) {}
+    virtual std::shared_ptr<Material> material() const;
+
+    Triangle(const Mesh *mesh, uint32_t index)
+        : m_mesh(mesh), m_index(index) {}
+
+    const Mesh *mesh() const { return m_mesh; }
+    uint32_t index() const { return m_index; }
 
-    Point3 x() const { return m_points[0]; }
-    Point3 y() const { return m_points[1]; }
-    Point3 z() const { return m_points[2]; }
+    Point3 x() const { return point(0); }
+    Point3 y() const { return point(1); }
+    Point3 z() const { return point(2); }
 
     Point3 center() const override;
     bool hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const override;
@@ -26,4 +38,4 @@ public:
 
     Point3 randomPointIn() const override;
     double pdf(const Ray &r) const override;
-};
\ No newline at end of file
+};
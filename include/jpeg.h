@@ -0,0 +1,19 @@
+#pragma once
+
+#include <core.h>
+#include <ldr_image.h>
+
+#include <stdint.h>
+
+// Baseline JPEG images (sequential DCT, Huffman coded, 8 bit samples), the
+// kind cameras and texture tools write by default. Gray and YCbCr images
+// with any chroma subsampling and restart markers are supported, chroma is
+// upsampled by repeating samples. Progressive and arithmetic coded images
+// are not.
+class Jpeg
+{
+public:
+    // Decode a JPEG image in memory, as embedded in a glTF file. Gray images
+    // get one channel, color images three.
+    static std::shared_ptr<LdrImage> read(const uint8_t *data, size_t size);
+};
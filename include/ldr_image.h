@@ -0,0 +1,18 @@
+#pragma once
+
+#include <core.h>
+
+#include <stdint.h>
+
+// An 8 bit image with 1 to 4 channels (gray, gray and alpha, RGB or RGBA),
+// the pixels are stored row by row starting at the top left, as decoded
+// from PNG and JPEG images
+struct LdrImage
+{
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    std::vector<uint8_t> pixels;
+
+    const uint8_t *at(int x, int y) const { return &pixels[((size_t)y * width + x) * channels]; }
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <core.h>
+
+// Walker's alias method (Vose's construction), picks an index proportional
+// to its weight in constant time with a single uniform sample.
+class AliasTable
+{
+private:
+    struct Bin
+    {
+        double probability;
+        int alias;
+    };
+
+    std::vector<Bin> m_bins;
+    std::vector<double> m_pmf;
+
+public:
+    AliasTable() {}
+    AliasTable(const std::vector<double> &weights);
+
+    int size() const { return m_bins.size(); }
+
+    // The probability that sample() returns index
+    double pmf(int index) const { return m_pmf[index]; }
+
+    int sample(double u) const;
+};
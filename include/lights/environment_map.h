@@ -0,0 +1,42 @@
+#pragma once
+
+#include <core.h>
+#include <vec3.h>
+#include <hdr.h>
+
+// An equirectangular environment map that lights the scene from infinitely
+// far away. The top row of the image is straight up (+y), the center of the
+// image looks along +x.
+//
+// Directions are importance sampled with a piecewise constant distribution
+// over the image, proportional to the luminance of the pixels times the
+// area they take up on the sphere. A row is picked with the marginal CDF,
+// then a column in that row with its conditional CDF. With
+// ENVIRONMENT_HALF_RES_CDF the distribution is built over blocks of 2x2
+// pixels, which needs a quarter of the memory.
+class EnvironmentMap
+{
+private:
+    std::shared_ptr<HdrImage> m_image;
+    double m_strength;
+
+    int m_rows;
+    int m_cols;
+
+    std::vector<float> m_conditional_cdf;   // m_rows * (m_cols + 1)
+    std::vector<float> m_marginal_cdf;      // m_rows + 1
+
+    // Image coordinates in [0, 1] and the sine of the polar angle of dir
+    static void toImage(const Direction &dir, double &u, double &v, double &sin_theta);
+
+public:
+    EnvironmentMap(std::shared_ptr<HdrImage> image, double strength = 1);
+
+    Color value(const Direction &dir) const;
+
+    // Sample a direction proportional to the brightness of the map
+    Direction sample(double u, double v) const;
+
+    // The solid angle density of sample() returning dir
+    double pdf(const Direction &dir) const;
+};
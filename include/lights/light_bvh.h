@@ -0,0 +1,63 @@
+#pragma once
+
+#include <core.h>
+#include <vec3.h>
+#include <bvh/aabb.h>
+
+#define LIGHT_BVH_BUCKETS 12
+
+// The bounds of a group of lights, the box that contains them, the cone
+// that contains their normals and their total power. See "Importance
+// Sampling of Many Lights with Adaptive Tree Splitting" by Conty and Kulla.
+struct LightBounds
+{
+    AABB box;
+    Direction axis;
+    double cos_theta_o;     // Spread of the normals around the axis
+    double cos_theta_e;     // How far past the normals the lights still emit
+    double power;
+    bool two_sided;
+
+    static LightBounds merge(const LightBounds &a, const LightBounds &b);
+
+    // An estimate of how much light this group contributes at point p
+    double importance(const Point3 &p) const;
+};
+
+struct LightBvhNode
+{
+    LightBounds bounds;
+
+    // Leaves hold a single light, interior nodes have their first child
+    // right after them and the second one at child_or_light.
+    int child_or_light;
+    bool leaf;
+};
+
+// A bounding volume hierarchy over the lights, used to pick a light that is
+// likely to be important for a shading point in logarithmic time. Lights
+// that are far away or face away from the point are rarely picked.
+class LightBvh
+{
+private:
+    std::vector<LightBvhNode> m_nodes;
+    std::vector<int> m_parents;
+    std::vector<int> m_light_leaf;
+
+    int build(std::vector<std::pair<int, LightBounds>> &lights, int start, int end, int parent);
+
+    // The probability of taking the first child of node at p
+    double firstChildProbability(int node, const Point3 &p) const;
+
+public:
+    LightBvh() {}
+    LightBvh(const std::vector<LightBounds> &lights);
+
+    bool empty() const { return m_nodes.empty(); }
+
+    // Pick a light for point p, pmf is set to the probability of picking it
+    int sample(const Point3 &p, double u, double &pmf) const;
+
+    // The probability of sample() picking light at point p
+    double pmf(const Point3 &p, int light) const;
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <core.h>
+#include <vec3.h>
+#include <ray.h>
+#include <hitables/hitable_list.h>
+#include <lights/alias_table.h>
+#include <lights/light_bvh.h>
+#include <config.h>
+
+// The light sampler keeps its own copy of the vertices, so it does not
+// depend on how the geometry itself is stored.
+struct EmissiveTriangle
+{
+    Point3 p0;
+    Direction edge1;
+    Direction edge2;
+    Direction normal;
+    double area;
+    double power;
+};
+
+// Next event estimation over all emissive triangles of the scene. A light
+// is picked with a probability proportional to its area times its emitted
+// power, then a point is sampled uniformly over its area. With LIGHT_BVH the
+// light is instead picked through a light hierarchy, which also takes the
+// distance and orientation of the lights to the shading point into account.
+class LightSampler
+{
+private:
+    std::vector<EmissiveTriangle> m_triangles;
+#if LIGHT_BVH
+    LightBvh m_bvh;
+#else
+    AliasTable m_table;
+#endif
+
+public:
+    LightSampler() {}
+    LightSampler(const std::vector<std::shared_ptr<HitableList>> &lights);
+
+    bool empty() const { return m_triangles.empty(); }
+    int size() const { return m_triangles.size(); }
+
+    // Returns the (not normalized) direction from origin to a point on a
+    // light, light is set to the index of that light
+    Direction sample(const Point3 &origin, double u_light, double u, double v, int &light) const;
+
+    // The solid angle density of sample() picking the point of the hit from
+    // origin. Only the light that is seen counts, a sample of a light behind
+    // it is blocked. A hit that is not on a light has no density.
+    double pdf(const Point3 &origin, const HitRecord &hit) const;
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <core.h>
+
+#include <stdint.h>
+
+// A read only memory mapping of a whole file. Pages are only read from disk
+// when they are touched, so loaders can use the file contents in place
+// instead of copying them into buffers first. The mapping is released when
+// the object goes out of scope.
+class MappedFile
+{
+private:
+    int m_fd = -1;
+    const uint8_t *m_data = nullptr;
+    size_t m_size = 0;
+
+public:
+    MappedFile(std::string filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool isOpen() const { return m_data != nullptr; }
+
+    const uint8_t *data() const { return m_data; }
+    size_t size() const { return m_size; }
+};
@@ -3,13 +3,14 @@
 #include <ray.h>
 #include <vec3.h>
 #include <hitables/hitable.h>
-#include <pdfs/pdf.h>
 
 struct ScatterRecord
 {
+    // Materials that scatter in a single direction (perfect mirrors and
+    // glass) set skip_pdf and the scattered ray, these can not be sampled
+    // or evaluated for any other direction.
     bool skip_pdf;
     Ray scattered_ray;
-    std::shared_ptr<PDF> pdf;
 };
 
 class Material
@@ -17,5 +18,17 @@ class Material
 public:
     virtual bool scatter(const Ray &r, const HitRecord &rec, ScatterRecord &srec) const = 0;
     virtual bool emitted(double u, double v, const Point3 &p, Color& emission) const { return false; }
-    virtual Color eval(const Ray &in, const HitRecord &rec, const ScatterRecord &srec) const = 0;
-};
\ No newline at end of file
+
+    // The BSDF times the cosine term for light arriving from direction out
+    // and leaving along -in.direction(), out has to be normalized.
+    virtual Color eval(const Ray &in, const HitRecord &rec, const Direction &out) const = 0;
+
+    // The solid angle density of sample() returning direction out
+    virtual double pdf(const Ray &in, const HitRecord &rec, const Direction &out) const = 0;
+
+    // Pick a direction to continue the path in, importance sampled by the BSDF
+    virtual Direction sample(const Ray &in, const HitRecord &rec) const = 0;
+
+    // The base color of the surface, for the albedo AOV
+    virtual Color albedo(const HitRecord &rec) const { return Color(1); }
+};
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <pdfs/pdf.h>
-#include <random.h>
+#include <sampler.h>
 #include <onb.h>
 
 class CosinePDF : public PDF
@@ -20,8 +20,7 @@ public:
 
     Direction generate() const override
     {
-        double r1 = randomGen.getDouble();
-        double r2 = randomGen.getDouble();
+        auto [r1, r2] = sampler->get2D();
 
         double phi = 2 * pi * r1;
         Direction dir = Direction(cos(phi) * sqrt(r2), sin(phi) * sqrt(r2), sqrt(1 - r2));
@@ -2,7 +2,7 @@
 
 #include <pdfs/pdf.h>
 #include <materials/helpers.h>
-#include <random.h>
+#include <sampler.h>
 
 class FresnelPDF : public PDF
 {
@@ -24,7 +24,7 @@ public:
 
     Direction generate() const override
     {
-        if (randomGen.getDouble() < m_mix)
+        if (sampler->get1D() < m_mix)
         {
             return m_p1->generate();
         }
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <pdfs/pdf.h>
-#include <random.h>
+#include <sampler.h>
 #include <hitables/hitable.h>
 #include <hitables/hitable_list.h>
 #include <onb.h>
@@ -36,9 +36,11 @@ public:
         Direction v = normalize(-m_view.direction());
 
         // TODO: see https://schuttejoe.github.io/post/ggximportancesamplingpart2/ for better sampler
-        double r0 = randomGen.getDouble();
-        double r1 = randomGen.getDouble();
-        double a2 = m_roughness * m_roughness;
+        // Same alpha = roughness^2 remapping as distributionGGX, otherwise
+        // value() would not be the density of the generated directions.
+        auto [r0, r1] = sampler->get2D();
+        double a = m_roughness * m_roughness;
+        double a2 = a * a;
         double theta = acos(sqrtf((1 - r0) / ((a2 - 1) * r0 + 1)));
         double phi = 2 * pi * r1;
         // H is the microfacet normal
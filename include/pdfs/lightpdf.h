@@ -1,55 +1,56 @@
 #pragma once
 
-#include <pdfs/hitablepdf.h>
-
-#define USE_AABB_FOR_LIGHT_SAMPLING 1
-
-class LightPDF : public HitablePDF
+#include <lights/light_sampler.h>
+#include <lights/environment_map.h>
+#include <sampler.h>
+
+// Samples the emissive triangles and the environment map, when both are
+// present each of them is picked half of the time. A sample only counts when
+// the light it picked is what is seen in its direction, so the density is
+// that of the light that is seen and not of everything along the direction.
+class LightPDF
 {
+private:
+    Point3 m_origin;
+    const LightSampler &m_lights;
+    const EnvironmentMap *m_environment;
+    double m_environment_probability;
+
 public:
+    LightPDF(const Point3 &origin, const LightSampler &lights, const EnvironmentMap *environment = nullptr)
+        : m_origin(origin), m_lights(lights), m_environment(environment)
+    {
+        if (!m_environment)
+            m_environment_probability = 0;
+        else
+            m_environment_probability = m_lights.empty() ? 1 : 0.5;
+    }
 
-    LightPDF(const Point3& origin, const std::shared_ptr<HitableList>& lst) : HitablePDF(origin, lst) {}
+    // The density of generate() giving the light seen in direction dir, hit
+    // is what the ray in that direction hits first, or null when it hits
+    // nothing and the environment is seen
+    double value(const Direction &dir, const HitRecord *hit) const
+    {
+        if (!hit)
+            return m_environment_probability > 0 ? m_environment_probability * m_environment->pdf(dir) : 0;
+        return (1 - m_environment_probability) * m_lights.pdf(m_origin, *hit);
+    }
 
-    double value(const Direction &dir) const override
+    // light is set to the index of the emissive triangle that was picked, or
+    // -1 when the environment was
+    Direction generate(int &light) const
     {
-        HitRecord rec;
-        // TODO: this is very inefficient because we do double the ray intersects (once here over the hitlist and once in the pdf of each object)
-        Ray r(m_origin, dir);
-        if (!m_hitable_list->hit(r, 0.001, inf, rec))
+        double u_light = sampler->get1D();
+        auto [u, v] = sampler->get2D();
+
+        if (u_light < m_environment_probability)
         {
-            // Return very small value that is not 0 because that would cause div's by zero 
-            // and thus nans.
-            return 0.00001;
+            light = -1;
+            return m_environment->sample(u, v);
         }
 
-        double distance_squared = rec.t * rec.t;
-        double cosine = fabs(dot(dir, rec.normal));
-
-#if USE_AABB_FOR_LIGHT_SAMPLING
-        AABB box;
-        m_hitable_list->boundingBox(box);
-        box.scale(0.90);
-
-        //double pdf = 1.0 / box.volume();
-
-        // I am really not sure about this *4 in the pdf, this is kinda a hack because there
-        // is too little light falloff.
-        double pdf = 1.0 / box.surfaceArea() * 4;
-#else
-        double pdf = m_hitable_list->pdf(r);
-#endif
-
-        return pdf * distance_squared;
+        // Reuse the rest of the sample to pick the triangle
+        u_light = (u_light - m_environment_probability) / (1 - m_environment_probability);
+        return m_lights.sample(m_origin, u_light, u, v, light);
     }
-#if USE_AABB_FOR_LIGHT_SAMPLING
-    Direction generate() const override
-    {
-        AABB box;
-        m_hitable_list->boundingBox(box);
-        box.scale(0.90);
-
-        return box.randomPointIn() - m_origin;
-    }
-#endif
-
-};
\ No newline at end of file
+};
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <pdfs/pdf.h>
-#include <random.h>
+#include <sampler.h>
 
 class MixturePDF : public PDF
 {
@@ -21,7 +21,7 @@ public:
 
     Direction generate() const override
     {
-        if (randomGen.getDouble() > m_mix)
+        if (sampler->get1D() > m_mix)
         {
             return m_p1->generate();
         }
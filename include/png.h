@@ -0,0 +1,32 @@
+#pragma once
+
+#include <core.h>
+#include <ldr_image.h>
+
+#include <stdint.h>
+
+// Deflate level of the image data, 0 only writes stored blocks which is
+// the fastest but as large as a BMP
+#define PNG_COMPRESSION_LEVEL   1
+
+// The image data is split over IDAT chunks of at most this many bytes
+#define PNG_MAX_CHUNK_SIZE      (1 << 24)
+
+// 8 bit RGB PNG images. Every row gets the filter that makes it the
+// smallest by the usual heuristic (smallest sum of absolute differences),
+// the rows are filtered and compressed in parallel.
+//
+// Reading supports every color type and bit depth of the standard and
+// Adam7 interlacing. 16 bit samples are cut to 8 bits, palette images are
+// expanded to RGB, or to RGBA when the palette has transparency.
+class Png
+{
+public:
+    // Write a row major 8 bit RGB image that starts at the bottom row, as
+    // given by Framebuffer::display
+    static int write(const std::vector<uint8_t> &pixels, std::string filename, int width, int height,
+                     int level = PNG_COMPRESSION_LEVEL);
+
+    // Decode a PNG image in memory, as embedded in a glTF file
+    static std::shared_ptr<LdrImage> read(const uint8_t *data, size_t size);
+};
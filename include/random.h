@@ -64,17 +64,22 @@ public:
         return (x << k) | (x >> (64 - k));
     }
 
-    RandomGenerator()
+    // Renders have to be reproducible, so an unseeded generator always starts
+    // from the same state instead of reading /dev/urandom.
+    RandomGenerator() : RandomGenerator(0) {}
+
+    // Deterministically seed the generator, the state is filled using
+    // splitmix64 as recommended by the xoshiro authors.
+    RandomGenerator(uint64_t seed)
     {
-        std::ifstream file("/dev/urandom");
-        if (!file.is_open()) {
-            ERROR("Could not open /dev/urandom");
-            exit(1);
+        for (int i = 0; i < 4; i++)
+        {
+            seed += 0x9e3779b97f4a7c15;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            m_state[i] = z ^ (z >> 31);
         }
-
-        file.read(reinterpret_cast<char*>(m_state), sizeof(uint64_t) * 4);
-
-        file.close();
     }
 
     uint64_t getUint64()
@@ -13,15 +13,29 @@ protected:
     // speed up operations such as AABB hit testing.
     Direction m_inverted_dir;
 
+    // The ray is the center of a cone that is cone_width wide at the origin
+    // and grows by cone_spread per unit of t, for a normalized direction
+    // that is the angle of the cone. Texture lookups use the width of the
+    // cone where it hits a surface to pick a mip level.
+    double m_cone_width = 0;
+    double m_cone_spread = 0;
+
 public:
     Ray() {}
     Ray(const Point3 &origin, const Direction &direction)
         : m_origin(origin), m_dir(direction), m_inverted_dir(1.0 / direction) {}
+    Ray(const Point3 &origin, const Direction &direction, double cone_width, double cone_spread)
+        : m_origin(origin), m_dir(direction), m_inverted_dir(1.0 / direction),
+          m_cone_width(cone_width), m_cone_spread(cone_spread) {}
 
     Point3 origin() const { return m_origin; }
     Direction direction() const { return m_dir; }
     Direction inverted_direction() const { return m_inverted_dir; }
 
+    double coneWidth(double t) const { return m_cone_width + t * m_cone_spread; }
+    double coneSpread() const { return m_cone_spread; }
+    bool hasCone() const { return m_cone_width > 0 || m_cone_spread > 0; }
+
     Point3 at(double t) const
     {
         // P(t) = A + tB where A is our origin and B is our directional component
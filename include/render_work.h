@@ -0,0 +1,51 @@
+#pragma once
+
+#include <core.h>
+
+#include <queue>
+#include <mutex>
+#include <optional>
+
+struct RenderWorkBlock
+{
+    int x;
+    int y;
+    int x_end;
+    int y_end;
+
+    // The samples [sample_start, sample_end) of every pixel in this block
+    int sample_start;
+    int sample_end;
+};
+
+class RenderWorkQueue
+{
+private:
+    std::queue<RenderWorkBlock> m_queue;
+    std::mutex m_mutex;
+
+public:
+    RenderWorkQueue(std::queue<RenderWorkBlock> &work) : m_queue(work) {}
+    std::optional<RenderWorkBlock> pop()
+    {
+        m_mutex.lock();
+
+        if (m_queue.size() == 0)
+        {
+            m_mutex.unlock();
+            return {};
+        }
+
+        RenderWorkBlock block = m_queue.front();
+        m_queue.pop();
+
+        m_mutex.unlock();
+        return block;
+    }
+
+    int size()
+    {
+        // I dont think this has to be locked?
+        return m_queue.size();
+    }
+};
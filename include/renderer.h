@@ -5,53 +5,20 @@
 #include <camera.h>
 #include <ray.h>
 #include <scene.h>
-#include <color_array.h>
+#include <framebuffer.h>
+#include <exr.h>
+#include <checkpoint.h>
+#include <sampler.h>
 
 #include <hitables/hitable_list.h>
 #include <bvh/bvh.h>
+#include <lights/light_sampler.h>
+#include <lights/environment_map.h>
+#include <render_work.h>
+#include <distributed/coordinator.h>
 
-#include <queue>
-#include <optional>
-
-struct RenderWorkBlock
-{
-    int x;
-    int y;
-    int x_end;
-    int y_end;
-};
-
-class RenderWorkQueue
-{
-private:
-    std::queue<RenderWorkBlock> m_queue;
-    std::mutex m_mutex;
-
-public:
-    RenderWorkQueue(std::queue<RenderWorkBlock> &work) : m_queue(work) {}
-    std::optional<RenderWorkBlock> pop()
-    {
-        m_mutex.lock();
-
-        if (m_queue.size() == 0)
-        {
-            m_mutex.unlock();
-            return {};
-        }
-
-        RenderWorkBlock block = m_queue.front();
-        m_queue.pop();
-
-        m_mutex.unlock();
-        return block;
-    }
-
-    int size()
-    {
-        // I dont think this has to be locked?
-        return m_queue.size();
-    }
-};
+#include <atomic>
+#include <chrono>
 
 class Renderer
 {
@@ -64,23 +31,82 @@ private:
 
     Color m_background = Color(0);
 
-    std::unique_ptr<ColorArray> m_screen_buf;
+    // Replaces the background color when set, it is sampled as a light
+    std::shared_ptr<EnvironmentMap> m_environment;
+    SamplerType m_sampler_type = SamplerType::Sobol;
+
+    // Progressive rendering, every pass renders m_pass_samples samples for all
+    // pixels. When this is 0 all samples are rendered in a single pass.
+    int m_pass_samples = 0;
+    double m_time_budget = 0;
+    double m_write_interval = 0;
+    std::string m_intermediate_file;
+
+    // When set the image is rendered in bands that are written to this file
+    // as soon as they are done, instead of keeping the whole framebuffer
+    std::string m_stream_file;
+
+    std::chrono::steady_clock::time_point m_deadline;
+    std::atomic<long> m_rendered_samples = 0;
+
+    std::string m_checkpoint_file;
+    double m_checkpoint_interval = 60;
+    bool m_resume = false;
+
+    // All random numbers of a sample are derived from the seed and the pixel
+    // and sample index, so the image does not depend on the thread scheduling.
+    uint32_t m_seed = 0;
+
+    // Distributed rendering, the passes are handed out to worker processes
+    int m_worker_amount = 0;
+    std::vector<std::string> m_worker_command;
+    std::unique_ptr<Coordinator> m_coordinator;
+
+    // The AOV planes rendered next to the color, see Aov
+    uint32_t m_aovs = AOV_NONE;
+
+    // Used when the output file is an EXR image
+    ExrCompression m_exr_compression = ExrCompression::Zip;
+    bool m_exr_half = true;
+
+    // The checkpoint owns the memory of the framebuffer when checkpointing
+    // The framebuffer of the whole image is only allocated once the render
+    // starts, distributed workers never need it.
+    std::unique_ptr<Checkpoint> m_checkpoint;
+    std::unique_ptr<Framebuffer> m_framebuffer;
+
+#if USE_COLOR_BUFFER_PER_THREAD
+    // Every thread renders into a framebuffer of just the tile it works on,
+    // which is merged into the shared framebuffer when the tile is done.
+    std::vector<std::unique_ptr<Framebuffer>> m_thread_bufs;
+#endif
 
     BvhManager m_world;
+    LightSampler m_lights;
     Scene m_scene;
 
 private:
-    Color rayColor(const Ray &r, int bounce, int x, int y, int sample);
-
-    void generate_bvh();
-
-    void renderPixel(ColorArray* array, int x, int y);
+    // scatter_pdf is the density the previous bounce sampled this ray with,
+    // or 0 when it could not have been found by sampling the lights. The
+    // first hit of a camera ray is stored in aov when it is given.
+    Color rayColor(const Ray &r, int bounce, int x, int y, int sample, double scatter_pdf, AovSample *aov = nullptr);
+    Color missColor(const Ray &r, double scatter_pdf);
+    bool hasLights() const { return !m_lights.empty() || m_environment; }
+
+    bool deadlineReached() const;
+    int setupCheckpoint();
+
+    // Render the samples of the region into target, locally or on the workers
+    bool renderPass(RenderWorkBlock region, Framebuffer &target);
+    int renderStreamed();
+    // The samples are added to buffer, target is the framebuffer they end up
+    // in. These are the same unless threads render into their own tile.
+    void renderPixel(const Framebuffer &target, Framebuffer *buffer, int x, int y, int sample_start, int sample_end);
 #if THREADING_IMPLEMENTATION == THREAD_IMPL_NAIVE
-    void renderThread(ColorArray* buffer, int thread_idx, double *percentage);
-    void calcProgress(double *percentages);
+    void renderThread(Framebuffer *target, Framebuffer *buffer, int thread_idx, RenderWorkBlock region, bool *complete);
 #endif
 #if THREADING_IMPLEMENTATION == THREAD_IMPL_OPENMP_BLOCKS
-    void renderBlock(ColorArray* buffer, RenderWorkBlock work);
+    void renderBlock(const Framebuffer &target, Framebuffer *buffer, RenderWorkBlock work);
 #endif
 
 public:
@@ -90,11 +116,35 @@ public:
     void set_samples_per_pixel(int samples);
     void set_max_bounces(int max_bounces);
     void set_dimensions(int width, int height);
+    void set_aovs(uint32_t aovs);
+    void set_exr_output(ExrCompression compression, bool half);
     void set_background_color(Color bg);
+    void set_environment(std::string file, double strength);
+    void set_sampler(SamplerType type);
+    void set_seed(uint32_t seed);
+    void set_pass_samples(int samples);
+    void set_time_budget(double seconds);
+    void set_intermediate_output(std::string file, double interval);
+    void set_stream_output(std::string file);
+    void set_checkpoint(std::string file, double interval);
+    void set_resume(std::string file);
+    void set_workers(int workers, std::vector<std::string> command);
 
     Scene &get_scene() { return m_scene; }
+    int get_width() const { return m_width; }
+    int get_height() const { return m_height; }
+    uint32_t get_aovs() const { return m_aovs; }
+
+    void generate_bvh();
+
+    // Render the samples of the region into target, this is what both a
+    // single render pass and a distributed worker job come down to. Target
+    // has to cover the region, but can be just a tile of the image.
+    bool renderRegion(RenderWorkBlock region, Framebuffer &target);
 
     int render();
 
+    // Write the image, every AOV is written next to it with its name
+    // appended to the file name
     int writeToFile(std::string file);
 };
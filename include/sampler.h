@@ -0,0 +1,86 @@
+#pragma once
+
+#include <core.h>
+#include <vec3.h>
+
+#include <utility>
+
+enum class SamplerType
+{
+    Random,
+    Sobol,
+    BlueNoise,
+};
+
+// A sampler hands out the sample values a path needs, indexed by pixel,
+// sample number and dimension. Every call to get1D() or get2D() uses the
+// next dimension, so as long as a path asks for its values in the same
+// order the samples of a pixel are well distributed over all dimensions.
+// The values are a pure function of the seed and this index, which keeps
+// renders identical no matter which thread renders which pixel.
+class Sampler
+{
+protected:
+    uint32_t m_seed;
+    uint32_t m_pixel_hash = 0;
+    uint32_t m_sample = 0;
+    uint32_t m_dimension = 0;
+    int m_x = 0;
+    int m_y = 0;
+
+public:
+    Sampler(uint32_t seed) : m_seed(seed) {}
+    virtual ~Sampler() = default;
+
+    static std::unique_ptr<Sampler> create(SamplerType type, uint32_t seed);
+
+    void startPixelSample(int x, int y, int sample);
+
+    // Unique key of the current pixel sample, used to seed everything else
+    // that needs random numbers along the path.
+    uint64_t sampleKey() const { return (uint64_t)m_pixel_hash << 32 | m_sample; }
+
+    virtual double get1D() = 0;
+    virtual std::pair<double, double> get2D() = 0;
+};
+
+// Independent random numbers for every dimension, each one is a hash of
+// the seed, pixel, sample and dimension (a counter based generator).
+class RandomSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+    double get1D() override;
+    std::pair<double, double> get2D() override;
+};
+
+// Owen scrambled Sobol points, see "Practical Hash-based Owen Scrambling"
+// by Brent Burley. Only the first two Sobol dimensions are used, the higher
+// dimensions are padded with independently shuffled and scrambled copies.
+class SobolSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+    double get1D() override;
+    std::pair<double, double> get2D() override;
+};
+
+// All pixels share the same scrambled Sobol sequence, which is rotated per
+// pixel by a blue noise mask. The error at low sample counts is then
+// distributed as blue noise over the image, which looks a lot less noisy.
+class BlueNoiseSampler : public Sampler
+{
+public:
+    using Sampler::Sampler;
+
+    double get1D() override;
+    std::pair<double, double> get2D() override;
+};
+
+// Map a 2d sample to a point in the unit disk, using the concentric mapping
+// so the stratification of the sample points is kept.
+Point3 sampleUnitDisk(double u, double v);
+
+extern thread_local std::unique_ptr<Sampler> sampler;
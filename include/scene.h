@@ -2,6 +2,8 @@
 
 #include <core.h>
 #include <hitables/hitable_list.h>
+#include <hitables/mesh.h>
+#include <bvh/bvh.h>
 #include <camera.h>
 #include <list>
 
@@ -9,6 +11,8 @@ class Scene
 {
 private:
     std::vector<std::shared_ptr<HitableList>> m_lights;
+    std::vector<std::shared_ptr<Mesh>> m_meshes;
+    std::shared_ptr<const FlatBvh> m_bvh;
     HitableList m_hitlist;
     Camera m_camera = Camera(Point3(0, 0, 1), Point3(0, 0, 0));
 
@@ -32,6 +36,29 @@ public:
         return m_hitlist;
     }
 
+    // The scene keeps the mesh alive, the hitable list only holds its triangles
+    void addMesh(std::shared_ptr<Mesh> mesh)
+    {
+        m_hitlist.add(mesh);
+        m_meshes.push_back(mesh);
+    }
+
+    const std::vector<std::shared_ptr<Mesh>> &getMeshes() const
+    {
+        return m_meshes;
+    }
+
+    // A BVH that came with the scene file, used instead of building one
+    void setBvh(std::shared_ptr<const FlatBvh> bvh)
+    {
+        m_bvh = bvh;
+    }
+
+    std::shared_ptr<const FlatBvh> getBvh() const
+    {
+        return m_bvh;
+    }
+
     std::vector<std::shared_ptr<HitableList>> &getLightList()
     {
     return m_lights;
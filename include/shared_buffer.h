@@ -0,0 +1,43 @@
+#pragma once
+
+#include <core.h>
+
+#include <memory>
+#include <vector>
+
+// A read only array that keeps whatever holds its elements alive. That is
+// either a vector that was filled while loading a file, or a memory mapped
+// file whose contents are used in place. Copies share the elements.
+template <typename T>
+class SharedBuffer
+{
+private:
+    std::shared_ptr<const void> m_owner;
+    const T *m_data = nullptr;
+    size_t m_size = 0;
+
+public:
+    SharedBuffer() {}
+    SharedBuffer(std::nullptr_t) {}
+
+    SharedBuffer(std::shared_ptr<const std::vector<T>> vector)
+        : m_owner(vector), m_data(vector ? vector->data() : nullptr), m_size(vector ? vector->size() : 0) {}
+    SharedBuffer(std::shared_ptr<std::vector<T>> vector)
+        : SharedBuffer(std::shared_ptr<const std::vector<T>>(vector)) {}
+
+    // size elements at data, which stay valid as long as owner is alive
+    SharedBuffer(std::shared_ptr<const void> owner, const T *data, size_t size)
+        : m_owner(owner), m_data(data), m_size(size) {}
+
+    explicit operator bool() const { return m_owner != nullptr; }
+    bool operator==(std::nullptr_t) const { return m_owner == nullptr; }
+    bool operator!=(std::nullptr_t) const { return m_owner != nullptr; }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const T *data() const { return m_data; }
+
+    const T &operator[](size_t i) const { return m_data[i]; }
+    const T *begin() const { return m_data; }
+    const T *end() const { return m_data + m_size; }
+};
@@ -2,18 +2,81 @@
 
 #include <vec3.h>
 #include <color_array.h>
+#include <ldr_image.h>
 #include <textures/texture.h>
+#include <textures/mipmap.h>
 #include <bmp.h>
 
+// An image with mip levels stored in the given texel layout, the lookups
+// are compiled for that layout
+template <typename Texel>
 class ImageTexture : public Texture
 {
 private:
-    std::shared_ptr<ColorArray> m_color_array;
+    MipMap<Texel> m_mipmap;
 
 public:
     ImageTexture(std::string image_file) : ImageTexture(Bmp::read(image_file)) {}
-    ImageTexture(std::shared_ptr<ColorArray> colorarray) : m_color_array(colorarray) { WARN(colorarray->at(5)[5].to_string()); 
-    DEBUG("width: " << m_color_array->width() << " height: " << m_color_array->height()); }
 
-    Color value(double u, double v, const Point3 &p) const;
-};
\ No newline at end of file
+    ImageTexture(std::shared_ptr<ColorArray> colorarray)
+        // The color array is stored column by column
+        : m_mipmap(colorarray->width(), colorarray->height(), [&](int x, int y) { return colorarray->at(x)[y]; })
+    {
+        DEBUG("width: " << width() << " height: " << height() << " levels: " << m_mipmap.levels());
+    }
+
+    // An 8 bit image with sRGB encoded colors, like the textures of glTF
+    // files. The texels start at the bottom row, the image at the top. Gray
+    // images have one or two channels.
+    ImageTexture(const LdrImage &image)
+        : m_mipmap(image.width, image.height, [&](int x, int y) {
+              const uint8_t *pixel = image.at(x, image.height - 1 - y);
+              const float *values = srgb8_to_linear.values;
+              if (image.channels < 3)
+                  return Color(values[pixel[0]]);
+              return Color(values[pixel[0]], values[pixel[1]], values[pixel[2]]);
+          })
+    {
+        DEBUG("width: " << width() << " height: " << height() << " levels: " << m_mipmap.levels());
+    }
+
+    ImageTexture(MipMap<Texel> mipmap) : m_mipmap(std::move(mipmap)) {}
+
+    const MipMap<Texel> &mipmap() const { return m_mipmap; }
+    int width() const { return m_mipmap.width(); }
+    int height() const { return m_mipmap.height(); }
+
+    // The texture repeats outside of the 0 to 1 range
+    Color value(double u, double v, const Point3 &p) const override { return filteredValue(u, v, 0, p); }
+    Color filteredValue(double u, double v, double width, const Point3 &p) const override
+    {
+        return m_mipmap.filter(u, v, width);
+    }
+};
+
+// 8 bit images keep their texels as they are, with alpha
+template <>
+ImageTexture<TexelSrgb8>::ImageTexture(const LdrImage &image);
+
+// The layouts images are stored in, see TEXTURE_LDR_FORMAT and
+// TEXTURE_HDR_FORMAT
+using LdrImageTexture = ImageTexture<LdrTexel>;
+using HdrImageTexture = ImageTexture<HdrTexel>;
+
+// Calls visitor with the image texture in the layout it has, returns false
+// if the texture is not an image texture
+template <typename Visitor>
+bool visitImageTexture(const std::shared_ptr<Texture> &texture, const Visitor &visitor)
+{
+    if (auto image = std::dynamic_pointer_cast<ImageTexture<TexelSrgb8>>(texture))
+        visitor(image);
+    else if (auto image = std::dynamic_pointer_cast<ImageTexture<TexelBc1>>(texture))
+        visitor(image);
+    else if (auto image = std::dynamic_pointer_cast<ImageTexture<TexelRgb16f>>(texture))
+        visitor(image);
+    else if (auto image = std::dynamic_pointer_cast<ImageTexture<TexelRgb32f>>(texture))
+        visitor(image);
+    else
+        return false;
+    return true;
+}
\ No newline at end of file
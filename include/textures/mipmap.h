@@ -0,0 +1,214 @@
+#pragma once
+
+#include <vec3.h>
+#include <config.h>
+#include <shared_buffer.h>
+#include <textures/texel.h>
+
+#include <stdint.h>
+
+// The filters below work on anything that can return the decoded texel at
+// x, y of a level, so images that are not in memory as a whole use them too
+
+// u and v have to be in the 0 to 1 range
+template <typename Fetch>
+Color nearestFilter(int width, int height, double u, double v, const Fetch &fetch)
+{
+    // u or v just below a whole number can round up to 1
+    int x = std::min(static_cast<int>(u * width), width - 1);
+    int y = std::min(static_cast<int>(v * height), height - 1);
+    return fetch(x, y);
+}
+
+// u and v have to be in the 0 to 1 range, the texels at the edges are
+// blended with the ones on the other side
+template <typename Fetch>
+Color bilinearFilter(int width, int height, double u, double v, const Fetch &fetch)
+{
+    double x = u * width - 0.5;
+    double y = v * height - 0.5;
+    double fx = std::floor(x);
+    double fy = std::floor(y);
+    double tx = x - fx;
+    double ty = y - fy;
+
+    int x0 = static_cast<int>(fx);
+    int y0 = static_cast<int>(fy);
+    int x1 = x0 + 1 >= width ? 0 : x0 + 1;
+    int y1 = y0 + 1 >= height ? 0 : y0 + 1;
+    x0 = x0 < 0 ? width - 1 : x0;
+    y0 = y0 < 0 ? height - 1 : y0;
+
+    Color bottom = lerp(fetch(x0, y0), fetch(x1, y0), tx);
+    Color top = lerp(fetch(x0, y1), fetch(x1, y1), tx);
+    return lerp(bottom, top, ty);
+}
+
+// The color over a footprint as wide as the given width in texture space,
+// the level is picked so one of its texels is about that wide. The image
+// has the same members as MipMap.
+template <typename Image>
+Color mipMapFilter(const Image &image, double u, double v, double width)
+{
+    u -= std::floor(u);
+    v -= std::floor(v);
+
+#if TEXTURE_FILTERING == TEXTURE_FILTER_NEAREST
+    return image.nearest(0, u, v);
+#else
+    double lod = 0;
+    if (width > 0)
+        lod = std::clamp(std::log2(width * std::max(image.width(), image.height())), 0.0, image.levels() - 1.0);
+
+#if TEXTURE_FILTERING == TEXTURE_FILTER_BILINEAR
+    return image.bilinear(static_cast<int>(lod + 0.5), u, v);
+#else
+    int level = static_cast<int>(lod);
+    double t = lod - level;
+    if (t <= 0)
+        return image.bilinear(level, u, v);
+    return lerp(image.bilinear(level, u, v), image.bilinear(level + 1, u, v), t);
+#endif
+#endif
+}
+
+// An image with every smaller level down to a single texel, each level
+// halves the size of the one before it. Texels are stored row by row
+// starting at the bottom left, so v goes up with the rows. Layouts with
+// larger blocks store the blocks that way, the blocks at the right and top
+// edges are padded with copies of the last column and row. The texture
+// repeats outside of the 0 to 1 range.
+template <typename Texel>
+class MipMap
+{
+public:
+    static constexpr int block_size = Texel::block_size;
+
+    struct Level
+    {
+        int width;
+        int height;
+        SharedBuffer<Texel> texels;
+
+        int blocksX() const { return blockCount(width); }
+        int blocksY() const { return blockCount(height); }
+        const Texel &block(int x, int y) const { return texels[(size_t)y * blocksX() + x]; }
+
+        Color fetch(int x, int y) const
+        {
+            if constexpr (block_size == 1)
+                return texels[(size_t)y * width + x].decode(0, 0);
+            else
+                return block(x / block_size, y / block_size).decode(x % block_size, y % block_size);
+        }
+    };
+
+    static int blockCount(int size) { return (size + block_size - 1) / block_size; }
+
+private:
+    std::vector<Level> m_levels;
+
+    // Encodes the blocks of a level from the colors fetch returns for its
+    // texels
+    template <typename Fetch>
+    static Level encode(int width, int height, const Fetch &fetch)
+    {
+        int blocks_x = blockCount(width);
+        int blocks_y = blockCount(height);
+        auto texels = std::make_shared<std::vector<Texel>>((size_t)blocks_x * blocks_y);
+
+#pragma omp parallel for
+        for (int by = 0; by < blocks_y; by++)
+        {
+            Color colors[block_size * block_size];
+            for (int bx = 0; bx < blocks_x; bx++)
+            {
+                for (int y = 0; y < block_size; y++)
+                    for (int x = 0; x < block_size; x++)
+                        colors[y * block_size + x] = fetch(std::min(bx * block_size + x, width - 1),
+                                                           std::min(by * block_size + y, height - 1));
+                (*texels)[(size_t)by * blocks_x + bx] = Texel::encode(colors);
+            }
+        }
+
+        return {width, height, texels};
+    }
+
+    static Level downsample(const Level &level)
+    {
+        // Odd sizes repeat the last row or column instead of wrapping around
+        return encode(std::max(level.width / 2, 1), std::max(level.height / 2, 1), [&](int x, int y) {
+            int x0 = std::min(2 * x, level.width - 1);
+            int x1 = std::min(2 * x + 1, level.width - 1);
+            int y0 = std::min(2 * y, level.height - 1);
+            int y1 = std::min(2 * y + 1, level.height - 1);
+            return (level.fetch(x0, y0) + level.fetch(x1, y0) + level.fetch(x0, y1) + level.fetch(x1, y1)) / 4;
+        });
+    }
+
+    void addLevels()
+    {
+        m_levels.reserve(levelCount(width(), height()));
+        while (m_levels.back().width > 1 || m_levels.back().height > 1)
+            m_levels.push_back(downsample(m_levels.back()));
+    }
+
+public:
+    MipMap() {}
+
+    // The smaller levels are made by averaging blocks of 2x2 texels
+    MipMap(int width, int height, std::shared_ptr<std::vector<Texel>> texels)
+    {
+        m_levels.push_back({width, height, texels});
+        addLevels();
+    }
+
+    // The first level is encoded from the colors fetch(x, y) returns
+    template <typename Fetch>
+    MipMap(int width, int height, const Fetch &fetch)
+    {
+        m_levels.push_back(encode(width, height, fetch));
+        addLevels();
+    }
+
+    // Levels that were made before, like the ones in a scene file
+    MipMap(std::vector<Level> levels) : m_levels(std::move(levels)) {}
+
+    static int levelCount(int width, int height)
+    {
+        int count = 1;
+        for (int size = std::max(width, height); size > 1; size /= 2)
+            count++;
+        return count;
+    }
+
+    explicit operator bool() const { return !m_levels.empty(); }
+
+    int width() const { return m_levels[0].width; }
+    int height() const { return m_levels[0].height; }
+    int levels() const { return m_levels.size(); }
+    const Level &level(int i) const { return m_levels[i]; }
+
+    // The bytes the texels of every level take
+    size_t bytes() const
+    {
+        size_t bytes = 0;
+        for (const Level &level : m_levels)
+            bytes += level.texels.size() * sizeof(Texel);
+        return bytes;
+    }
+
+    Color nearest(int level, double u, double v) const
+    {
+        const Level &l = m_levels[level];
+        return nearestFilter(l.width, l.height, u, v, [&](int x, int y) { return l.fetch(x, y); });
+    }
+
+    Color bilinear(int level, double u, double v) const
+    {
+        const Level &l = m_levels[level];
+        return bilinearFilter(l.width, l.height, u, v, [&](int x, int y) { return l.fetch(x, y); });
+    }
+
+    Color filter(double u, double v, double width) const { return mipMapFilter(*this, u, v, width); }
+};
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <vec3.h>
+#include <config.h>
+
+#include <stdint.h>
+
+// The layouts image textures can store their texels in. A layout stores
+// blocks of block_size x block_size texels: encode() makes a block out of
+// its colors (row by row) and decode() returns the color of the texel at
+// x, y in the block. Most layouts have blocks of a single texel. The
+// format is what scene files know the layout by.
+
+// The linear value of every 8 bit sRGB value
+struct SrgbTable
+{
+    float values[256];
+    SrgbTable();
+};
+extern const SrgbTable srgb8_to_linear;
+
+// The closest 8 bit sRGB value of a linear value
+uint8_t linearToSrgb8(double value);
+
+uint16_t floatToHalf(float value);
+float halfToFloat(uint16_t value);
+
+// Linear colors stored as floats
+struct TexelRgb32f
+{
+    static constexpr int format = TEXEL_RGB32F;
+    static constexpr int block_size = 1;
+
+    float r, g, b;
+
+    static TexelRgb32f encode(const Color *c) { return {(float)c->x(), (float)c->y(), (float)c->z()}; }
+    Color decode(int x, int y) const { return Color(r, g, b); }
+};
+
+// Linear colors stored as half floats, half the size of floats with about
+// three significant digits
+struct TexelRgb16f
+{
+    static constexpr int format = TEXEL_RGB16F;
+    static constexpr int block_size = 1;
+
+    uint16_t r, g, b;
+
+    static TexelRgb16f encode(const Color *c) { return {floatToHalf(c->x()), floatToHalf(c->y()), floatToHalf(c->z())}; }
+    Color decode(int x, int y) const { return Color(halfToFloat(r), halfToFloat(g), halfToFloat(b)); }
+};
+
+// sRGB encoded 8 bit colors like PNG and JPEG images have, decoded with a
+// table lookup. Alpha is kept but not used.
+struct TexelSrgb8
+{
+    static constexpr int format = TEXEL_SRGB8;
+    static constexpr int block_size = 1;
+
+    uint8_t r, g, b, a;
+
+    static TexelSrgb8 encode(const Color *c) { return {linearToSrgb8(c->x()), linearToSrgb8(c->y()), linearToSrgb8(c->z()), 255}; }
+    Color decode(int x, int y) const { return Color(srgb8_to_linear.values[r], srgb8_to_linear.values[g], srgb8_to_linear.values[b]); }
+};
+
+// 4x4 sRGB texels in 8 bytes like BC1 (DXT1) textures: two 5:6:5 end
+// points and for every texel 2 bits that pick one of them or a blend of a
+// third or two thirds between them. Blocks with the end points in the
+// other order have a single half way blend and black instead, as in BC1,
+// the encoder only makes those when both end points are the same.
+struct TexelBc1
+{
+    static constexpr int format = TEXEL_BC1;
+    static constexpr int block_size = 4;
+
+    uint16_t color0, color1;
+    uint32_t indices;
+
+    static TexelBc1 encode(const Color *c);
+
+    Color decode(int x, int y) const
+    {
+        int index = (indices >> (2 * (y * 4 + x))) & 3;
+        int r0 = expand5(color0 >> 11), g0 = expand6((color0 >> 5) & 63), b0 = expand5(color0 & 31);
+        int r1 = expand5(color1 >> 11), g1 = expand6((color1 >> 5) & 63), b1 = expand5(color1 & 31);
+
+        int r, g, b;
+        if (index < 2)
+        {
+            r = index ? r1 : r0;
+            g = index ? g1 : g0;
+            b = index ? b1 : b0;
+        }
+        else if (color0 > color1)
+        {
+            int w0 = index == 2 ? 2 : 1;
+            r = (w0 * r0 + (3 - w0) * r1) / 3;
+            g = (w0 * g0 + (3 - w0) * g1) / 3;
+            b = (w0 * b0 + (3 - w0) * b1) / 3;
+        }
+        else if (index == 2)
+        {
+            r = (r0 + r1) / 2;
+            g = (g0 + g1) / 2;
+            b = (b0 + b1) / 2;
+        }
+        else
+            return Color(0);
+
+        return Color(srgb8_to_linear.values[r], srgb8_to_linear.values[g], srgb8_to_linear.values[b]);
+    }
+
+    static int expand5(int value) { return value << 3 | value >> 2; }
+    static int expand6(int value) { return value << 2 | value >> 4; }
+};
+
+// The layouts that images are stored in, 8 bit images and all others
+#if TEXTURE_LDR_FORMAT == TEXEL_BC1
+using LdrTexel = TexelBc1;
+#else
+using LdrTexel = TexelSrgb8;
+#endif
+
+#if TEXTURE_HDR_FORMAT == TEXEL_RGB32F
+using HdrTexel = TexelRgb32f;
+#else
+using HdrTexel = TexelRgb16f;
+#endif
@@ -6,6 +6,11 @@ class Texture
 {
 public:
     virtual Color value(double u, double v, const Point3 &p) const = 0;
+
+    // The color averaged over a footprint of the given width in texture
+    // space, like the cross section of a ray cone. Textures without
+    // prefiltered versions just return the color at u, v.
+    virtual Color filteredValue(double u, double v, double width, const Point3 &p) const { return value(u, v, p); }
 };
 
 class SolidColor : public Texture
@@ -17,5 +22,27 @@ public:
     SolidColor(double r, double g, double b) : SolidColor(Color(r,g,b)) {}
     SolidColor(Color c) : m_color(c) {}
 
+    Color color() const { return m_color; }
     Color value(double u, double v, const Point3 &p) const override { return m_color; }
+};
+
+// A texture multiplied by a color, like the color factor of a glTF material
+// applied to its texture
+class ScaledTexture : public Texture
+{
+private:
+    std::shared_ptr<Texture> m_texture;
+    Color m_scale;
+
+public:
+    ScaledTexture(std::shared_ptr<Texture> texture, Color scale) : m_texture(texture), m_scale(scale) {}
+
+    std::shared_ptr<Texture> texture() const { return m_texture; }
+    Color scale() const { return m_scale; }
+
+    Color value(double u, double v, const Point3 &p) const override { return m_texture->value(u, v, p) * m_scale; }
+    Color filteredValue(double u, double v, double width, const Point3 &p) const override
+    {
+        return m_texture->filteredValue(u, v, width, p) * m_scale;
+    }
 };
\ No newline at end of file
@@ -0,0 +1,205 @@
+#pragma once
+
+#include <config.h>
+#include <textures/texture.h>
+#include <textures/image_texture.h>
+#include <textures/mipmap.h>
+
+#include <atomic>
+#include <cstdio>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+template <typename Texel>
+class TiledTexture;
+
+// Keeps the texels of image textures in a file as tiles of
+// TEXTURE_TILE_SIZE x TEXTURE_TILE_SIZE, only the tiles that were used
+// recently are kept in memory. That memory is split into shards that each
+// keep their least recently used tiles under their own lock, so threads
+// looking up different tiles rarely wait for each other.
+class TextureCache : public std::enable_shared_from_this<TextureCache>
+{
+private:
+    struct Entry
+    {
+        uint64_t key;
+        std::shared_ptr<const std::vector<uint8_t>> tile;
+    };
+
+    struct Shard
+    {
+        std::mutex mutex;
+        std::list<Entry> lru;
+        std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+        size_t bytes = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+
+    Shard m_shards[TEXTURE_CACHE_SHARDS];
+    size_t m_capacity;
+
+    // Lookups that hit the tiles a thread remembers never reach a shard.
+    // Every thread counts them in its own counter, which only it writes.
+    std::mutex m_memo_mutex;
+    std::list<std::atomic<uint64_t>> m_memo_hits;
+
+    std::atomic<uint64_t> *memoHitCounter();
+
+    // The tiles are written to a temporary file that is removed once it is closed
+    FILE *m_file = nullptr;
+    std::mutex m_file_mutex;
+    uint64_t m_file_size = 0;
+    uint32_t m_texture_count = 0;
+
+    // Appends to the tile file, m_file_mutex has to be locked
+    uint64_t write(const void *bytes, size_t size);
+
+public:
+    // Keeps at most about capacity bytes of tiles in memory
+    TextureCache(size_t capacity);
+    ~TextureCache();
+
+    TextureCache(const TextureCache &) = delete;
+    TextureCache &operator=(const TextureCache &) = delete;
+
+    // Moves the levels of an image to the tile file, the returned texture
+    // reads them back through the cache
+    template <typename Texel>
+    std::shared_ptr<Texture> add(const MipMap<Texel> &mipmap);
+
+    // A tile is known by its texture, its level and its index in the level
+    static uint64_t key(uint32_t texture, int level, uint64_t tile)
+    {
+        return (uint64_t)texture << 32 | (uint64_t)level << 27 | tile;
+    }
+
+    // The size bytes of the tile at offset in the file. The tile stays valid
+    // until the calling thread looks up other tiles.
+    const uint8_t *tile(uint64_t key, uint64_t offset, size_t size);
+
+    uint64_t hits();
+    uint64_t misses();
+    size_t bytes();
+    size_t capacity() const { return m_capacity; }
+};
+
+// The cache the image textures of the scene are moved to, only set when
+// rendering with --texture-cache
+extern std::shared_ptr<TextureCache> texture_cache;
+
+// The texture itself, or a tiled copy of it if there is a texture cache
+template <typename Texel>
+std::shared_ptr<Texture> cacheTexture(std::shared_ptr<ImageTexture<Texel>> texture)
+{
+    if (!texture_cache)
+        return texture;
+    return texture_cache->add(texture->mipmap());
+}
+
+// An image texture whose texels are looked up through a texture cache. A
+// tile holds TEXTURE_TILE_SIZE / block_size blocks in each direction.
+template <typename Texel>
+class TiledTexture : public Texture
+{
+public:
+    static constexpr int block_size = Texel::block_size;
+    static constexpr int tile_blocks = TEXTURE_TILE_SIZE / block_size;
+    static_assert(TEXTURE_TILE_SIZE % block_size == 0, "Tiles have to hold whole blocks");
+
+    struct Level
+    {
+        int width;
+        int height;
+        int tiles_x;
+        uint64_t offset;
+    };
+
+    static constexpr size_t tile_bytes = tile_blocks * tile_blocks * sizeof(Texel);
+
+private:
+    std::shared_ptr<TextureCache> m_cache;
+    uint32_t m_id;
+    std::vector<Level> m_levels;
+
+    Color texel(int level, int x, int y) const
+    {
+        const Level &l = m_levels[level];
+        uint64_t tile = (uint64_t)(y / TEXTURE_TILE_SIZE) * l.tiles_x + x / TEXTURE_TILE_SIZE;
+        const Texel *texels = reinterpret_cast<const Texel *>(
+            m_cache->tile(TextureCache::key(m_id, level, tile), l.offset + tile * tile_bytes, tile_bytes));
+        int bx = x % TEXTURE_TILE_SIZE / block_size;
+        int by = y % TEXTURE_TILE_SIZE / block_size;
+        return texels[by * tile_blocks + bx].decode(x % block_size, y % block_size);
+    }
+
+public:
+    TiledTexture(std::shared_ptr<TextureCache> cache, uint32_t id, std::vector<Level> levels)
+        : m_cache(cache), m_id(id), m_levels(std::move(levels)) {}
+
+    int width() const { return m_levels[0].width; }
+    int height() const { return m_levels[0].height; }
+    int levels() const { return m_levels.size(); }
+
+    Color nearest(int level, double u, double v) const
+    {
+        const Level &l = m_levels[level];
+        return nearestFilter(l.width, l.height, u, v, [&](int x, int y) { return texel(level, x, y); });
+    }
+
+    Color bilinear(int level, double u, double v) const
+    {
+        const Level &l = m_levels[level];
+        return bilinearFilter(l.width, l.height, u, v, [&](int x, int y) { return texel(level, x, y); });
+    }
+
+    Color value(double u, double v, const Point3 &p) const override { return filteredValue(u, v, 0, p); }
+    Color filteredValue(double u, double v, double width, const Point3 &p) const override
+    {
+        return mipMapFilter(*this, u, v, width);
+    }
+};
+
+template <typename Texel>
+std::shared_ptr<Texture> TextureCache::add(const MipMap<Texel> &mipmap)
+{
+    // The tiles of a level have to follow each other in the file
+    std::lock_guard<std::mutex> lock(m_file_mutex);
+    uint32_t id = m_texture_count++;
+
+    // Tiles at the right and top edges are padded to the full size
+    constexpr int tile_blocks = TiledTexture<Texel>::tile_blocks;
+    std::vector<typename TiledTexture<Texel>::Level> levels;
+    std::vector<Texel> tile(tile_blocks * tile_blocks);
+    for (int i = 0; i < mipmap.levels(); i++)
+    {
+        const auto &level = mipmap.level(i);
+        int tiles_x = (level.blocksX() + tile_blocks - 1) / tile_blocks;
+        int tiles_y = (level.blocksY() + tile_blocks - 1) / tile_blocks;
+
+        uint64_t offset = 0;
+        for (int ty = 0; ty < tiles_y; ty++)
+        {
+            for (int tx = 0; tx < tiles_x; tx++)
+            {
+                std::fill(tile.begin(), tile.end(), Texel{});
+                int x0 = tx * tile_blocks;
+                int y0 = ty * tile_blocks;
+                int columns = std::min(tile_blocks, level.blocksX() - x0);
+                int rows = std::min(tile_blocks, level.blocksY() - y0);
+                for (int y = 0; y < rows; y++)
+                    std::copy(&level.block(x0, y0 + y), &level.block(x0, y0 + y) + columns, &tile[y * tile_blocks]);
+
+                uint64_t tile_offset = write(tile.data(), tile.size() * sizeof(Texel));
+                if (tx == 0 && ty == 0)
+                    offset = tile_offset;
+            }
+        }
+
+        levels.push_back({level.width, level.height, tiles_x, offset});
+    }
+
+    return std::make_shared<TiledTexture<Texel>>(shared_from_this(), id, levels);
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <vec3.h>
+#include <vec4.h>
+
+// An affine transform as a 4x4 matrix, as used by the nodes of a glTF
+// scene. Points get the translation and directions do not. Normals are
+// transformed by the inverse transpose so they stay perpendicular to the
+// surface when the transform scales unevenly.
+class Transform
+{
+private:
+    // Row major, the translation is the last column
+    double m[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+
+public:
+    Transform() {}
+
+    static Transform translation(const Vec3d &t)
+    {
+        Transform transform;
+        for (int i = 0; i < 3; i++)
+            transform.m[i][3] = t[i];
+        return transform;
+    }
+
+    static Transform scale(const Vec3d &s)
+    {
+        Transform transform;
+        for (int i = 0; i < 3; i++)
+            transform.m[i][i] = s[i];
+        return transform;
+    }
+
+    // The rotation of a unit quaternion
+    static Transform rotation(const Quaternion &q)
+    {
+        double x = q.x(), y = q.y(), z = q.z(), w = q.w();
+
+        Transform transform;
+        transform.m[0][0] = 1 - 2 * (y * y + z * z);
+        transform.m[0][1] = 2 * (x * y - z * w);
+        transform.m[0][2] = 2 * (x * z + y * w);
+        transform.m[1][0] = 2 * (x * y + z * w);
+        transform.m[1][1] = 1 - 2 * (x * x + z * z);
+        transform.m[1][2] = 2 * (y * z - x * w);
+        transform.m[2][0] = 2 * (x * z - y * w);
+        transform.m[2][1] = 2 * (y * z + x * w);
+        transform.m[2][2] = 1 - 2 * (x * x + y * y);
+        return transform;
+    }
+
+    // 16 values column by column, the way glTF stores a matrix
+    static Transform fromColumnMajor(const double *values)
+    {
+        Transform transform;
+        for (int column = 0; column < 4; column++)
+        {
+            for (int row = 0; row < 4; row++)
+                transform.m[row][column] = values[column * 4 + row];
+        }
+        return transform;
+    }
+
+    // The transform that applies other first and then this one
+    Transform operator*(const Transform &other) const
+    {
+        Transform transform;
+        for (int row = 0; row < 4; row++)
+        {
+            for (int column = 0; column < 4; column++)
+            {
+                double sum = 0;
+                for (int k = 0; k < 4; k++)
+                    sum += m[row][k] * other.m[k][column];
+                transform.m[row][column] = sum;
+            }
+        }
+        return transform;
+    }
+
+    Point3 point(const Point3 &p) const
+    {
+        return direction(p) + Point3(m[0][3], m[1][3], m[2][3]);
+    }
+
+    Direction direction(const Direction &d) const
+    {
+        return Direction(m[0][0] * d.x() + m[0][1] * d.y() + m[0][2] * d.z(),
+                         m[1][0] * d.x() + m[1][1] * d.y() + m[1][2] * d.z(),
+                         m[2][0] * d.x() + m[2][1] * d.y() + m[2][2] * d.z());
+    }
+
+    // The result is not normalized. The cofactor matrix is the inverse
+    // transpose times the determinant, the sign of the determinant keeps
+    // normals of mirrored meshes on the right side.
+    Direction normal(const Direction &n) const
+    {
+        double c[3][3];
+        for (int row = 0; row < 3; row++)
+        {
+            for (int column = 0; column < 3; column++)
+            {
+                int r0 = (row + 1) % 3, r1 = (row + 2) % 3;
+                int c0 = (column + 1) % 3, c1 = (column + 2) % 3;
+                c[row][column] = m[r0][c0] * m[r1][c1] - m[r0][c1] * m[r1][c0];
+            }
+        }
+
+        double sign = determinant() < 0 ? -1 : 1;
+        return sign * Direction(c[0][0] * n.x() + c[0][1] * n.y() + c[0][2] * n.z(),
+                                c[1][0] * n.x() + c[1][1] * n.y() + c[1][2] * n.z(),
+                                c[2][0] * n.x() + c[2][1] * n.y() + c[2][2] * n.z());
+    }
+
+    // Of the rotation and scale part
+    double determinant() const
+    {
+        return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+               m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+               m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    }
+
+    // A transform that only moves things leaves directions and normals as
+    // they are
+    bool isTranslation() const
+    {
+        for (int row = 0; row < 4; row++)
+        {
+            for (int column = 0; column < 3; column++)
+            {
+                if (m[row][column] != (row == column ? 1 : 0))
+                    return false;
+            }
+        }
+        return m[3][3] == 1;
+    }
+
+    bool isIdentity() const
+    {
+        return isTranslation() && m[0][3] == 0 && m[1][3] == 0 && m[2][3] == 0;
+    }
+};
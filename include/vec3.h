@@ -14,6 +14,10 @@ public:
 
     Vec3(T x) : Vec3(x, x, x) {}
 
+    // Converts between precisions, like float vertex data to double for hits
+    template <class U>
+    explicit Vec3(const Vec3<U> &v) : e{(T)v.x(), (T)v.y(), (T)v.z()} {}
+
     T x() const { return e[0]; }
     T y() const { return e[1]; }
     T z() const { return e[2]; }
@@ -86,6 +90,8 @@ using Point3 = Vec3<double>;
 using Color = Vec3<double>;
 using Direction = Vec3<double>;
 using Vec3d = Vec3<double>;
+// Compact storage for large arrays like mesh vertices, math is done in double
+using Vec3f = Vec3<float>;
 
 template <class T>
 inline Vec3<T> operator+(const Vec3<T> &x, const Vec3<T> &y)
@@ -207,6 +213,13 @@ inline Vec3<T> pow(Vec3<T> a, double x)
     return Vec3<T>(pow(a.x(), x), pow(a.y(), x), pow(a.z(), x));
 }
 
+// The perceived brightness of a linear rgb color
+template <class T>
+inline T luminance(Vec3<T> c)
+{
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 template <class T>
 static inline T det(Vec3<T> a, Vec3<T> b, Vec3<T> c)
 {
@@ -1,9 +1,11 @@
 #include <bmp.h>
 
+#include <cstring>
+
 // This code is a little ugly and pretty c style ish but
 // it will do for now.
 
-int Bmp::write(ColorArray *color_array, std::string filename, int width, int height)
+int Bmp::write(const std::vector<uint8_t> &pixels, std::string filename, int width, int height)
 {
     std::ofstream output;
     output.open(filename, std::ios::out | std::ios::binary);
@@ -11,18 +13,27 @@ int Bmp::write(ColorArray *color_array, std::string filename, int width, int hei
     if (!output.is_open())
         return -1;
 
-    // Write the first header
+    // Every row in the pixel array has to be padded to 4 bytes.
+    size_t row_size = ((size_t)width * 3 + 3) & ~(size_t)3;
+    size_t data_offset = sizeof(struct bmp_hdr) +      // Header 1
+                         sizeof(struct bmp_dib_hdr);   // Header 2
+
+    // The whole file is put together in memory and written at once, the
+    // padding is already zero.
+    std::vector<uint8_t> file(data_offset + row_size * height);
+
+    // The first header
     struct bmp_hdr header;
     header.id[0] = BMP_HDR_ID_0;
     header.id[1] = BMP_HDR_ID_1;
-    header.size = 0; // This will be set at the end.
-
-    header.image_data_offset = sizeof(struct bmp_hdr) +    // Header 1
-                               sizeof(struct bmp_dib_hdr); // Header 2
+    header.size = file.size();
+    header.reserved[0] = 0;
+    header.reserved[1] = 0;
+    header.image_data_offset = data_offset;
 
-    output.write((const char *)&header, sizeof(struct bmp_hdr));
+    memcpy(&file[0], &header, sizeof(struct bmp_hdr));
 
-    // Write the second header
+    // The second header
     struct bmp_dib_hdr dib;
     dib.size = BMP_DIB_SIZE;
     dib.image_width = width;
@@ -36,28 +47,25 @@ int Bmp::write(ColorArray *color_array, std::string filename, int width, int hei
     dib.used_colors_cnt = 0;
     dib.important_colors_cnt = 0;
 
-    output.write((const char *)&dib, sizeof(struct bmp_dib_hdr));
+    memcpy(&file[sizeof(struct bmp_hdr)], &dib, sizeof(struct bmp_dib_hdr));
 
+    // Both start at the bottom row, BMP stores BGR
+#pragma omp parallel for
     for (int j = 0; j < height; j++)
     {
+        const uint8_t *src = &pixels[(size_t)j * width * 3];
+        uint8_t *dst = &file[data_offset + j * row_size];
+
         for (int i = 0; i < width; i++)
         {
-            Color &color = color_array->at(i)[j];
-            output.put(static_cast<char>(255.999 * color[2]));
-            output.put(static_cast<char>(255.999 * color[1]));
-            output.put(static_cast<char>(255.999 * color[0]));
+            dst[3 * i + 0] = src[3 * i + 2];
+            dst[3 * i + 1] = src[3 * i + 1];
+            dst[3 * i + 2] = src[3 * i + 0];
         }
-
-        // Every row in the pixel array has to be padded to 4 bytes.
-        if (width % 4)
-            output.seekp(4 - (width % 4), std::ios::end);
     }
 
-    int size = output.tellp();
-    output.seekp(2, std::ios::beg);
-    output.write((const char *)&size, 4);
-
-    return 0;
+    output.write((const char *)file.data(), file.size());
+    return output.good() ? 0 : -1;
 }
 
 #define READ_ERR(x)                                \
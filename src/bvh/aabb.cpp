@@ -1,6 +1,6 @@
 #include <bvh/aabb.h>
 #include <vec3.h>
-#include <random.h>
+#include <sampler.h>
 #include <hitables/hitable.h>
 #include <config.h>
 
@@ -81,7 +81,8 @@ AABB AABB::surroundingBox(AABB &b0, AABB &b1)
 
 Point3 AABB::randomPointIn() const
 {
-    return randomGen.getPoint3() * (m_max - m_min) + m_min;
+    auto [u, v] = sampler->get2D();
+    return Point3(u, v, sampler->get1D()) * (m_max - m_min) + m_min;
 }
 
 double AABB::volume() const
@@ -1,6 +1,8 @@
 #include <bvh/bvh.h>
 #include <random.h>
 
+#include <functional>
+
 #include <sys/mman.h>
 #include <unistd.h>
 
@@ -183,16 +185,17 @@ bool BvhManager::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec)
 }
 
 #if BVH_FIRST_HIT_CACHING
-bool BvhManager::cachedHit(int x, int y, int sample, const Ray &ray, double t_min, double t_max, HitRecord &rec)
+bool BvhManager::cachedHit(int x, int y, const Ray &ray, double t_min, double t_max, HitRecord &rec)
 {
     HitCacheRecord &cached = m_cache[x][y];
 
-    if (sample >= m_cache_cutoff_sample)
+    if (cached.probes() >= m_cache_cutoff_sample)
     {
         return cached.hit(ray, t_min, t_max, rec);
     }
     else
     {
+        cached.addProbe();
         bool hit = m_top->hit(ray, t_min, t_max, rec);
 
         if (hit && !cached.contains(rec.hitable))
@@ -237,16 +240,173 @@ BvhNode *BvhManager::allocate_node()
     return reinterpret_cast<BvhNode *>(m_nodes - sizeof(BvhNode));
 }
 
-BvhManager::BvhManager(const HitableList &list, int width, int height, int samples_per_pixel)
+void BvhManager::setupCache(int width, int height, int samples_per_pixel)
 {
     m_cache = std::vector<std::vector<HitCacheRecord>>(width, std::vector<HitCacheRecord>(height, HitCacheRecord()));
 
-    m_cache_cutoff_sample = static_cast<int>(static_cast<double>(samples_per_pixel) * FIRST_HIT_CACHE_FRAC);
+    // At least one full traversal is needed, otherwise low sample counts end
+    // up with empty caches and nothing is ever hit.
+    m_cache_cutoff_sample = std::max(1, static_cast<int>(static_cast<double>(samples_per_pixel) * FIRST_HIT_CACHE_FRAC));
+}
 
+void BvhManager::build(const HitableList &list)
+{
 #if BVH_SAH
     m_top = BvhNode::createTree(list.objects(), *this);
 #else
     m_top = allocate_node();
     m_top = new (m_top) BvhNode(list.objects(), 0, list.objects().size(), *this);
 #endif
-}
\ No newline at end of file
+}
+
+BvhManager::BvhManager(const HitableList &list, int width, int height, int samples_per_pixel)
+{
+    setupCache(width, height, samples_per_pixel);
+    build(list);
+}
+
+BvhManager::BvhManager(const HitableList &list, const FlatBvh &bvh, int width, int height, int samples_per_pixel)
+{
+    setupCache(width, height, samples_per_pixel);
+
+    m_top = unflatten(list, bvh);
+    if (m_top == nullptr)
+    {
+        WARN("The stored BVH does not match the scene, building a new one");
+        build(list);
+    }
+}
+
+HitablePtr BvhManager::unflatten(const HitableList &list, const FlatBvh &bvh)
+{
+    const std::vector<HitablePtr> &objects = list.objects();
+    if (bvh.object_count != objects.size())
+        return nullptr;
+
+    // Every reference is checked before anything is allocated, so a stored
+    // BVH that does not fit leaves no half built tree behind. Children come
+    // after their parent, a child before its parent would make a loop, those
+    // are rejected.
+    auto valid = [&](uint32_t reference, size_t parent) {
+        uint32_t index = reference & FLAT_BVH_INDEX_MASK;
+        switch (reference >> FLAT_BVH_TYPE_SHIFT)
+        {
+        case FLAT_BVH_NODE:
+            return index < bvh.nodes.size() && index > parent;
+        case FLAT_BVH_OBJECT:
+            return index < objects.size();
+        case FLAT_BVH_LIST:
+        {
+            if (index >= bvh.lists.size())
+                return false;
+
+            const FlatBvhList &range = bvh.lists[index];
+            if (range.begin >= range.end || range.end > bvh.list_objects.size())
+                return false;
+
+            for (uint32_t i = range.begin; i < range.end; i++)
+            {
+                if (bvh.list_objects[i] >= objects.size())
+                    return false;
+            }
+            return true;
+        }
+        }
+        return false;
+    };
+
+    for (size_t i = 0; i < bvh.nodes.size(); i++)
+    {
+        if (!valid(bvh.nodes[i].left, i) || !valid(bvh.nodes[i].right, i))
+            return nullptr;
+    }
+
+    // The root is the first node, or a single object or list when the tree
+    // has no nodes
+    bool root_is_node = (bvh.root >> FLAT_BVH_TYPE_SHIFT) == FLAT_BVH_NODE;
+    if (root_is_node ? bvh.root != 0 || bvh.nodes.empty() : !valid(bvh.root, 0))
+        return nullptr;
+
+    // Going backwards every child is done before the node that refers to it
+    std::vector<HitablePtr> nodes(bvh.nodes.size(), nullptr);
+    auto resolve = [&](uint32_t reference) -> HitablePtr {
+        uint32_t index = reference & FLAT_BVH_INDEX_MASK;
+        switch (reference >> FLAT_BVH_TYPE_SHIFT)
+        {
+        case FLAT_BVH_NODE:
+            return nodes[index];
+        case FLAT_BVH_OBJECT:
+            return objects[index];
+        default:
+        {
+            const FlatBvhList &range = bvh.lists[index];
+            std::vector<HitablePtr> leaf;
+            for (uint32_t i = range.begin; i < range.end; i++)
+                leaf.push_back(objects[bvh.list_objects[i]]);
+            return new HitableList(leaf);
+        }
+        }
+    };
+
+    for (size_t i = bvh.nodes.size(); i-- > 0;)
+    {
+        const FlatBvhNode &node = bvh.nodes[i];
+        nodes[i] = new (allocate_node()) BvhNode(node.box, resolve(node.left), resolve(node.right));
+    }
+
+    return root_is_node ? nodes[0] : resolve(bvh.root);
+}
+
+FlatBvh BvhManager::flatten(const HitableList &list) const
+{
+    std::unordered_map<const Hitable *, uint32_t> object_index;
+    for (size_t i = 0; i < list.objects().size(); i++)
+        object_index[list.objects()[i]] = i;
+
+    auto nodes = std::make_shared<std::vector<FlatBvhNode>>();
+    auto lists = std::make_shared<std::vector<FlatBvhList>>();
+    auto list_objects = std::make_shared<std::vector<uint32_t>>();
+
+    std::function<uint32_t(HitablePtr)> add = [&](HitablePtr hitable) -> uint32_t {
+        auto found = object_index.find(hitable);
+        if (found != object_index.end())
+            return FLAT_BVH_OBJECT << FLAT_BVH_TYPE_SHIFT | found->second;
+
+        if (auto node = dynamic_cast<const BvhNode *>(hitable))
+        {
+            // The index is taken before the children are added, so they come
+            // after their parent
+            uint32_t index = nodes->size();
+            nodes->push_back({});
+            node->boundingBox((*nodes)[index].box);
+            uint32_t left = add(node->left());
+            uint32_t right = add(node->right());
+            (*nodes)[index].left = left;
+            (*nodes)[index].right = right;
+            return FLAT_BVH_NODE << FLAT_BVH_TYPE_SHIFT | index;
+        }
+
+        if (auto leaf = dynamic_cast<const HitableList *>(hitable))
+        {
+            FlatBvhList range;
+            range.begin = list_objects->size();
+            for (HitablePtr object : leaf->objects())
+                list_objects->push_back(object_index.at(object));
+            range.end = list_objects->size();
+
+            lists->push_back(range);
+            return FLAT_BVH_LIST << FLAT_BVH_TYPE_SHIFT | (uint32_t)(lists->size() - 1);
+        }
+
+        ERROR("The BVH contains an object that is not in the scene");
+        exit(1);
+    };
+
+    FlatBvh bvh;
+    bvh.root = add(m_top);
+    bvh.object_count = list.objects().size();
+    bvh.nodes = nodes;
+    bvh.lists = lists;
+    bvh.list_objects = list_objects;
+    return bvh;
+}
@@ -0,0 +1,139 @@
+#include <checkpoint.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <chrono>
+
+bool Checkpoint::map(bool create)
+{
+    int flags = create ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR;
+    m_fd = ::open(m_filename.c_str(), flags, 0644);
+    if (m_fd < 0)
+    {
+        ERROR("Could not open checkpoint '" << m_filename << "'");
+        return false;
+    }
+
+    if (create)
+    {
+        if (ftruncate(m_fd, m_size) != 0)
+        {
+            ERROR("Could not resize checkpoint '" << m_filename << "'");
+            return false;
+        }
+    }
+    else
+    {
+        struct stat st;
+        fstat(m_fd, &st);
+        m_size = st.st_size;
+
+        if (m_size < CHECKPOINT_DATA_OFFSET)
+        {
+            ERROR("Could not read '" << m_filename << "' because it is not a valid checkpoint");
+            return false;
+        }
+    }
+
+    void *map = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+    if (map == MAP_FAILED)
+    {
+        ERROR("Could not map checkpoint '" << m_filename << "'");
+        return false;
+    }
+
+    m_map = static_cast<uint8_t *>(map);
+    return true;
+}
+
+Checkpoint::~Checkpoint()
+{
+    if (m_map != nullptr)
+    {
+        msync(m_map, m_size, MS_SYNC);
+        munmap(m_map, m_size);
+    }
+
+    if (m_fd >= 0)
+        close(m_fd);
+}
+
+std::unique_ptr<Checkpoint> Checkpoint::create(std::string filename, int width, int height, uint32_t aovs, int samples_per_pixel, uint32_t seed)
+{
+    auto checkpoint = std::unique_ptr<Checkpoint>(new Checkpoint(filename));
+    checkpoint->m_size = CHECKPOINT_DATA_OFFSET + Framebuffer::storageSize(width, height, aovs);
+
+    if (!checkpoint->map(true))
+        return nullptr;
+
+    // The file was just truncated so the framebuffer is all zeros already
+    checkpoint_hdr *hdr = checkpoint->header();
+    hdr->id[0] = CHECKPOINT_ID_0;
+    hdr->id[1] = CHECKPOINT_ID_1;
+    hdr->id[2] = CHECKPOINT_ID_2;
+    hdr->id[3] = CHECKPOINT_ID_3;
+    hdr->version = CHECKPOINT_VERSION;
+    hdr->width = width;
+    hdr->height = height;
+    hdr->samples_per_pixel = samples_per_pixel;
+    hdr->samples_done = 0;
+    hdr->seed = seed;
+    hdr->aovs = aovs;
+
+    return checkpoint;
+}
+
+std::unique_ptr<Checkpoint> Checkpoint::open(std::string filename)
+{
+    auto checkpoint = std::unique_ptr<Checkpoint>(new Checkpoint(filename));
+
+    if (!checkpoint->map(false))
+        return nullptr;
+
+    checkpoint_hdr *hdr = checkpoint->header();
+    if (hdr->id[0] != CHECKPOINT_ID_0 || hdr->id[1] != CHECKPOINT_ID_1 ||
+        hdr->id[2] != CHECKPOINT_ID_2 || hdr->id[3] != CHECKPOINT_ID_3)
+    {
+        ERROR("Could not read '" << filename << "' because it is not a valid checkpoint");
+        return nullptr;
+    }
+
+    if (hdr->version != CHECKPOINT_VERSION)
+    {
+        ERROR("Checkpoint '" << filename << "' has version " << hdr->version << ", expected " << CHECKPOINT_VERSION);
+        return nullptr;
+    }
+
+    if (checkpoint->m_size < CHECKPOINT_DATA_OFFSET + Framebuffer::storageSize(hdr->width, hdr->height, hdr->aovs))
+    {
+        ERROR("Checkpoint '" << filename << "' is truncated");
+        return nullptr;
+    }
+
+    return checkpoint;
+}
+
+std::unique_ptr<Framebuffer> Checkpoint::buffer()
+{
+    return std::make_unique<Framebuffer>(width(), height(), aovs(), m_map + CHECKPOINT_DATA_OFFSET);
+}
+
+void Checkpoint::commit(int samples_per_pixel, int samples_done)
+{
+    auto start_chrono = std::chrono::high_resolution_clock::now();
+
+    checkpoint_hdr *hdr = header();
+    hdr->samples_per_pixel = samples_per_pixel;
+    hdr->samples_done = samples_done;
+
+    // Only the pages that were touched since the last checkpoint are written
+    // back, and this does not wait for the writes to finish.
+    msync(m_map, m_size, MS_ASYNC);
+
+    auto stop_chrono = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::microseconds>(stop_chrono - start_chrono);
+    OUT("Checkpoint written at " << samples_done << " samples per pixel, took: " << (double)duration.count() / 1000 << " ms");
+}
@@ -0,0 +1,945 @@
+#include <deflate.h>
+
+#include <algorithm>
+#include <cstring>
+#include <queue>
+
+#define DEFLATE_HASH_BITS   15
+#define DEFLATE_HASH_SIZE   (1 << DEFLATE_HASH_BITS)
+#define DEFLATE_MAX_BITS    15
+#define DEFLATE_MAX_STORED  65535
+#define ADLER_BASE          65521
+
+static const int length_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const int length_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                     3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const int distance_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+                                      257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+                                      8193, 12289, 16385, 24577};
+static const int distance_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+                                       7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// The order the lengths of the code length code are written in
+static const int code_length_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// Longest hash chain followed per level, 0 means no matching at all
+static const int chain_lengths[10] = {0, 4, 8, 16, 32, 64, 128, 256, 1024, 4096};
+
+// The fast levels only add the positions inside a match to the hash chains
+// when the match is at most this long
+static const int insert_lengths[10] = {0, 4, 5, 6, 258, 258, 258, 258, 258, 258};
+
+static int lengthCode(int length)
+{
+    static const std::vector<uint8_t> codes = []() {
+        std::vector<uint8_t> codes(DEFLATE_MAX_MATCH + 1, 0);
+        int code = 0;
+        for (int length = DEFLATE_MIN_MATCH; length <= DEFLATE_MAX_MATCH; length++)
+        {
+            while (code < 28 && length_base[code + 1] <= length)
+                code++;
+            codes[length] = code;
+        }
+        return codes;
+    }();
+
+    return codes[length];
+}
+
+static int distanceCode(int distance)
+{
+    // The codes come in pairs that double in size, so the top bits of the
+    // distance pick the pair
+    if (distance <= 4)
+        return distance - 1;
+
+    int d = distance - 1;
+    int bits = 31 - __builtin_clz(d);
+    return 2 * bits + ((d >> (bits - 1)) & 1);
+}
+
+// A literal or length symbol with the distance of a match, distance is 0
+// for literals
+struct DeflateSymbol
+{
+    uint16_t value;
+    uint16_t distance;
+};
+
+class BitWriter
+{
+private:
+    std::vector<uint8_t> &m_output;
+    uint64_t m_bits = 0;
+    int m_count = 0;
+
+public:
+    BitWriter(std::vector<uint8_t> &output) : m_output(output) {}
+
+    // Write the lowest count bits of value, least significant bit first
+    void write(uint32_t value, int count)
+    {
+        m_bits |= (uint64_t)value << m_count;
+        m_count += count;
+        while (m_count >= 8)
+        {
+            m_output.push_back(m_bits & 0xFF);
+            m_bits >>= 8;
+            m_count -= 8;
+        }
+    }
+
+    void align()
+    {
+        if (m_count > 0)
+            write(0, 8 - m_count);
+    }
+};
+
+// Code lengths of an optimal prefix code for the frequencies, limited to
+// max_bits. Lengths that are too long are fixed up by moving leaves down the
+// tree, like the JPEG standard does.
+static void buildLengths(const std::vector<uint32_t> &freqs, int max_bits, std::vector<uint8_t> &lengths)
+{
+    int n = freqs.size();
+    lengths.assign(n, 0);
+
+    std::vector<int> used;
+    for (int i = 0; i < n; i++)
+    {
+        if (freqs[i] > 0)
+            used.push_back(i);
+    }
+
+    if (used.empty())
+        return;
+    if (used.size() == 1)
+    {
+        lengths[used[0]] = 1;
+        return;
+    }
+
+    // Nodes 0..n-1 are the leaves, the rest are inner nodes
+    std::vector<int> parent(2 * n, -1);
+    using Node = std::pair<uint64_t, int>;
+    std::priority_queue<Node, std::vector<Node>, std::greater<Node>> queue;
+    for (int i : used)
+        queue.push({freqs[i], i});
+
+    int next = n;
+    while (queue.size() > 1)
+    {
+        Node a = queue.top();
+        queue.pop();
+        Node b = queue.top();
+        queue.pop();
+
+        parent[a.second] = next;
+        parent[b.second] = next;
+        queue.push({a.first + b.first, next});
+        next++;
+    }
+
+    std::vector<int> count(64, 0);
+    for (int i : used)
+    {
+        int depth = 0;
+        for (int node = i; parent[node] >= 0; node = parent[node])
+            depth++;
+        lengths[i] = std::min(depth, 63);
+        count[lengths[i]]++;
+    }
+
+    // Move the overflowing leaves up: take two leaves from the deepest
+    // level, one of them takes the place of a leaf one level above max_bits
+    // and that leaf and the other one move a level down.
+    for (int bits = 63; bits > max_bits; bits--)
+    {
+        while (count[bits] > 0)
+        {
+            int j = bits - 2;
+            while (count[j] == 0)
+                j--;
+
+            count[bits] -= 2;
+            count[bits - 1]++;
+            count[j + 1] += 2;
+            count[j]--;
+        }
+    }
+
+    // Hand the lengths out again, the least frequent symbols get the longest
+    std::sort(used.begin(), used.end(), [&](int a, int b) {
+        return freqs[a] != freqs[b] ? freqs[a] < freqs[b] : a > b;
+    });
+
+    int k = 0;
+    for (int bits = max_bits; bits > 0; bits--)
+    {
+        for (int i = 0; i < count[bits]; i++)
+            lengths[used[k++]] = bits;
+    }
+}
+
+// Canonical codes for the lengths (RFC 1951 section 3.2.2). Huffman codes
+// are written most significant bit first, so they are returned reversed and
+// can be written like any other bits.
+static void buildCodes(const std::vector<uint8_t> &lengths, std::vector<uint16_t> &codes)
+{
+    int bl_count[DEFLATE_MAX_BITS + 1] = {};
+    for (uint8_t length : lengths)
+        bl_count[length]++;
+    bl_count[0] = 0;
+
+    int next_code[DEFLATE_MAX_BITS + 1] = {};
+    int code = 0;
+    for (int bits = 1; bits <= DEFLATE_MAX_BITS; bits++)
+    {
+        code = (code + bl_count[bits - 1]) << 1;
+        next_code[bits] = code;
+    }
+
+    codes.assign(lengths.size(), 0);
+    for (size_t i = 0; i < lengths.size(); i++)
+    {
+        if (lengths[i] == 0)
+            continue;
+
+        int code = next_code[lengths[i]]++;
+        for (int bit = 0; bit < lengths[i]; bit++)
+            codes[i] |= ((code >> bit) & 1) << (lengths[i] - 1 - bit);
+    }
+}
+
+// Every alphabet needs at least two codes, decoders tend to reject a tree
+// with a single one
+static void ensureTwoSymbols(std::vector<uint32_t> &freqs)
+{
+    int used = std::count_if(freqs.begin(), freqs.end(), [](uint32_t f) { return f > 0; });
+    for (size_t i = 0; used < 2 && i < freqs.size(); i++)
+    {
+        if (freqs[i] == 0)
+        {
+            freqs[i] = 1;
+            used++;
+        }
+    }
+}
+
+static void writeStored(BitWriter &writer, const uint8_t *data, size_t size, bool final, std::vector<uint8_t> &output)
+{
+    do
+    {
+        size_t length = std::min<size_t>(size, DEFLATE_MAX_STORED);
+        bool last = final && length == size;
+
+        writer.write(last ? 1 : 0, 1);
+        writer.write(0, 2);
+        writer.align();
+        writer.write(length, 16);
+        writer.write(~length & 0xFFFF, 16);
+        output.insert(output.end(), data, data + length);
+
+        data += length;
+        size -= length;
+    } while (size > 0);
+}
+
+// Write the symbols as a block with dynamic Huffman codes, or as a stored
+// block when that is smaller. data and size are the input the symbols
+// stand for.
+static void writeBlock(BitWriter &writer, const std::vector<DeflateSymbol> &symbols,
+                       const uint8_t *data, size_t size, bool final, std::vector<uint8_t> &output)
+{
+    std::vector<uint32_t> literal_freqs(286, 0);
+    std::vector<uint32_t> distance_freqs(30, 0);
+    for (const DeflateSymbol &symbol : symbols)
+    {
+        if (symbol.distance == 0)
+            literal_freqs[symbol.value]++;
+        else
+        {
+            literal_freqs[257 + lengthCode(symbol.value)]++;
+            distance_freqs[distanceCode(symbol.distance)]++;
+        }
+    }
+    literal_freqs[256] = 1;
+    ensureTwoSymbols(literal_freqs);
+    ensureTwoSymbols(distance_freqs);
+
+    std::vector<uint8_t> literal_lengths, distance_lengths;
+    buildLengths(literal_freqs, DEFLATE_MAX_BITS, literal_lengths);
+    buildLengths(distance_freqs, DEFLATE_MAX_BITS, distance_lengths);
+
+    int hlit = 286;
+    while (hlit > 257 && literal_lengths[hlit - 1] == 0)
+        hlit--;
+    int hdist = 30;
+    while (hdist > 1 && distance_lengths[hdist - 1] == 0)
+        hdist--;
+
+    // Run length encode both length tables as one sequence
+    std::vector<uint8_t> all_lengths(literal_lengths.begin(), literal_lengths.begin() + hlit);
+    all_lengths.insert(all_lengths.end(), distance_lengths.begin(), distance_lengths.begin() + hdist);
+
+    std::vector<std::pair<uint8_t, uint8_t>> runs;  // Symbol and its extra bits
+    for (size_t i = 0; i < all_lengths.size();)
+    {
+        uint8_t length = all_lengths[i];
+        size_t run = 1;
+        while (i + run < all_lengths.size() && all_lengths[i + run] == length)
+            run++;
+
+        size_t left = run;
+        if (length == 0)
+        {
+            while (left >= 11)
+            {
+                size_t n = std::min<size_t>(left, 138);
+                runs.push_back({18, n - 11});
+                left -= n;
+            }
+            if (left >= 3)
+            {
+                runs.push_back({17, left - 3});
+                left = 0;
+            }
+        }
+        else
+        {
+            runs.push_back({length, 0});
+            left--;
+            while (left >= 3)
+            {
+                size_t n = std::min<size_t>(left, 6);
+                runs.push_back({16, n - 3});
+                left -= n;
+            }
+        }
+        for (; left > 0; left--)
+            runs.push_back({length, 0});
+
+        i += run;
+    }
+
+    std::vector<uint32_t> code_length_freqs(19, 0);
+    for (auto &run : runs)
+        code_length_freqs[run.first]++;
+    ensureTwoSymbols(code_length_freqs);
+
+    std::vector<uint8_t> code_length_lengths;
+    buildLengths(code_length_freqs, 7, code_length_lengths);
+
+    int hclen = 19;
+    while (hclen > 4 && code_length_lengths[code_length_order[hclen - 1]] == 0)
+        hclen--;
+
+    // Compare the size in bits with a stored block
+    uint64_t bits = 3 + 5 + 5 + 4 + 3 * hclen;
+    for (auto &run : runs)
+        bits += code_length_lengths[run.first] + (run.first == 16 ? 2 : run.first == 17 ? 3 : run.first == 18 ? 7 : 0);
+    for (int i = 0; i < 286; i++)
+        bits += (uint64_t)literal_freqs[i] * literal_lengths[i] + (i >= 257 ? (uint64_t)literal_freqs[i] * length_extra[i - 257] : 0);
+    for (int i = 0; i < 30; i++)
+        bits += (uint64_t)distance_freqs[i] * (distance_lengths[i] + distance_extra[i]);
+
+    uint64_t stored_bits = (size / DEFLATE_MAX_STORED + 1) * (3 + 7 + 32) + size * 8;
+    if (stored_bits <= bits)
+    {
+        writeStored(writer, data, size, final, output);
+        return;
+    }
+
+    std::vector<uint16_t> literal_codes, distance_codes, code_length_codes;
+    buildCodes(literal_lengths, literal_codes);
+    buildCodes(distance_lengths, distance_codes);
+    buildCodes(code_length_lengths, code_length_codes);
+
+    writer.write(final ? 1 : 0, 1);
+    writer.write(2, 2);
+    writer.write(hlit - 257, 5);
+    writer.write(hdist - 1, 5);
+    writer.write(hclen - 4, 4);
+    for (int i = 0; i < hclen; i++)
+        writer.write(code_length_lengths[code_length_order[i]], 3);
+
+    for (auto &run : runs)
+    {
+        writer.write(code_length_codes[run.first], code_length_lengths[run.first]);
+        if (run.first == 16)
+            writer.write(run.second, 2);
+        else if (run.first == 17)
+            writer.write(run.second, 3);
+        else if (run.first == 18)
+            writer.write(run.second, 7);
+    }
+
+    for (const DeflateSymbol &symbol : symbols)
+    {
+        if (symbol.distance == 0)
+        {
+            writer.write(literal_codes[symbol.value], literal_lengths[symbol.value]);
+            continue;
+        }
+
+        int length_code = lengthCode(symbol.value);
+        writer.write(literal_codes[257 + length_code], literal_lengths[257 + length_code]);
+        writer.write(symbol.value - length_base[length_code], length_extra[length_code]);
+
+        int distance_code = distanceCode(symbol.distance);
+        writer.write(distance_codes[distance_code], distance_lengths[distance_code]);
+        writer.write(symbol.distance - distance_base[distance_code], distance_extra[distance_code]);
+    }
+
+    writer.write(literal_codes[256], literal_lengths[256]);
+}
+
+// The amount of equal bytes at the start of a and b, at most max_length
+static int matchLength(const uint8_t *a, const uint8_t *b, int max_length)
+{
+    int length = 0;
+    while (length + 8 <= max_length)
+    {
+        uint64_t x, y;
+        memcpy(&x, a + length, sizeof(x));
+        memcpy(&y, b + length, sizeof(y));
+        if (x != y)
+            return length + __builtin_ctzll(x ^ y) / 8;
+        length += 8;
+    }
+
+    while (length < max_length && a[length] == b[length])
+        length++;
+    return length;
+}
+
+static uint32_t hash(const uint8_t *p)
+{
+    return ((p[0] << 10) ^ (p[1] << 5) ^ p[2]) & (DEFLATE_HASH_SIZE - 1);
+}
+
+void Deflate::compress(const uint8_t *data, size_t size, int level, std::vector<uint8_t> &output, bool final)
+{
+    BitWriter writer(output);
+    level = std::clamp(level, 0, 9);
+
+    // Stored blocks always end on a byte boundary
+    if (level == 0 || size < DEFLATE_MIN_MATCH)
+    {
+        writeStored(writer, data, size, final, output);
+        return;
+    }
+
+    int max_chain = chain_lengths[level];
+
+    // Blocks that do not get smaller are stored, so this is the most it takes
+    output.reserve(output.size() + size + (size / DEFLATE_MAX_STORED + 1) * 5 + 16);
+
+    // Most recent position per hash and the previous position with the same
+    // hash per position in the window
+    std::vector<int32_t> head(DEFLATE_HASH_SIZE, -1);
+    std::vector<int32_t> prev(DEFLATE_WINDOW_SIZE, -1);
+
+    auto insert = [&](size_t pos) {
+        uint32_t h = hash(&data[pos]);
+        prev[pos & (DEFLATE_WINDOW_SIZE - 1)] = head[h];
+        head[h] = pos;
+    };
+
+    std::vector<DeflateSymbol> symbols;
+    symbols.reserve(DEFLATE_BLOCK_SYMBOLS);
+    size_t block_start = 0;
+
+    size_t pos = 0;
+    while (pos < size)
+    {
+        int best_length = 0;
+        int best_distance = 0;
+
+        if (pos + DEFLATE_MIN_MATCH <= size)
+        {
+            int max_length = std::min<size_t>(DEFLATE_MAX_MATCH, size - pos);
+            int32_t candidate = head[hash(&data[pos])];
+
+            for (int chain = max_chain; candidate >= 0 && chain > 0; chain--)
+            {
+                if (pos - candidate > DEFLATE_WINDOW_SIZE)
+                    break;
+
+                const uint8_t *a = &data[pos];
+                const uint8_t *b = &data[candidate];
+                if (b[best_length] == a[best_length])
+                {
+                    int length = matchLength(a, b, max_length);
+
+                    if (length > best_length)
+                    {
+                        best_length = length;
+                        best_distance = pos - candidate;
+                        if (length == max_length)
+                            break;
+                    }
+                }
+
+                int32_t next = prev[candidate & (DEFLATE_WINDOW_SIZE - 1)];
+                if (next >= candidate)
+                    break;
+                candidate = next;
+            }
+
+            insert(pos);
+        }
+
+        if (best_length >= DEFLATE_MIN_MATCH)
+        {
+            symbols.push_back({(uint16_t)best_length, (uint16_t)best_distance});
+            if (best_length <= insert_lengths[level])
+            {
+                for (size_t i = pos + 1; i < pos + best_length && i + DEFLATE_MIN_MATCH <= size; i++)
+                    insert(i);
+            }
+            pos += best_length;
+        }
+        else
+        {
+            symbols.push_back({data[pos], 0});
+            pos++;
+        }
+
+        if (symbols.size() >= DEFLATE_BLOCK_SYMBOLS && pos < size)
+        {
+            writeBlock(writer, symbols, &data[block_start], pos - block_start, false, output);
+            symbols.clear();
+            block_start = pos;
+        }
+    }
+
+    writeBlock(writer, symbols, &data[block_start], pos - block_start, final, output);
+
+    // An empty stored block pads the stream to a byte boundary
+    if (!final)
+        writeStored(writer, nullptr, 0, false, output);
+    writer.align();
+}
+
+void Deflate::zlibCompress(const uint8_t *data, size_t size, int level, std::vector<uint8_t> &output)
+{
+    // 32K window, deflate, the check bits make the header a multiple of 31
+    output.push_back(0x78);
+    output.push_back(0x01);
+
+    int segment_count = std::max<size_t>(1, (size + DEFLATE_SEGMENT_SIZE - 1) / DEFLATE_SEGMENT_SIZE);
+    std::vector<std::vector<uint8_t>> segments(segment_count);
+    std::vector<uint32_t> checksums(segment_count);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < segment_count; i++)
+    {
+        size_t start = (size_t)i * DEFLATE_SEGMENT_SIZE;
+        size_t length = std::min<size_t>(DEFLATE_SEGMENT_SIZE, size - start);
+
+        compress(data + start, length, level, segments[i], i == segment_count - 1);
+        checksums[i] = adler32(data + start, length);
+    }
+
+    size_t total = output.size() + 4;
+    for (const std::vector<uint8_t> &segment : segments)
+        total += segment.size();
+    output.reserve(total);
+
+    uint32_t adler = 1;
+    for (int i = 0; i < segment_count; i++)
+    {
+        size_t length = std::min<size_t>(DEFLATE_SEGMENT_SIZE, size - (size_t)i * DEFLATE_SEGMENT_SIZE);
+        adler = adler32Combine(adler, checksums[i], length);
+        output.insert(output.end(), segments[i].begin(), segments[i].end());
+    }
+
+    output.push_back(adler >> 24);
+    output.push_back(adler >> 16);
+    output.push_back(adler >> 8);
+    output.push_back(adler);
+}
+
+uint32_t Deflate::adler32(const uint8_t *data, size_t size, uint32_t adler)
+{
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+
+    while (size > 0)
+    {
+        // The sums can not overflow in this many bytes
+        size_t n = std::min<size_t>(size, 5552);
+        for (size_t i = 0; i < n; i++)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+
+        data += n;
+        size -= n;
+    }
+
+    return (b << 16) | a;
+}
+
+uint32_t Deflate::adler32Combine(uint32_t adler1, uint32_t adler2, size_t size2)
+{
+    // The second sum of the second piece is missing the first sum of the
+    // first piece for every byte of it, see zlib
+    uint64_t rest = size2 % ADLER_BASE;
+    uint64_t a1 = adler1 & 0xFFFF;
+    uint64_t b1 = adler1 >> 16;
+    uint64_t a2 = adler2 & 0xFFFF;
+    uint64_t b2 = adler2 >> 16;
+
+    uint64_t a = (a1 + a2 + ADLER_BASE - 1) % ADLER_BASE;
+    uint64_t b = (b1 + b2 + rest * a1 + ADLER_BASE - rest) % ADLER_BASE;
+    return (b << 16) | a;
+}
+
+// Codes of at most this many bits are decoded with a single table lookup,
+// longer codes are decoded a bit at a time
+#define INFLATE_FAST_BITS   9
+
+class BitReader
+{
+private:
+    const uint8_t *m_data;
+    size_t m_size;
+    size_t m_pos = 0;
+    uint64_t m_bits = 0;
+    int m_count = 0;
+
+    // Bits handed out past the end of the data, they read as zeros
+    int m_overrun = 0;
+
+public:
+    BitReader(const uint8_t *data, size_t size) : m_data(data), m_size(size) {}
+
+    void refill()
+    {
+        while (m_count <= 56)
+        {
+            if (m_pos < m_size)
+                m_bits |= (uint64_t)m_data[m_pos++] << m_count;
+            else
+                m_overrun += 8;
+            m_count += 8;
+        }
+    }
+
+    // The next count bits without consuming them, at most 32
+    uint32_t peek(int count)
+    {
+        if (m_count < count)
+            refill();
+        return m_bits & ((1ull << count) - 1);
+    }
+
+    void consume(int count)
+    {
+        m_bits >>= count;
+        m_count -= count;
+    }
+
+    uint32_t read(int count)
+    {
+        uint32_t value = peek(count);
+        consume(count);
+        return value;
+    }
+
+    void align() { consume(m_count % 8); }
+
+    // Whole bytes for stored blocks, the buffered bits are byte aligned
+    // when this is called so they can be handed back
+    bool readBytes(size_t count, std::vector<uint8_t> &output)
+    {
+        if (overrun())
+            return false;
+        m_pos = bytePosition();
+        m_bits = 0;
+        m_count = 0;
+        m_overrun = 0;
+
+        if (count > m_size - m_pos)
+            return false;
+        output.insert(output.end(), m_data + m_pos, m_data + m_pos + count);
+        m_pos += count;
+        return true;
+    }
+
+    bool overrun() const { return m_overrun > m_count; }
+
+    // Position of the first byte after the consumed bits
+    size_t bytePosition() const { return m_pos - (m_count - m_overrun) / 8; }
+};
+
+// A canonical Huffman code, see "puff.c" from zlib for the slow path
+struct InflateCode
+{
+    uint16_t counts[DEFLATE_MAX_BITS + 1];
+    uint16_t symbols[288];
+
+    // Symbol << 4 | length, 0 when the code is longer than the table
+    uint16_t fast[1 << INFLATE_FAST_BITS];
+
+    // Returns false for codes that are oversubscribed. Incomplete codes are
+    // allowed, like zlib does, as a stream with a single distance has one.
+    bool build(const uint8_t *lengths, int count)
+    {
+        memset(counts, 0, sizeof(counts));
+        memset(fast, 0, sizeof(fast));
+        for (int i = 0; i < count; i++)
+            counts[lengths[i]]++;
+
+        int left = 1;
+        for (int len = 1; len <= DEFLATE_MAX_BITS; len++)
+        {
+            left = 2 * left - counts[len];
+            if (left < 0)
+                return false;
+        }
+
+        uint16_t offsets[DEFLATE_MAX_BITS + 2];
+        offsets[1] = 0;
+        for (int len = 1; len <= DEFLATE_MAX_BITS; len++)
+            offsets[len + 1] = offsets[len] + counts[len];
+
+        // The codes of one length are consecutive in symbol order
+        uint32_t code = 0;
+        uint32_t next[DEFLATE_MAX_BITS + 1];
+        for (int len = 1; len <= DEFLATE_MAX_BITS; len++)
+        {
+            code = (code + (len > 1 ? counts[len - 1] : 0)) << 1;
+            next[len] = code;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            int len = lengths[i];
+            if (len == 0)
+                continue;
+            symbols[offsets[len]++] = i;
+
+            uint32_t value = next[len]++;
+            if (len > INFLATE_FAST_BITS)
+                continue;
+
+            // The stream holds codes starting at the top bit
+            uint32_t reversed = 0;
+            for (int k = 0; k < len; k++)
+                reversed |= ((value >> k) & 1) << (len - 1 - k);
+            for (uint32_t j = reversed; j < (1u << INFLATE_FAST_BITS); j += 1u << len)
+                fast[j] = i << 4 | len;
+        }
+        return true;
+    }
+
+    // Returns -1 for codes that are not in the table
+    int decode(BitReader &reader) const
+    {
+        uint16_t entry = fast[reader.peek(INFLATE_FAST_BITS)];
+        if (entry != 0)
+        {
+            reader.consume(entry & 0xF);
+            return entry >> 4;
+        }
+
+        int code = 0;
+        int first = 0;
+        int index = 0;
+        for (int len = 1; len <= DEFLATE_MAX_BITS; len++)
+        {
+            code |= reader.read(1);
+            int count = counts[len];
+            if (code - first < count)
+                return symbols[index + code - first];
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    }
+};
+
+static bool readDynamicCodes(BitReader &reader, InflateCode &literals, InflateCode &distances)
+{
+    int literal_count = reader.read(5) + 257;
+    int distance_count = reader.read(5) + 1;
+    int length_count = reader.read(4) + 4;
+    if (literal_count > 286 || distance_count > 30)
+        return false;
+
+    uint8_t lengths[286 + 30] = {};
+    for (int i = 0; i < length_count; i++)
+        lengths[code_length_order[i]] = reader.read(3);
+
+    InflateCode length_code;
+    if (!length_code.build(lengths, 19))
+        return false;
+
+    int total = literal_count + distance_count;
+    int i = 0;
+    while (i < total)
+    {
+        int symbol = length_code.decode(reader);
+        if (symbol < 0)
+            return false;
+
+        if (symbol < 16)
+        {
+            lengths[i++] = symbol;
+            continue;
+        }
+
+        int value = 0;
+        int repeat;
+        if (symbol == 16)
+        {
+            if (i == 0)
+                return false;
+            value = lengths[i - 1];
+            repeat = 3 + reader.read(2);
+        }
+        else if (symbol == 17)
+            repeat = 3 + reader.read(3);
+        else
+            repeat = 11 + reader.read(7);
+
+        if (i + repeat > total)
+            return false;
+        while (repeat-- > 0)
+            lengths[i++] = value;
+    }
+
+    // Without an end of block code the block can not end
+    if (lengths[256] == 0)
+        return false;
+
+    return literals.build(lengths, literal_count) && distances.build(lengths + literal_count, distance_count);
+}
+
+static bool inflateBlock(BitReader &reader, const InflateCode &literals, const InflateCode &distances,
+                         std::vector<uint8_t> &output, size_t start)
+{
+    while (true)
+    {
+        int symbol = literals.decode(reader);
+        if (symbol < 0 || reader.overrun())
+            return false;
+
+        if (symbol < 256)
+        {
+            output.push_back(symbol);
+            continue;
+        }
+        if (symbol == 256)
+            return true;
+
+        symbol -= 257;
+        if (symbol >= 29)
+            return false;
+        int length = length_base[symbol] + reader.read(length_extra[symbol]);
+
+        symbol = distances.decode(reader);
+        if (symbol < 0 || symbol >= 30)
+            return false;
+        size_t distance = distance_base[symbol] + reader.read(distance_extra[symbol]);
+        if (distance > output.size() - start)
+            return false;
+
+        // The match may overlap the bytes it writes
+        size_t from = output.size() - distance;
+        output.resize(output.size() + length);
+        uint8_t *out = &output[output.size() - length];
+        const uint8_t *in = &output[from];
+        if (distance >= (size_t)length)
+            memcpy(out, in, length);
+        else
+        {
+            for (int k = 0; k < length; k++)
+                out[k] = in[k];
+        }
+    }
+}
+
+static bool inflate(BitReader &reader, std::vector<uint8_t> &output)
+{
+    static const std::vector<InflateCode> fixed = []() {
+        uint8_t lengths[288];
+        for (int i = 0; i < 288; i++)
+            lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+        std::vector<InflateCode> codes(2);
+        codes[0].build(lengths, 288);
+        std::fill(lengths, lengths + 30, 5);
+        codes[1].build(lengths, 30);
+        return codes;
+    }();
+
+    size_t start = output.size();
+    InflateCode literals;
+    InflateCode distances;
+    bool final = false;
+
+    while (!final)
+    {
+        final = reader.read(1);
+        int type = reader.read(2);
+
+        if (type == 0)
+        {
+            reader.align();
+            uint32_t length = reader.read(16);
+            uint32_t inverse = reader.read(16);
+            if ((length ^ 0xFFFF) != inverse || !reader.readBytes(length, output))
+                return false;
+        }
+        else if (type == 1)
+        {
+            if (!inflateBlock(reader, fixed[0], fixed[1], output, start))
+                return false;
+        }
+        else if (type == 2)
+        {
+            if (!readDynamicCodes(reader, literals, distances) ||
+                !inflateBlock(reader, literals, distances, output, start))
+                return false;
+        }
+        else
+            return false;
+    }
+
+    return !reader.overrun();
+}
+
+bool Deflate::decompress(const uint8_t *data, size_t size, std::vector<uint8_t> &output)
+{
+    BitReader reader(data, size);
+    return inflate(reader, output);
+}
+
+bool Deflate::zlibDecompress(const uint8_t *data, size_t size, std::vector<uint8_t> &output)
+{
+    // Only deflate with a window of at most 32K and no preset dictionary
+    if (size < 6 || (data[0] & 0x0F) != 8 || (data[0] >> 4) > 7 || (data[1] & 0x20) ||
+        ((data[0] << 8) | data[1]) % 31 != 0)
+        return false;
+
+    size_t start = output.size();
+    BitReader reader(data + 2, size - 2);
+    if (!inflate(reader, output))
+        return false;
+
+    reader.align();
+    size_t end = 2 + reader.bytePosition();
+    if (end + 4 > size)
+        return false;
+
+    uint32_t adler = (uint32_t)data[end] << 24 | data[end + 1] << 16 | data[end + 2] << 8 | data[end + 3];
+    return adler == adler32(output.data() + start, output.size() - start);
+}
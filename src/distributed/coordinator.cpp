@@ -0,0 +1,313 @@
+#include <distributed/coordinator.h>
+#include <distributed/protocol.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+
+pid_t Coordinator::spawn()
+{
+    std::vector<std::string> args = m_command;
+    args.push_back("--worker");
+    args.push_back(m_socket_path);
+
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+
+    std::vector<char *> argv;
+    for (auto &arg : args)
+        argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+
+    execv(argv[0], argv.data());
+
+    ERROR("Could not start worker " << args[0]);
+    _exit(1);
+}
+
+bool Coordinator::acceptWorker(int width, int height, uint32_t aovs, int timeout_ms)
+{
+    int fd = accept(m_listen_fd, nullptr, nullptr);
+    if (fd < 0)
+        return false;
+
+    // A worker that connects but never says hello must not hang the start,
+    // the timeout is lifted again once it did
+    struct timeval timeout = {timeout_ms / 1000, (timeout_ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    distributed_msg_hdr header;
+    std::vector<uint8_t> payload;
+    if (!receiveMessage(fd, header, payload) || header.type != DISTRIBUTED_MSG_HELLO ||
+        payload.size() != sizeof(distributed_hello))
+    {
+        WARN("Worker did not introduce itself, dropping it");
+        close(fd);
+        return false;
+    }
+
+    timeout = {0, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    distributed_hello hello;
+    memcpy(&hello, payload.data(), sizeof(distributed_hello));
+
+    if (hello.width != width || hello.height != height || hello.aovs != aovs)
+    {
+        WARN("Worker " << hello.pid << " renders a " << hello.width << "x" << hello.height << " image with AOVs "
+                       << hello.aovs << " instead of " << width << "x" << height << " with AOVs " << aovs << ", dropping it");
+        kill(hello.pid, SIGKILL);
+        close(fd);
+        return false;
+    }
+
+    m_workers.push_back(WorkerConnection{hello.pid, fd, false, {}});
+    return true;
+}
+
+bool Coordinator::start(int workers, int width, int height, uint32_t aovs)
+{
+    m_socket_path = "/tmp/raytracer-" + std::to_string(getpid()) + ".sock";
+    unlink(m_socket_path.c_str());
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, m_socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    m_listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (m_listen_fd < 0 || bind(m_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(m_listen_fd, workers) != 0)
+    {
+        ERROR("Could not listen on " << m_socket_path);
+        return false;
+    }
+
+    for (int i = 0; i < workers; i++)
+        m_pids.push_back(spawn());
+
+    // Workers connect once they loaded the scene, this can take a while. Keep
+    // an eye on workers that die before they ever connect, and give up on
+    // the ones that are not there by the deadline.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(DISTRIBUTED_START_TIMEOUT);
+    std::vector<pid_t> starting = m_pids;
+    int failed = 0;
+    while (!starting.empty())
+    {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0)
+        {
+            WARN(starting.size() << " workers did not connect within " << DISTRIBUTED_START_TIMEOUT << " seconds, stopping them");
+            for (pid_t pid : starting)
+                kill(pid, SIGKILL);
+            failed += starting.size();
+            break;
+        }
+
+        struct pollfd pfd = {m_listen_fd, POLLIN, 0};
+        if (poll(&pfd, 1, std::min<long>(remaining, 500)) > 0)
+        {
+            if (acceptWorker(width, height, aovs, remaining))
+                starting.erase(std::remove(starting.begin(), starting.end(), m_workers.back().pid), starting.end());
+            continue;
+        }
+
+        for (auto it = starting.begin(); it != starting.end();)
+        {
+            if (waitpid(*it, nullptr, WNOHANG) == *it)
+            {
+                it = starting.erase(it);
+                failed++;
+            }
+            else
+                ++it;
+        }
+    }
+
+    if (m_workers.empty())
+    {
+        ERROR("None of the " << workers << " workers started");
+        return false;
+    }
+
+    if (failed)
+        WARN(failed << " of the " << workers << " workers did not start");
+
+    return true;
+}
+
+int Coordinator::workers() const
+{
+    int alive = 0;
+    for (const auto &worker : m_workers)
+        alive += worker.fd >= 0;
+
+    return alive;
+}
+
+void Coordinator::lostWorker(WorkerConnection &worker, std::deque<RenderWorkBlock> &pending)
+{
+    WARN("Lost worker " << worker.pid << (worker.busy ? ", reissuing its job" : ""));
+
+    if (worker.busy)
+        pending.push_front(worker.job);
+
+    // Make sure it is really gone, a worker that misbehaves is not trusted with more work
+    kill(worker.pid, SIGKILL);
+    close(worker.fd);
+    worker.fd = -1;
+    worker.busy = false;
+}
+
+bool Coordinator::sendJob(WorkerConnection &worker, const RenderWorkBlock &block, const Framebuffer &buffer)
+{
+    // The samples the pixels already have go along with the job, see
+    // DISTRIBUTED_MSG_JOB
+    int width = block.x_end - block.x;
+    std::vector<uint8_t> message(sizeof(distributed_job) + (size_t)width * (block.y_end - block.y) * sizeof(int32_t));
+    distributed_job job = toJob(block);
+    memcpy(message.data(), &job, sizeof(distributed_job));
+
+    int32_t *counts = reinterpret_cast<int32_t *>(message.data() + sizeof(distributed_job));
+    for (int y = block.y; y < block.y_end; y++)
+    {
+        for (int x = block.x; x < block.x_end; x++)
+            counts[(y - block.y) * width + (x - block.x)] = buffer.samples(x, y);
+    }
+
+    return sendMessage(worker.fd, DISTRIBUTED_MSG_JOB, message.data(), message.size());
+}
+
+bool Coordinator::mergeResult(const WorkerConnection &worker, const std::vector<uint8_t> &payload, Framebuffer &buffer,
+                              std::atomic<long> &rendered_samples)
+{
+    if (payload.size() < sizeof(distributed_job))
+        return false;
+
+    distributed_job job;
+    memcpy(&job, payload.data(), sizeof(distributed_job));
+
+    // The result has to be the job the worker was given, and that has to lie
+    // in the image. Anything else is not trusted with an allocation.
+    distributed_job expected = toJob(worker.job);
+    if (memcmp(&job, &expected, sizeof(distributed_job)) != 0 ||
+        job.x < buffer.x() || job.y < buffer.y() || job.x > job.x_end || job.y > job.y_end ||
+        job.x_end > buffer.x() + buffer.width() || job.y_end > buffer.y() + buffer.height())
+        return false;
+
+    Framebuffer tile(job.x, job.y, job.x_end - job.x, job.y_end - job.y, buffer.aovs());
+    if (payload.size() != sizeof(distributed_job) + tile.size())
+        return false;
+
+    memcpy(tile.data(), payload.data() + sizeof(distributed_job), tile.size());
+    buffer.merge(tile);
+
+    for (int y = job.y; y < job.y_end; y++)
+    {
+        for (int x = job.x; x < job.x_end; x++)
+            rendered_samples += tile.samples(x, y);
+    }
+
+    return true;
+}
+
+bool Coordinator::render(const std::vector<RenderWorkBlock> &jobs, Framebuffer &buffer,
+                         std::atomic<long> &rendered_samples, std::function<bool()> stop)
+{
+    std::deque<RenderWorkBlock> pending(jobs.begin(), jobs.end());
+    int in_flight = 0;
+
+    while (true)
+    {
+        // Hand out work to every idle worker, unless we have been told to stop
+        for (auto &worker : m_workers)
+        {
+            if (worker.fd < 0 || worker.busy || pending.empty() || stop())
+                continue;
+
+            if (!sendJob(worker, pending.front(), buffer))
+            {
+                lostWorker(worker, pending);
+                continue;
+            }
+
+            worker.busy = true;
+            worker.job = pending.front();
+            pending.pop_front();
+            in_flight++;
+        }
+
+        if (workers() == 0)
+        {
+            ERROR("All workers have died");
+            return false;
+        }
+
+        // Everything is done, or we stopped handing out work and the last jobs came back
+        if (in_flight == 0)
+            break;
+
+        std::vector<struct pollfd> pfds;
+        std::vector<WorkerConnection *> polled;
+        for (auto &worker : m_workers)
+        {
+            if (worker.fd < 0 || !worker.busy)
+                continue;
+
+            pfds.push_back({worker.fd, POLLIN, 0});
+            polled.push_back(&worker);
+        }
+
+        poll(pfds.data(), pfds.size(), -1);
+
+        for (size_t i = 0; i < pfds.size(); i++)
+        {
+            if (pfds[i].revents == 0)
+                continue;
+
+            WorkerConnection &worker = *polled[i];
+            distributed_msg_hdr header;
+            std::vector<uint8_t> payload;
+
+            in_flight--;
+            if (!receiveMessage(worker.fd, header, payload) || header.type != DISTRIBUTED_MSG_RESULT ||
+                !mergeResult(worker, payload, buffer, rendered_samples))
+            {
+                lostWorker(worker, pending);
+                continue;
+            }
+
+            worker.busy = false;
+        }
+    }
+
+    return pending.empty();
+}
+
+Coordinator::~Coordinator()
+{
+    for (auto &worker : m_workers)
+    {
+        if (worker.fd < 0)
+            continue;
+
+        sendMessage(worker.fd, DISTRIBUTED_MSG_QUIT, nullptr, 0);
+        close(worker.fd);
+    }
+
+    for (pid_t pid : m_pids)
+        waitpid(pid, nullptr, 0);
+
+    if (m_listen_fd >= 0)
+    {
+        close(m_listen_fd);
+        unlink(m_socket_path.c_str());
+    }
+}
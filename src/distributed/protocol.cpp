@@ -0,0 +1,68 @@
+#include <distributed/protocol.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+static bool sendAll(int fd, const void *data, size_t size)
+{
+    const uint8_t *ptr = static_cast<const uint8_t *>(data);
+    while (size > 0)
+    {
+        // MSG_NOSIGNAL, a dead peer should be an error and not kill us with SIGPIPE
+        ssize_t written = send(fd, ptr, size, MSG_NOSIGNAL);
+        if (written <= 0)
+            return false;
+
+        ptr += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+static bool receiveAll(int fd, void *data, size_t size)
+{
+    uint8_t *ptr = static_cast<uint8_t *>(data);
+    while (size > 0)
+    {
+        ssize_t received = recv(fd, ptr, size, 0);
+        if (received <= 0)
+            return false;
+
+        ptr += received;
+        size -= received;
+    }
+
+    return true;
+}
+
+bool sendMessage(int fd, uint32_t type, const void *payload, size_t size)
+{
+    distributed_msg_hdr header;
+    header.type = type;
+    header.size = size;
+
+    if (!sendAll(fd, &header, sizeof(distributed_msg_hdr)))
+        return false;
+
+    return size == 0 || sendAll(fd, payload, size);
+}
+
+bool receiveMessage(int fd, distributed_msg_hdr &header, std::vector<uint8_t> &payload)
+{
+    if (!receiveAll(fd, &header, sizeof(distributed_msg_hdr)))
+        return false;
+
+    payload.resize(header.size);
+    return header.size == 0 || receiveAll(fd, payload.data(), header.size);
+}
+
+distributed_job toJob(const RenderWorkBlock &block)
+{
+    return distributed_job{block.x, block.y, block.x_end, block.y_end, block.sample_start, block.sample_end};
+}
+
+RenderWorkBlock fromJob(const distributed_job &job)
+{
+    return RenderWorkBlock{job.x, job.y, job.x_end, job.y_end, job.sample_start, job.sample_end};
+}
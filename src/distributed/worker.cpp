@@ -0,0 +1,93 @@
+#include <distributed/worker.h>
+#include <distributed/protocol.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cstring>
+
+int Worker::run(Renderer &renderer)
+{
+    renderer.generate_bvh();
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, m_socket_path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        ERROR("Could not connect to coordinator at " << m_socket_path);
+        return 1;
+    }
+
+    distributed_hello hello = {getpid(), renderer.get_width(), renderer.get_height(), renderer.get_aovs()};
+    if (!sendMessage(fd, DISTRIBUTED_MSG_HELLO, &hello, sizeof(distributed_hello)))
+    {
+        ERROR("Could not introduce worker to the coordinator");
+        close(fd);
+        return 1;
+    }
+
+    distributed_msg_hdr header;
+    std::vector<uint8_t> payload;
+    std::vector<uint8_t> result;
+    std::vector<int32_t> counts;
+
+    // Jobs are rendered straight into a framebuffer of just the tile, a
+    // worker never holds the whole image.
+    Framebuffer tile(0, 0, 0, 0, renderer.get_aovs());
+
+    while (receiveMessage(fd, header, payload) && header.type == DISTRIBUTED_MSG_JOB)
+    {
+        if (payload.size() < sizeof(distributed_job))
+            break;
+
+        distributed_job job;
+        memcpy(&job, payload.data(), sizeof(distributed_job));
+
+        RenderWorkBlock block = fromJob(job);
+        if (block.x < 0 || block.y < 0 || block.x > block.x_end || block.y > block.y_end ||
+            block.x_end > renderer.get_width() || block.y_end > renderer.get_height())
+            break;
+
+        int width = block.x_end - block.x;
+        int height = block.y_end - block.y;
+        if (payload.size() != sizeof(distributed_job) + (size_t)width * height * sizeof(int32_t))
+            break;
+
+        // The tile starts with the samples the pixels already have, so the
+        // renderer skips them just like it does for the whole image. They
+        // are taken out again before the tile goes back.
+        counts.resize((size_t)width * height);
+        memcpy(counts.data(), payload.data() + sizeof(distributed_job), counts.size() * sizeof(int32_t));
+        tile.setRegion(block.x, block.y, width, height);
+        for (int y = block.y; y < block.y_end; y++)
+        {
+            for (int x = block.x; x < block.x_end; x++)
+                tile.add(x, y, Color(0), counts[(y - block.y) * width + (x - block.x)]);
+        }
+
+        renderer.renderRegion(block, tile);
+
+        for (int y = block.y; y < block.y_end; y++)
+        {
+            for (int x = block.x; x < block.x_end; x++)
+                tile.add(x, y, Color(0), -counts[(y - block.y) * width + (x - block.x)]);
+        }
+
+        // Send the tile back and forget about it, the coordinator owns the image
+
+        result.resize(sizeof(distributed_job) + tile.size());
+        memcpy(result.data(), &job, sizeof(distributed_job));
+        memcpy(result.data() + sizeof(distributed_job), tile.data(), tile.size());
+
+        if (!sendMessage(fd, DISTRIBUTED_MSG_RESULT, result.data(), result.size()))
+            break;
+    }
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,334 @@
+#include <exr.h>
+#include <deflate.h>
+
+#include <cstring>
+
+#define EXR_PIXEL_HALF  1
+#define EXR_PIXEL_FLOAT 2
+
+// Round to the nearest half, ties to even. Values too large for a half
+// become infinity.
+static uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t abs = bits & 0x7FFFFFFF;
+
+    // Infinity and NaN, NaN stays a NaN
+    if (abs >= 0x7F800000)
+        return sign | 0x7C00 | (abs > 0x7F800000 ? 0x200 : 0);
+
+    // 65536 and up
+    if (abs >= 0x47800000)
+        return sign | 0x7C00;
+
+    // Below the smallest normal half (2^-14) the result is denormal
+    if (abs < 0x38800000)
+    {
+        if (abs < 0x33000000)
+            return sign;
+
+        int exponent = abs >> 23;
+        uint32_t mantissa = (abs & 0x7FFFFF) | 0x800000;
+        int shift = 126 - exponent;
+
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1)))
+            half++;
+        return sign | half;
+    }
+
+    // Rebias the exponent from 127 to 15, rounding up may carry into the
+    // exponent which is still correct
+    uint32_t half = (abs - 0x38000000) >> 13;
+    uint32_t rest = abs & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return sign | half;
+}
+
+template <typename T>
+static void put(std::vector<uint8_t> &output, T value)
+{
+    const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+    output.insert(output.end(), bytes, bytes + sizeof(T));
+}
+
+static void putString(std::vector<uint8_t> &output, const std::string &value)
+{
+    output.insert(output.end(), value.begin(), value.end());
+    output.push_back(0);
+}
+
+static void putAttribute(std::vector<uint8_t> &output, const std::string &name, const std::string &type,
+                         const std::vector<uint8_t> &value)
+{
+    putString(output, name);
+    putString(output, type);
+    put<int32_t>(output, value.size());
+    output.insert(output.end(), value.begin(), value.end());
+}
+
+static std::vector<ExrChannel> channels(uint32_t aovs, bool half)
+{
+    int color_type = half ? EXR_PIXEL_HALF : EXR_PIXEL_FLOAT;
+
+    std::vector<ExrChannel> channels = {
+        {"R", AOV_NONE, 0, color_type},
+        {"G", AOV_NONE, 1, color_type},
+        {"B", AOV_NONE, 2, color_type},
+    };
+
+    if (aovs & AOV_ALBEDO)
+    {
+        channels.push_back({"albedo.R", AOV_ALBEDO, 0, color_type});
+        channels.push_back({"albedo.G", AOV_ALBEDO, 1, color_type});
+        channels.push_back({"albedo.B", AOV_ALBEDO, 2, color_type});
+    }
+    if (aovs & AOV_NORMAL)
+    {
+        channels.push_back({"normal.X", AOV_NORMAL, 0, color_type});
+        channels.push_back({"normal.Y", AOV_NORMAL, 1, color_type});
+        channels.push_back({"normal.Z", AOV_NORMAL, 2, color_type});
+    }
+    if (aovs & AOV_VARIANCE)
+    {
+        channels.push_back({"variance.R", AOV_VARIANCE, 0, color_type});
+        channels.push_back({"variance.G", AOV_VARIANCE, 1, color_type});
+        channels.push_back({"variance.B", AOV_VARIANCE, 2, color_type});
+    }
+
+    // A half does not have enough precision for distances and counts
+    if (aovs & AOV_DEPTH)
+        channels.push_back({"depth.Z", AOV_DEPTH, 0, EXR_PIXEL_FLOAT});
+    if (aovs & AOV_SAMPLES)
+        channels.push_back({"samples.Y", AOV_SAMPLES, 0, EXR_PIXEL_FLOAT});
+
+    // Readers expect the channel list to be sorted by name
+    std::sort(channels.begin(), channels.end(), [](const ExrChannel &a, const ExrChannel &b) {
+        return a.name < b.name;
+    });
+
+    return channels;
+}
+
+static std::vector<uint8_t> header(int width, int height, const std::vector<ExrChannel> &channels,
+                                   ExrCompression compression)
+{
+    std::vector<uint8_t> output;
+    put<int32_t>(output, EXR_MAGIC);
+    put<int32_t>(output, EXR_VERSION);
+
+    std::vector<uint8_t> value;
+    for (const ExrChannel &channel : channels)
+    {
+        putString(value, channel.name);
+        put<int32_t>(value, channel.type);
+        put<uint8_t>(value, 0);     // pLinear
+        put<uint8_t>(value, 0);     // Reserved
+        put<uint8_t>(value, 0);
+        put<uint8_t>(value, 0);
+        put<int32_t>(value, 1);     // xSampling
+        put<int32_t>(value, 1);     // ySampling
+    }
+    put<uint8_t>(value, 0);
+    putAttribute(output, "channels", "chlist", value);
+
+    putAttribute(output, "compression", "compression", {(uint8_t)compression});
+
+    value.clear();
+    put<int32_t>(value, 0);
+    put<int32_t>(value, 0);
+    put<int32_t>(value, width - 1);
+    put<int32_t>(value, height - 1);
+    putAttribute(output, "dataWindow", "box2i", value);
+    putAttribute(output, "displayWindow", "box2i", value);
+
+    putAttribute(output, "lineOrder", "lineOrder", {0});    // Increasing y
+
+    value.clear();
+    put<float>(value, 1);
+    putAttribute(output, "pixelAspectRatio", "float", value);
+
+    value.clear();
+    put<float>(value, 0);
+    put<float>(value, 0);
+    putAttribute(output, "screenWindowCenter", "v2f", value);
+
+    value.clear();
+    put<float>(value, 1);
+    putAttribute(output, "screenWindowWidth", "float", value);
+
+    put<uint8_t>(output, 0);
+    return output;
+}
+
+// The uncompressed scanlines y to y_end, every scanline holds all values of
+// the first channel, then all of the second and so on
+static void chunkData(const Framebuffer &framebuffer, const std::vector<ExrChannel> &channels,
+                      int y, int y_end, std::vector<uint8_t> &output)
+{
+    int width = framebuffer.width();
+    std::vector<Color> values(width);
+    Aov resolved = AOV_NONE;
+
+    for (int line = y; line < y_end; line++)
+    {
+        // EXR starts at the top, the framebuffer at the bottom
+        int row = framebuffer.y() + framebuffer.height() - 1 - line;
+        bool first = true;
+
+        for (const ExrChannel &channel : channels)
+        {
+            if (first || channel.aov != resolved)
+            {
+                for (int x = 0; x < width; x++)
+                {
+                    int px = framebuffer.x() + x;
+                    values[x] = channel.aov == AOV_NONE ? framebuffer.resolve(px, row)
+                                                        : framebuffer.resolve(px, row, channel.aov);
+                }
+                resolved = channel.aov;
+                first = false;
+            }
+
+            for (int x = 0; x < width; x++)
+            {
+                float value = values[x][channel.component];
+                if (channel.type == EXR_PIXEL_HALF)
+                    put<uint16_t>(output, floatToHalf(value));
+                else
+                    put<float>(output, value);
+            }
+        }
+    }
+}
+
+// ZIP compression reorders the bytes and stores differences between them
+// before they are deflated, see the OpenEXR file layout documentation
+static void zipCompress(const std::vector<uint8_t> &data, std::vector<uint8_t> &output)
+{
+    size_t size = data.size();
+    std::vector<uint8_t> reordered(size);
+
+    // Even bytes go to the first half, odd bytes to the second
+    size_t half = (size + 1) / 2;
+    for (size_t i = 0; i < size; i++)
+        reordered[(i & 1) ? half + i / 2 : i / 2] = data[i];
+
+    uint8_t previous = size > 0 ? reordered[0] : 0;
+    for (size_t i = 1; i < size; i++)
+    {
+        uint8_t current = reordered[i];
+        reordered[i] = current - previous + 128;
+        previous = current;
+    }
+
+    Deflate::zlibCompress(reordered.data(), size, EXR_ZIP_LEVEL, output);
+
+    // Data that does not get smaller is stored as is
+    if (output.size() >= size)
+        output = data;
+}
+
+int Exr::write(const Framebuffer &framebuffer, std::string filename, ExrCompression compression, bool half)
+{
+    ExrWriter writer(filename, framebuffer.width(), framebuffer.height(), framebuffer.aovs(), compression, half);
+    if (!writer.isOpen())
+        return -1;
+
+    if (!writer.writeBand(framebuffer) || !writer.close())
+        return -1;
+
+    return 0;
+}
+
+ExrWriter::ExrWriter(std::string filename, int width, int height, uint32_t aovs, ExrCompression compression, bool half)
+    : m_width(width), m_height(height), m_compression(compression), m_channels(channels(aovs, half))
+{
+    m_output.open(filename, std::ios::out | std::ios::binary);
+    if (!m_output.is_open())
+        return;
+
+    std::vector<uint8_t> file_header = header(width, height, m_channels, compression);
+    m_output.write((const char *)file_header.data(), file_header.size());
+
+    // The offset table is written once all chunks are in place
+    int chunk_count = (height + linesPerChunk() - 1) / linesPerChunk();
+    std::vector<uint8_t> table(chunk_count * sizeof(uint64_t), 0);
+    m_table = m_output.tellp();
+    m_output.write((const char *)table.data(), table.size());
+}
+
+ExrWriter::~ExrWriter()
+{
+    if (m_output.is_open())
+        close();
+}
+
+int ExrWriter::linesPerChunk() const
+{
+    return m_compression == ExrCompression::Zip ? EXR_ZIP_SCANLINES : EXR_NONE_SCANLINES;
+}
+
+bool ExrWriter::writeBand(const Framebuffer &band)
+{
+    int lines_per_chunk = linesPerChunk();
+    if (m_next_line % lines_per_chunk != 0 || m_next_line + band.height() > m_height)
+        return false;
+    int height = band.height();
+    int chunk_count = (height + lines_per_chunk - 1) / lines_per_chunk;
+
+    std::vector<std::vector<uint8_t>> chunks(chunk_count);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < chunk_count; i++)
+    {
+        int y = i * lines_per_chunk;
+        int y_end = std::min(y + lines_per_chunk, height);
+
+        std::vector<uint8_t> data;
+        chunkData(band, m_channels, y, y_end, data);
+
+        std::vector<uint8_t> &chunk = chunks[i];
+        put<int32_t>(chunk, m_next_line + y);
+        put<int32_t>(chunk, 0);     // Size, filled in below
+
+        size_t start = chunk.size();
+        if (m_compression == ExrCompression::Zip)
+        {
+            std::vector<uint8_t> compressed;
+            zipCompress(data, compressed);
+            chunk.insert(chunk.end(), compressed.begin(), compressed.end());
+        }
+        else
+            chunk.insert(chunk.end(), data.begin(), data.end());
+
+        int32_t size = chunk.size() - start;
+        memcpy(&chunk[sizeof(int32_t)], &size, sizeof(size));
+    }
+
+    for (const std::vector<uint8_t> &chunk : chunks)
+    {
+        m_offsets.push_back(m_output.tellp());
+        m_output.write((const char *)chunk.data(), chunk.size());
+    }
+
+    m_next_line += height;
+    return m_output.good();
+}
+
+bool ExrWriter::close()
+{
+    // The offset table points at the start of every chunk in the file
+    m_output.seekp(m_table);
+    m_output.write((const char *)m_offsets.data(), m_offsets.size() * sizeof(uint64_t));
+
+    bool complete = m_output.good() && m_next_line == m_height;
+    m_output.close();
+    return complete;
+}
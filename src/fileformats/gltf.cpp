@@ -2,60 +2,103 @@
 #include <vec4.h>
 #include <debug.h>
 #include <fileformats/gltf.h>
-#include <hitables/triangle.h>
+#include <hitables/mesh.h>
 #include <materials/lambertian.h>
 #include <materials/pbr.h>
 #include <textures/uv_texture.h>
+#include <textures/image_texture.h>
+#include <textures/texture_cache.h>
+#include <mapped_file.h>
+#include <png.h>
+#include <jpeg.h>
 #include <json.h>
 
+#include <omp.h>
+
+#include <cstring>
+#include <numeric>
+
 using json = nlohmann::json_abi_v3_11_3::json;
 
-Point3 GLTF::parseNodeTranslation(json &node)
+static_assert(sizeof(Vec3f) == sizeof(GLTFVec3<float>), "Packed float VEC3 accessors are used as Vec3f in place");
+
+Transform GLTF::parseNodeTransform(const json &node)
 {
-    double x, y, z;
-    Point3 location = Point3(0, 0, 0);
+    // A node has either a matrix or a translation, rotation and scale, which
+    // are applied scale first
+    if (node.contains("matrix"))
+    {
+        double values[16];
+        const json &matrix = node.at("matrix");
+        for (int i = 0; i < 16; i++)
+            matrix.at(i).get_to(values[i]);
+        return Transform::fromColumnMajor(values);
+    }
 
-    // Node contains translation, extract XYZ location
+    Transform transform;
     if (node.contains("translation"))
     {
-        node["translation"][0].get_to(x);
-        node["translation"][1].get_to(y);
-        node["translation"][2].get_to(z);
-        location = Point3(x, y, z) * GLTF_UNIT_TO_RT_UNIT;
+        const json &translation = node.at("translation");
+        transform = Transform::translation(Vec3d(translation.at(0), translation.at(1), translation.at(2)));
+    }
+    if (node.contains("rotation"))
+    {
+        const json &rot = node.at("rotation");
+        transform = transform * Transform::rotation(Quaternion(rot.at(0), rot.at(1), rot.at(2), rot.at(3)));
     }
-    return location;
+    if (node.contains("scale"))
+    {
+        const json &scale = node.at("scale");
+        transform = transform * Transform::scale(Vec3d(scale.at(0), scale.at(1), scale.at(2)));
+    }
+    return transform;
 }
 
-Quaternion GLTF::parseNodeRotation(json &node)
+void GLTF::parseNode(Scene &scene, int node_idx, const Transform &parent, std::vector<bool> &visited,
+                     std::vector<GLTFInstance> &instances)
 {
-    double x, y, z, w;
-    Quaternion q = Quaternion(0, 0, 0, 1);
+    const json &node = m_file->at("nodes").at(node_idx);
 
-    if (node.contains("rotation"))
+    // The nodes form trees, a node that is reached twice has two parents or
+    // is part of a cycle
+    if (visited[node_idx])
     {
-        auto rot = node["rotation"];
-        rot[0].get_to(x);
-        rot[1].get_to(y);
-        rot[2].get_to(z);
-        rot[3].get_to(w);
+        ERROR("GLTF node " << node_idx << " has more than one parent");
+        exit(1);
+    }
+    visited[node_idx] = true;
+
+    Transform transform = parent * parseNodeTransform(node);
 
-        q = Quaternion(x, y, z, w);
+    if (node.contains("mesh"))
+    {
+        int mesh_idx;
+        node.at("mesh").get_to(mesh_idx);
+        parseMesh(mesh_idx);
+        instances.push_back({mesh_idx, transform});
     }
 
-    return q;
+    if (node.contains("camera"))
+    {
+        parseCameraNode(scene, node, transform);
+    }
+
+    if (node.contains("children"))
+    {
+        for (const json &child : node.at("children"))
+            parseNode(scene, child.get<int>(), transform, visited, instances);
+    }
 }
 
-void GLTF::parseCameraNode(Scene &scene, json &node, json &file)
+void GLTF::parseCameraNode(Scene &scene, const json &node, const Transform &transform)
 {
-    Point3 location = parseNodeTranslation(node);
-
     // Get the camera node
     int camera_idx;
-    node["camera"].get_to(camera_idx);
-    json camera = file["cameras"][camera_idx];
+    node.at("camera").get_to(camera_idx);
+    const json &camera = m_file->at("cameras").at(camera_idx);
 
     // We only support perspective cameras (and no orthographic cameras)
-    if (camera["type"] != "perspective")
+    if (camera.at("type") != "perspective")
     {
         ERROR("Only perspective cameras are supported");
         exit(1);
@@ -64,60 +107,485 @@ void GLTF::parseCameraNode(Scene &scene, json &node, json &file)
     double aspect_ratio = 1.777;
     double yfov;
 
-    camera["perspective"]["yfov"].get_to(yfov);
-    if (camera["perspective"].contains("aspectRatio"))
+    const json &perspective = camera.at("perspective");
+    perspective.at("yfov").get_to(yfov);
+    if (perspective.contains("aspectRatio"))
     {
-        camera["perspective"]["aspectRatio"].get_to(aspect_ratio);
+        perspective.at("aspectRatio").get_to(aspect_ratio);
     }
 
     // Transform yfov from radians to degrees
     yfov = (yfov / (2 * pi)) * 360;
 
-    // Default lookAt is just in the forward direction
-    Direction cameraLookDirection = Direction(0, 0, 1);
-    cameraLookDirection = parseNodeRotation(node) * cameraLookDirection;
+    // Cameras look down their -Z axis with +Y up
+    Point3 location = transform.point(Point3(0, 0, 0));
+    Direction forward = normalize(transform.direction(Direction(0, 0, -1)));
+    Direction up = normalize(transform.direction(Direction(0, 1, 0)));
+
+    scene.setCamera(Camera(location, location + forward, aspect_ratio, yfov, 0.00001, -1, up));
+}
+
+static size_t componentSize(int component_type)
+{
+    switch (component_type)
+    {
+    case GLTF_ACCESSOR_COMPTYPE_UBYTE:
+        return 1;
+    case GLTF_ACCESSOR_COMPTYPE_USHORT:
+        return 2;
+    case GLTF_ACCESSOR_COMPTYPE_UINT:
+    case GLTF_ACCESSOR_COMPTYPE_FLOAT:
+        return 4;
+    }
+
+    ERROR("Unsupported GLTF accessor component type " << component_type);
+    exit(1);
+}
+
+static int componentCount(const std::string &type)
+{
+    if (type == "SCALAR")
+        return 1;
+    if (type == "VEC2")
+        return 2;
+    if (type == "VEC3")
+        return 3;
+    if (type == "VEC4")
+        return 4;
+
+    ERROR("Unsupported GLTF accessor type " << type);
+    exit(1);
+}
+
+uint32_t GLTFAccessor::index(size_t i) const
+{
+    // Elements do not have to be aligned, so they are copied out
+    const uint8_t *element = data + i * stride;
+    switch (component_type)
+    {
+    case GLTF_ACCESSOR_COMPTYPE_UBYTE:
+        return *element;
+    case GLTF_ACCESSOR_COMPTYPE_USHORT:
+    {
+        uint16_t value;
+        memcpy(&value, element, sizeof(value));
+        return value;
+    }
+    default:
+    {
+        uint32_t value;
+        memcpy(&value, element, sizeof(value));
+        return value;
+    }
+    }
+}
+
+Vec3f GLTFAccessor::vec3(size_t i) const
+{
+    GLTFVec3<float> value;
+    memcpy(&value, data + i * stride, sizeof(value));
+    return value.toVec3f();
+}
+
+TexCoord GLTFAccessor::vec2(size_t i) const
+{
+    const uint8_t *element = data + i * stride;
+    float values[2];
+    for (int c = 0; c < 2; c++)
+    {
+        switch (component_type)
+        {
+        case GLTF_ACCESSOR_COMPTYPE_UBYTE:
+            values[c] = element[c] / 255.0f;
+            break;
+        case GLTF_ACCESSOR_COMPTYPE_USHORT:
+        {
+            uint16_t value;
+            memcpy(&value, element + c * sizeof(value), sizeof(value));
+            values[c] = value / 65535.0f;
+            break;
+        }
+        default:
+            memcpy(&values[c], element + c * sizeof(float), sizeof(float));
+            break;
+        }
+    }
+
+    // glTF starts v at the top of the image, textures at the bottom
+    return TexCoord{values[0], 1 - values[1]};
+}
+
+GLTFAccessor GLTF::getAccessor(int accessor_idx)
+{
+    const json &file = *m_file;
+    const GLTFBuffer &bin = m_bin;
+    const json &accessor = file.at("accessors").at(accessor_idx);
+
+    GLTFAccessor view;
+    accessor.at("componentType").get_to(view.component_type);
+    accessor.at("count").get_to(view.count);
+    view.components = componentCount(accessor.at("type").get<std::string>());
+    view.normalized = accessor.value("normalized", false);
+
+    if (!accessor.contains("bufferView"))
+    {
+        ERROR("GLTF accessors without a buffer view are not supported");
+        exit(1);
+    }
+
+    const json &bufferview = file.at("bufferViews").at(accessor.at("bufferView").get<int>());
+    if (bufferview.value("buffer", 0) != 0)
+    {
+        ERROR("Only the binary chunk of a GLB file is supported as a GLTF buffer");
+        exit(1);
+    }
+
+    // Both the buffer view and the accessor can have an offset
+    size_t element_size = componentSize(view.component_type) * view.components;
+    size_t offset = bufferview.value("byteOffset", (size_t)0) + accessor.value("byteOffset", (size_t)0);
+    view.stride = bufferview.value("byteStride", element_size);
+
+    if (view.count > 0 && (offset > bin.size || (view.count - 1) * view.stride + element_size > bin.size - offset))
+    {
+        ERROR("GLTF accessor " << accessor_idx << " lies outside of the binary chunk");
+        exit(1);
+    }
+
+    view.data = bin.data + offset;
+    return view;
+}
+
+const std::vector<GLTFPrimitive> &GLTF::parseMesh(int mesh_idx)
+{
+    // Meshes that are used by more than one node are parsed once
+    auto found = m_meshes.find(mesh_idx);
+    if (found != m_meshes.end())
+        return found->second;
+
+    std::vector<GLTFPrimitive> &primitives = m_meshes[mesh_idx];
+    const json &mesh = m_file->at("meshes").at(mesh_idx);
+
+    // All values in the primitives are indices into the accessor array
+    for (const json &primitive_json : mesh.at("primitives"))
+    {
+        if (primitive_json.value("mode", GLTF_PRIMITIVE_MODE_TRIANGLES) != GLTF_PRIMITIVE_MODE_TRIANGLES)
+        {
+            WARN("GLTF mesh " << mesh_idx << " has points or lines, they are skipped");
+            continue;
+        }
+
+        if (!primitive_json.contains("material"))
+        {
+            ERROR("GLTF contains an object without a material applied to it");
+            exit(1);
+        }
+
+        GLTFPrimitive primitive;
+        const json &attributes = primitive_json.at("attributes");
+        attributes.at("POSITION").get_to(primitive.positions);
+        primitive.normals = attributes.value("NORMAL", -1);
+        primitive.texcoords = attributes.value("TEXCOORD_0", -1);
+        primitive.indices = primitive_json.value("indices", -1);
+        primitive_json.at("material").get_to(primitive.material);
+        primitives.push_back(primitive);
+    }
+
+    return primitives;
+}
+
+// Split the jobs into tasks of at most GLTF_ELEMENTS_PER_TASK elements, so
+// a single big accessor is spread over all threads, and run them
+static void runJobs(std::vector<GLTFJob> &jobs)
+{
+    struct Task
+    {
+        size_t job;
+        size_t begin;
+        size_t end;
+        uint32_t result;
+    };
+
+    std::vector<Task> tasks;
+    for (size_t j = 0; j < jobs.size(); j++)
+    {
+        for (size_t begin = 0; begin < jobs[j].count; begin += GLTF_ELEMENTS_PER_TASK)
+            tasks.push_back({j, begin, std::min<size_t>(begin + GLTF_ELEMENTS_PER_TASK, jobs[j].count), 0});
+    }
+
+#pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < (int)tasks.size(); t++)
+    {
+        Task &task = tasks[t];
+        task.result = jobs[task.job].run(task.begin, task.end);
+    }
+
+    for (const Task &task : tasks)
+        jobs[task.job].result = std::max(jobs[task.job].result, task.result);
+}
+
+void GLTF::decodeAccessors(const std::vector<GLTFInstance> &instances)
+{
+    std::vector<GLTFJob> jobs;
+    std::map<int, size_t> index_jobs;
+
+    auto addVec3 = [&](int accessor_idx, const char *name) {
+        if (accessor_idx < 0 || m_vec3s.count(accessor_idx))
+            return;
+
+        GLTFAccessor accessor = getAccessor(accessor_idx);
+        if (accessor.component_type != GLTF_ACCESSOR_COMPTYPE_FLOAT || accessor.components != 3)
+        {
+            ERROR("GLTF " << name << " have to be float VEC3");
+            exit(1);
+        }
+
+        // Packed floats are already laid out like Vec3f, the mesh uses them
+        // straight from the mapping
+        if (accessor.stride == sizeof(Vec3f) && (uintptr_t)accessor.data % alignof(Vec3f) == 0)
+        {
+            m_vec3s[accessor_idx] = MeshBuffer<Vec3f>(m_bin.owner, (const Vec3f *)accessor.data, accessor.count);
+            return;
+        }
+
+        auto buffer = std::make_shared<std::vector<Vec3f>>(accessor.count);
+        m_vec3s[accessor_idx] = buffer;
+        jobs.push_back({accessor.count, [accessor, buffer](size_t begin, size_t end) {
+                            for (size_t i = begin; i < end; i++)
+                                (*buffer)[i] = accessor.vec3(i);
+                            return 0u;
+                        }});
+    };
+
+    auto addTexCoords = [&](int accessor_idx) {
+        if (accessor_idx < 0 || m_texcoords.count(accessor_idx))
+            return;
+
+        GLTFAccessor accessor = getAccessor(accessor_idx);
+        bool integer = accessor.component_type == GLTF_ACCESSOR_COMPTYPE_UBYTE ||
+                       accessor.component_type == GLTF_ACCESSOR_COMPTYPE_USHORT;
+        if (!(accessor.component_type == GLTF_ACCESSOR_COMPTYPE_FLOAT || (integer && accessor.normalized)) ||
+            accessor.components != 2)
+        {
+            ERROR("GLTF texture coordinates have to be float or normalized integer VEC2");
+            exit(1);
+        }
+
+        auto buffer = std::make_shared<std::vector<TexCoord>>(accessor.count);
+        m_texcoords[accessor_idx] = buffer;
+        jobs.push_back({accessor.count, [accessor, buffer](size_t begin, size_t end) {
+                            for (size_t i = begin; i < end; i++)
+                                (*buffer)[i] = accessor.vec2(i);
+                            return 0u;
+                        }});
+    };
+
+    // The largest index is kept, so the indices can be checked against
+    // every set of positions they are used with
+    auto addIndices = [&](int accessor_idx) {
+        if (accessor_idx < 0 || m_indices.count(accessor_idx))
+            return;
+
+        GLTFAccessor accessor = getAccessor(accessor_idx);
+        if (accessor.component_type == GLTF_ACCESSOR_COMPTYPE_FLOAT || accessor.components != 1)
+        {
+            ERROR("GLTF indices have to be unsigned integer scalars");
+            exit(1);
+        }
+
+        auto buffer = std::make_shared<std::vector<uint32_t>>(accessor.count / 3 * 3);
+        m_indices[accessor_idx] = buffer;
+        index_jobs[accessor_idx] = jobs.size();
+        jobs.push_back({buffer->size(), [accessor, buffer](size_t begin, size_t end) {
+                            uint32_t max = 0;
+                            for (size_t i = begin; i < end; i++)
+                            {
+                                (*buffer)[i] = accessor.index(i);
+                                max = std::max(max, (*buffer)[i]);
+                            }
+                            return max;
+                        }});
+    };
+
+    for (const GLTFInstance &instance : instances)
+    {
+        for (const GLTFPrimitive &primitive : m_meshes.at(instance.mesh))
+        {
+            addVec3(primitive.positions, "vertex positions");
+            addVec3(primitive.normals, "normals");
+            addTexCoords(primitive.texcoords);
+            addIndices(primitive.indices);
+        }
+    }
+
+    runJobs(jobs);
 
-    Point3 lookAt = location - cameraLookDirection;
-    scene.setCamera(Camera(location, lookAt, aspect_ratio, yfov, 0.00001));
+    for (const auto &[accessor_idx, job] : index_jobs)
+        m_max_index[accessor_idx] = jobs[job].result;
 }
 
-void *GLTF::getBufferviewData(json file, char *bin_data, int bufferview_idx)
+std::shared_ptr<LdrImage> GLTF::decodeImage(int image_idx)
 {
-    size_t offset;
-    json bufferview = file["bufferViews"][bufferview_idx];
-    bufferview["byteOffset"].get_to(offset);
+    const json &image = m_file->at("images").at(image_idx);
+    const uint8_t *data = nullptr;
+    size_t size = 0;
 
-    return bin_data + offset;
+    // Images are embedded in the binary chunk or stored next to the file
+    std::unique_ptr<MappedFile> external;
+    if (image.contains("bufferView"))
+    {
+        const json &bufferview = m_file->at("bufferViews").at(image.at("bufferView").get<int>());
+        size_t offset = bufferview.value("byteOffset", (size_t)0);
+        size = bufferview.at("byteLength").get<size_t>();
+        if (bufferview.value("buffer", 0) != 0 || offset > m_bin.size || size > m_bin.size - offset)
+        {
+            WARN("GLTF image " << image_idx << " lies outside of the binary chunk");
+            return nullptr;
+        }
+        data = m_bin.data + offset;
+    }
+    else if (image.contains("uri"))
+    {
+        std::string uri = image.at("uri");
+        if (uri.rfind("data:", 0) == 0)
+        {
+            WARN("GLTF image " << image_idx << " is stored in a data URI, which is not supported");
+            return nullptr;
+        }
+
+        std::string directory = m_infile_name.substr(0, m_infile_name.find_last_of('/') + 1);
+        external = std::make_unique<MappedFile>(directory + uri);
+        if (!external->isOpen())
+        {
+            WARN("Could not read GLTF image '" << directory + uri << "'");
+            return nullptr;
+        }
+        data = external->data();
+        size = external->size();
+    }
+
+    // The format is told by the first bytes, the mime type is often left out
+    if (size >= 8 && memcmp(data, "\x89PNG", 4) == 0)
+        return Png::read(data, size);
+    if (size >= 3 && data[0] == 0xFF && data[1] == 0xD8)
+        return Jpeg::read(data, size);
+
+    WARN("GLTF image " << image_idx << " is not a PNG or JPEG image");
+    return nullptr;
+}
+
+int GLTF::textureSource(const json &texture_info)
+{
+    const json &texture = m_file->at("textures").at(texture_info.at("index").get<int>());
+    return texture.value("source", -1);
 }
 
-std::shared_ptr<Material> GLTF::parseMaterial(json file, int mat_idx, bool &is_emissive)
+std::shared_ptr<Texture> GLTF::materialTexture(const json &texture_info)
 {
-    auto material = file["materials"][mat_idx];
-    auto pbr = material["pbrMetallicRoughness"];
+    if (texture_info.value("texCoord", 0) != 0)
+        WARN("GLTF textures can only use the first set of texture coordinates");
+
+    // Images that could not be decoded are left out
+    auto found = m_images.find(textureSource(texture_info));
+    return found != m_images.end() ? found->second : nullptr;
+}
+
+void GLTF::loadImages(const std::vector<GLTFInstance> &instances)
+{
+    static const json no_pbr = json::object();
+
+    // Only the images that a material in the scene uses are decoded
+    std::vector<int> images;
+    auto addImage = [&](const json &parent, const char *name) {
+        if (!parent.contains(name))
+            return;
+
+        int image_idx = textureSource(parent.at(name));
+        if (image_idx >= 0 && !m_images.count(image_idx))
+        {
+            m_images[image_idx] = nullptr;
+            images.push_back(image_idx);
+        }
+    };
+
+    for (const GLTFInstance &instance : instances)
+    {
+        for (const GLTFPrimitive &primitive : m_meshes.at(instance.mesh))
+        {
+            const json &material = m_file->at("materials").at(primitive.material);
+            const json &pbr = material.contains("pbrMetallicRoughness") ? material.at("pbrMetallicRoughness") : no_pbr;
+            addImage(pbr, "baseColorTexture");
+            addImage(material, "emissiveTexture");
+        }
+    }
+
+    // The images are decoded by all threads at once, a batch at a time so
+    // only a few decoded images are around at the same time. The textures
+    // then convert their pixels with all threads, one at a time. With a
+    // texture cache only the tiles of the textures stay around.
+    size_t batch = omp_get_max_threads();
+    for (size_t start = 0; start < images.size(); start += batch)
+    {
+        size_t end = std::min(start + batch, images.size());
+        std::vector<std::shared_ptr<LdrImage>> decoded(end - start);
+
+#pragma omp parallel for schedule(dynamic)
+        for (int i = start; i < (int)end; i++)
+            decoded[i - start] = decodeImage(images[i]);
+
+        for (size_t i = start; i < end; i++)
+        {
+            if (decoded[i - start])
+                m_images[images[i]] = cacheTexture(std::make_shared<LdrImageTexture>(*decoded[i - start]));
+            else
+                m_images.erase(images[i]);
+            decoded[i - start] = nullptr;
+        }
+    }
+}
+
+std::shared_ptr<Material> GLTF::parseMaterial(int mat_idx, bool &is_emissive)
+{
+    static const json no_pbr = json::object();
+
+    // Materials are shared by all primitives that use them
+    auto found = m_materials.find(mat_idx);
+    if (found != m_materials.end())
+    {
+        is_emissive = m_emissive.at(mat_idx);
+        return found->second;
+    }
+
+    const json &material = m_file->at("materials").at(mat_idx);
+    const json &pbr = material.contains("pbrMetallicRoughness") ? material.at("pbrMetallicRoughness") : no_pbr;
 
     std::shared_ptr<Texture> emission = std::make_shared<SolidColor>(Color(0));
     double r = 1, g = 1, b = 1, metallic = 1, roughness = 1, emissionStrength = 0, transmission = 0;
 
     if (material.contains("emissiveFactor"))
     {
-        auto emissiveFactor = material["emissiveFactor"];
+        const json &emissiveFactor = material.at("emissiveFactor");
         emissiveFactor[0].get_to(r);
         emissiveFactor[1].get_to(g);
         emissiveFactor[2].get_to(b);
         emissionStrength = 1;
         is_emissive = true;
         emission = std::make_shared<SolidColor>(r, g, b);
+
+        // The factor scales the texture
+        std::shared_ptr<Texture> texture = material.contains("emissiveTexture") ? materialTexture(material.at("emissiveTexture")) : nullptr;
+        if (texture)
+            emission = std::make_shared<ScaledTexture>(texture, Color(r, g, b));
     }
 
     // Handle extensions to the regular GLTF specification
     if (material.contains("extensions"))
     {
-        auto extensions = material["extensions"];
+        const json &extensions = material.at("extensions");
 
         if (extensions.contains("KHR_materials_emissive_strength"))
         {
-            auto em = material["extensions"]["KHR_materials_emissive_strength"];
-            em["emissiveStrength"].get_to(emissionStrength);
+            const json &em = extensions.at("KHR_materials_emissive_strength");
+            em.at("emissiveStrength").get_to(emissionStrength);
 
             // TODO: maybe we should check if emissionStrength is above some threshold.
             is_emissive = true;
@@ -125,139 +593,173 @@ std::shared_ptr<Material> GLTF::parseMaterial(json file, int mat_idx, bool &is_e
 
         if (extensions.contains("KHR_materials_transmission"))
         {
-            extensions["KHR_materials_transmission"]["transmissionFactor"].get_to(transmission);
+            extensions.at("KHR_materials_transmission").at("transmissionFactor").get_to(transmission);
         }
     }
 
+    // The base color defaults to white, not to the emission
+    r = g = b = 1;
     if (pbr.contains("baseColorFactor"))
     {
-        pbr["baseColorFactor"][0].get_to(r);
-        pbr["baseColorFactor"][1].get_to(g);
-        pbr["baseColorFactor"][2].get_to(b);
+        const json &baseColorFactor = pbr.at("baseColorFactor");
+        baseColorFactor[0].get_to(r);
+        baseColorFactor[1].get_to(g);
+        baseColorFactor[2].get_to(b);
     }
 
+    std::shared_ptr<Texture> color = std::make_shared<SolidColor>(r, g, b);
+    std::shared_ptr<Texture> texture = pbr.contains("baseColorTexture") ? materialTexture(pbr.at("baseColorTexture")) : nullptr;
+    if (texture)
+        color = std::make_shared<ScaledTexture>(texture, Color(r, g, b));
+
     if (pbr.contains("metallicFactor"))
     {
-        pbr["metallicFactor"].get_to(metallic);
+        pbr.at("metallicFactor").get_to(metallic);
     }
 
     if (pbr.contains("roughnessFactor"))
     {
-        pbr["roughnessFactor"].get_to(roughness);
+        pbr.at("roughnessFactor").get_to(roughness);
     }
 
     DEBUG("Material with roughness " << roughness << " metallic " << metallic << " transmission " << transmission << " emission strength " << emissionStrength);
-    return std::make_shared<PBR>(std::make_shared<SolidColor>(r, g, b), roughness, metallic >= 0.1, transmission, emission, emissionStrength);
+    auto result = std::make_shared<PBR>(color, roughness, metallic >= 0.1, transmission, emission, emissionStrength);
+    m_materials[mat_idx] = result;
+    m_emissive[mat_idx] = is_emissive;
+    return result;
 }
 
-void GLTF::parseMeshNode(Scene &scene, json &node, json &file, char *bin_data)
+void GLTF::buildMeshes(Scene &scene, const std::vector<GLTFInstance> &instances)
 {
-    // Get the mesh node
-    int mesh_idx;
-    node["mesh"].get_to(mesh_idx);
-    json mesh = file["meshes"][mesh_idx];
-
-    // The primitives object contains the positions of all
-    // the vertices as well as texture coordinates etc.
-    for (const auto &primitives : mesh["primitives"])
+    struct Part
     {
-        int positions_accessor_idx;
-        int indices_accessor_idx;
-        int material_idx;
-
-        // All values in the primitives json object are indices into the accessor array
-        primitives["attributes"]["POSITION"].get_to(positions_accessor_idx);
-        primitives["indices"].get_to(indices_accessor_idx);
-
-        if (!primitives.contains("material"))
-        {
-            ERROR("GLTF contains an object without a material applied to it");
-            exit(1);
-        }
-        primitives["material"].get_to(material_idx);
-
-        // All data from accessors is stored in the binary part of this file.
-        // It is described by bufferviews which have their types etc.
-        json pos_accessor = file["accessors"][positions_accessor_idx];
-        json ind_accessor = file["accessors"][indices_accessor_idx];
-
-        // Handle the position accessor, this describes where the vertices of the mesh
-        // are in 3d space (I think).
-        size_t positions_count;
-        int bufferview_idx;
-        int component_type;
-        std::string type;
-        pos_accessor["componentType"].get_to(component_type);
-        pos_accessor["bufferView"].get_to(bufferview_idx);
-        pos_accessor["count"].get_to(positions_count);
-        pos_accessor["type"].get_to(type);
-
-        assert(component_type == GLTF_ACCESSOR_COMPTYPE_FLOAT);
-        assert(type == "VEC3");
-
-        GLTFVec3<float> *positions = static_cast<GLTFVec3<float> *>(getBufferviewData(file, bin_data, bufferview_idx));
-
-        // Now use the indices to create triangles and add them to the hitable list
-
-        size_t indices_count;
-        ind_accessor["bufferView"].get_to(bufferview_idx);
-        ind_accessor["count"].get_to(indices_count);
-        ind_accessor["type"].get_to(type);
-        ind_accessor["componentType"].get_to(component_type);
-
-        assert(component_type == GLTF_ACCESSOR_COMPTYPE_USHORT || component_type == GLTF_ACCESSOR_COMPTYPE_UINT);
-        assert(type == "SCALAR");
-
-        uint32_t *indices = new uint32_t[indices_count];
-
-        if (component_type == GLTF_ACCESSOR_COMPTYPE_USHORT)
+        int mesh;
+        int material;
+        MeshBuffer<Vec3f> positions;
+        MeshBuffer<uint32_t> indices;
+        MeshBuffer<Vec3f> normals;
+        MeshBuffer<TexCoord> texcoords;
+    };
+
+    std::vector<Part> parts;
+    std::vector<GLTFJob> jobs;
+
+    for (const GLTFInstance &instance : instances)
+    {
+        // Copies that are not moved use the decoded vertices as they are.
+        // Transformed vertices are shared by the primitives of the copy.
+        std::map<int, MeshBuffer<Vec3f>> positions;
+        std::map<int, MeshBuffer<Vec3f>> normals;
+        auto transformed = [&](int accessor_idx, bool normal) -> MeshBuffer<Vec3f> {
+            if (accessor_idx < 0)
+                return nullptr;
+
+            MeshBuffer<Vec3f> source = m_vec3s.at(accessor_idx);
+            const Transform &transform = instance.transform;
+            if (transform.isIdentity() || (normal && transform.isTranslation()))
+                return source;
+
+            std::map<int, MeshBuffer<Vec3f>> &cache = normal ? normals : positions;
+            auto found = cache.find(accessor_idx);
+            if (found != cache.end())
+                return found->second;
+
+            // The transform is applied in double, the result is stored as float
+            auto buffer = std::make_shared<std::vector<Vec3f>>(source.size());
+            cache[accessor_idx] = buffer;
+            jobs.push_back({source.size(), [source, buffer, transform, normal](size_t begin, size_t end) {
+                                for (size_t i = begin; i < end; i++)
+                                {
+                                    Vec3d value(source[i]);
+                                    (*buffer)[i] = Vec3f(normal ? normalize(transform.normal(value)) : transform.point(value));
+                                }
+                                return 0u;
+                            }});
+            return buffer;
+        };
+
+        for (const GLTFPrimitive &primitive : m_meshes.at(instance.mesh))
         {
-            uint16_t *temp = static_cast<uint16_t *>(getBufferviewData(file, bin_data, bufferview_idx));
-
-            for (size_t i = 0; i < indices_count; i++)
+            Part part;
+            part.mesh = instance.mesh;
+            part.material = primitive.material;
+            part.positions = transformed(primitive.positions, false);
+            part.normals = transformed(primitive.normals, true);
+            part.texcoords = primitive.texcoords >= 0 ? m_texcoords.at(primitive.texcoords) : nullptr;
+
+            size_t vertex_count = part.positions.size();
+            if (primitive.indices >= 0)
             {
-                indices[i] = temp[i];
+                part.indices = m_indices.at(primitive.indices);
+                if (!part.indices.empty() && m_max_index.at(primitive.indices) >= vertex_count)
+                {
+                    ERROR("GLTF mesh " << instance.mesh << " has indices that are out of range");
+                    exit(1);
+                }
+            }
+            else
+            {
+                // Without indices every three consecutive vertices make a
+                // triangle, the same indices serve every such primitive
+                size_t count = vertex_count / 3 * 3;
+                auto found = m_sequential.find(count);
+                if (found == m_sequential.end())
+                {
+                    auto indices = std::make_shared<std::vector<uint32_t>>(count);
+                    std::iota(indices->begin(), indices->end(), 0);
+                    found = m_sequential.emplace(count, indices).first;
+                }
+                part.indices = found->second;
             }
-        }
-        else
-        {
-            memcpy(indices, getBufferviewData(file, bin_data, bufferview_idx), sizeof(uint32_t) * indices_count);
-        }
 
-        bool is_emissive = false;
-        auto mat = parseMaterial(file, material_idx, is_emissive);
+            parts.push_back(part);
+        }
+    }
 
-        auto list = std::make_shared<HitableList>();
-        for (size_t i = 0; i < indices_count; i += 3)
-        {
+    runJobs(jobs);
 
-            auto triangle = new Triangle(
-                positions[indices[i + 0]].toPoint3() * GLTF_UNIT_TO_RT_UNIT,
-                positions[indices[i + 1]].toPoint3() * GLTF_UNIT_TO_RT_UNIT,
-                positions[indices[i + 2]].toPoint3() * GLTF_UNIT_TO_RT_UNIT,
-                mat);
+    for (const Part &part : parts)
+    {
+        if (part.indices.empty())
+            continue;
 
-            list->add(triangle);
-        }
+        bool is_emissive = false;
+        std::shared_ptr<Material> material = parseMaterial(part.material, is_emissive);
+        auto mesh = std::make_shared<Mesh>(part.positions, part.indices, material, part.normals, part.texcoords);
+        scene.addMesh(mesh);
 
         // If this material is emissive, it should be added to the lights
-        scene.getHitableList().add(list);
-
         if (is_emissive)
         {
-            scene.getLightList().push_back(list);
+            scene.getLightList().push_back(mesh);
         }
-
-        delete[] indices;
     }
 }
 
 void GLTF::read(Scene &scene)
 {
+    // The file is mapped instead of read, the json is parsed from the
+    // mapping and the meshes are built from the binary chunk in place. The
+    // mapping is shared with the vertex buffers that are views into it.
+    auto map = std::make_shared<MappedFile>(m_infile_name);
+    if (!map->isOpen())
+    {
+        ERROR("Could not read GLTF file: " << m_infile_name);
+        exit(1);
+    }
+
+    const uint8_t *data = map->data();
+    size_t size = map->size();
+
     GLTFHeader header;
     GLTFChunk chunk;
 
-    m_infile.read((char *)&header, sizeof(GLTFHeader));
+    if (size < sizeof(GLTFHeader) + sizeof(GLTFChunk))
+    {
+        ERROR("Invalid GLTF file");
+        exit(1);
+    }
+    memcpy(&header, data, sizeof(GLTFHeader));
 
     if (header.magic != GLTF_MAGIC_BYTES)
     {
@@ -271,52 +773,67 @@ void GLTF::read(Scene &scene)
         exit(1);
     }
 
-    // Read the first two chunks, json and binary data
-    m_infile.read((char *)&chunk, sizeof(GLTFChunk));
-
-    if (chunk.type != GLTF_CHUNK_TYPE_JSON)
+    if (header.length > size)
     {
-        ERROR("Invalid GLTF file, chunks are malformed");
+        ERROR("Invalid GLTF file, the file is truncated");
         exit(1);
     }
+    size_t end = header.length;
 
-    char *json_data = new char[chunk.length + 1];
-    json_data[chunk.length] = '\0';
-    m_infile.read(json_data, chunk.length);
+    // The first chunk is the json, the second one the binary data
+    size_t offset = sizeof(GLTFHeader);
+    memcpy(&chunk, data + offset, sizeof(GLTFChunk));
+    offset += sizeof(GLTFChunk);
 
-    m_infile.read((char *)&chunk, sizeof(GLTFChunk));
-    if (chunk.type != GLTF_CHUNK_TYPE_BIN)
+    if (chunk.type != GLTF_CHUNK_TYPE_JSON || chunk.length > end - offset)
     {
         ERROR("Invalid GLTF file, chunks are malformed");
         exit(1);
     }
 
-    char *bin_data = new char[chunk.length];
-    m_infile.read(bin_data, chunk.length);
-
     // Interpret the json file and populate the hitable list with the scene
-    json file = nlohmann::json::parse(json_data);
-
-    // We only support a single scene in this parser
-
-    std::int64_t scene_idx = file["scene"].template get<std::int64_t>();
+    const char *json_data = reinterpret_cast<const char *>(data + offset);
+    json file = json::parse(json_data, json_data + chunk.length);
+    offset += chunk.length;
 
-    json gltf_scene = file["scenes"][scene_idx];
-    for (json node_idx_json : gltf_scene["nodes"])
+    // The binary chunk is optional, a file without one has no meshes
+    GLTFBuffer bin;
+    if (end - offset >= sizeof(GLTFChunk))
     {
-        int node_idx;
-        node_idx_json.get_to(node_idx);
-        json node = file["nodes"][node_idx];
+        memcpy(&chunk, data + offset, sizeof(GLTFChunk));
+        offset += sizeof(GLTFChunk);
 
-        // TODO: handle rotation as well
-
-        if (node.contains("mesh"))
-        {
-            parseMeshNode(scene, node, file, bin_data);
-        }
-        else if (node.contains("camera"))
+        if (chunk.type != GLTF_CHUNK_TYPE_BIN || chunk.length > end - offset)
         {
-            parseCameraNode(scene, node, file);
+            ERROR("Invalid GLTF file, chunks are malformed");
+            exit(1);
         }
+
+        bin.owner = map;
+        bin.data = data + offset;
+        bin.size = chunk.length;
+    }
+
+    m_file = &file;
+    m_bin = bin;
+
+    // We only support a single scene in this parser
+    std::int64_t scene_idx = file.value("scene", (std::int64_t)0);
+
+    // The node trees are walked first, collecting the meshes they place with
+    // their transforms. The accessors and images are decoded afterwards and
+    // the meshes are built from them.
+    std::vector<GLTFInstance> instances;
+    std::vector<bool> visited(file.contains("nodes") ? file.at("nodes").size() : 0, false);
+    Transform root = Transform::scale(Vec3d(GLTF_UNIT_TO_RT_UNIT));
+
+    const json &gltf_scene = file.at("scenes").at(scene_idx);
+    for (const json &node_idx_json : gltf_scene.at("nodes"))
+    {
+        parseNode(scene, node_idx_json.get<int>(), root, visited, instances);
     }
-}
\ No newline at end of file
+
+    decodeAccessors(instances);
+    loadImages(instances);
+    buildMeshes(scene, instances);
+}
@@ -1,93 +1,376 @@
 #include <fileformats/obj.h>
-#include <hitables/triangle.h>
+#include <hitables/mesh.h>
+#include <mapped_file.h>
 
 #include <materials/metal.h>
 #include <materials/pbr.h>
 
-static void splitAtChar(std::string &line, std::vector<std::string> &parts, char split)
+#include <charconv>
+#include <cstring>
+#include <numeric>
+#include <string_view>
+
+static const char *skipSpace(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+// Values are separated by spaces, std::from_chars does not skip them and
+// does not take a leading plus either
+static bool parseDouble(const char *&p, const char *end, double &value)
+{
+    p = skipSpace(p, end);
+    if (p < end && *p == '+')
+        p++;
+
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        return false;
+    p = result.ptr;
+    return true;
+}
+
+static bool parseIndex(const char *&p, const char *end, int64_t &value)
+{
+    auto result = std::from_chars(p, end, value);
+    if (result.ec != std::errc())
+        return false;
+    p = result.ptr;
+    return true;
+}
+
+// A face is a list of corners v, v/vt, v//vn or v/vt/vn. The indices of the
+// corners are collected in face (positions, texture coordinates, normals),
+// which is passed in so it is not allocated for every face.
+static bool parseFace(const char *p, const char *end, ObjChunk &chunk, std::vector<int64_t> face[3])
 {
-    parts.clear();
+    int64_t counts[3] = {(int64_t)chunk.positions.size(), (int64_t)chunk.texcoords.size(), (int64_t)chunk.normals.size()};
+    bool complete[3] = {true, true, true};
+    for (int a = 0; a < 3; a++)
+        face[a].clear();
 
-    std::string buf;
-    for (char c : line)
+    while ((p = skipSpace(p, end)) < end)
     {
-        if (c == split)
+        int64_t index[3];
+        bool present[3] = {true, false, false};
+        if (!parseIndex(p, end, index[0]))
+            return false;
+
+        if (p < end && *p == '/')
         {
-            parts.push_back(buf);
-            buf.clear();
+            p++;
+            if (p < end && *p != '/')
+            {
+                if (!parseIndex(p, end, index[1]))
+                    return false;
+                present[1] = true;
+            }
+            if (p < end && *p == '/')
+            {
+                p++;
+                if (!parseIndex(p, end, index[2]))
+                    return false;
+                present[2] = true;
+            }
+        }
+
+        for (int a = 0; a < 3; a++)
+        {
+            if (!present[a])
+            {
+                complete[a] = false;
+                continue;
+            }
+
+            // Indices start at 1, 0 is not a valid index
+            if (index[a] > 0 && index[a] <= UINT32_MAX)
+                face[a].push_back(index[a] - 1);
+            else if (index[a] < 0 && index[a] >= -(int64_t)UINT32_MAX)
+                face[a].push_back(counts[a] + index[a] + OBJ_RELATIVE_INDEX);
+            else
+                return false;
+        }
+    }
+
+    if (face[0].size() < 3)
+        return false;
+
+    // Fan triangulation around the first corner
+    std::vector<int64_t> *indices[3] = {&chunk.position_indices, &chunk.texcoord_indices, &chunk.normal_indices};
+    for (size_t k = 1; k + 1 < face[0].size(); k++)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            if (!complete[a])
+                continue;
+
+            indices[a]->push_back(face[a][0]);
+            indices[a]->push_back(face[a][k]);
+            indices[a]->push_back(face[a][k + 1]);
         }
-        else
-            buf += c;
     }
-    if (buf.size())
-        parts.push_back(buf);
+
+    return true;
+}
+
+static bool parseLine(const char *p, const char *end, ObjChunk &chunk, std::vector<int64_t> face[3])
+{
+    const char *keyword = p;
+    while (p < end && *p != ' ' && *p != '\t')
+        p++;
+    std::string_view name(keyword, p - keyword);
+
+    // Comments, empty lines and everything that is not geometry (objects,
+    // groups, materials, ...) are skipped
+    if (name == "v")
+    {
+        // Anything after the position (w or a vertex color) is ignored
+        double x, y, z;
+        if (!parseDouble(p, end, x) || !parseDouble(p, end, y) || !parseDouble(p, end, z))
+            return false;
+        chunk.positions.push_back(Vec3f((float)x, (float)y, (float)z));
+    }
+    else if (name == "vt")
+    {
+        // v and w are optional
+        double u, v = 0;
+        if (!parseDouble(p, end, u))
+            return false;
+        if (skipSpace(p, end) < end && !parseDouble(p, end, v))
+            return false;
+        chunk.texcoords.push_back({(float)u, (float)v});
+    }
+    else if (name == "vn")
+    {
+        double x, y, z;
+        if (!parseDouble(p, end, x) || !parseDouble(p, end, y) || !parseDouble(p, end, z))
+            return false;
+        chunk.normals.push_back(Vec3f((float)x, (float)y, (float)z));
+    }
+    else if (name == "f")
+    {
+        return parseFace(p, end, chunk, face);
+    }
+
+    return true;
 }
 
-Point3 Obj::parseVec(const std::vector<std::string> &parts, int start_index) const
+void Obj::parseChunk(const char *begin, const char *end, ObjChunk &chunk) const
 {
-    // @todo: Test if the x y and z values are actually valid
-    std::string::size_type size;
-    double x = std::stod(parts[start_index + 0], &size);
-    double y = std::stod(parts[start_index + 1], &size);
-    double z = std::stod(parts[start_index + 2], &size);
+    std::vector<int64_t> face[3];
+
+    const char *line = begin;
+    while (line < end)
+    {
+        const char *line_end = static_cast<const char *>(memchr(line, '\n', end - line));
+        if (line_end == nullptr)
+            line_end = end;
+
+        if (!parseLine(skipSpace(line, line_end), line_end, chunk, face))
+            chunk.malformed_lines++;
 
-    return Point3(x, y, z);
+        line = line_end + 1;
+    }
 }
 
-Point3 Obj::getVert(const std::string vert) const
+// Turn an index stored by parseFace into an index into the whole file,
+// offset is where the chunk starts. Returns -1 if the index is out of range.
+static int64_t resolveIndex(int64_t index, size_t offset, size_t count)
 {
-    // @todo: this is a little clunky
-    std::string s;
-    int idx = vert.find('/');
-    if (idx)
-        s = vert.substr(0, idx);
-    else
-        s = vert;
-
-    // @todo: check bounds to make sure we actually have this index
-
-    // Vertex indices start at 1
-    return m_verts[std::stoi(s) - 1];
+    if (index >= OBJ_RELATIVE_INDEX / 2)
+        index = index - OBJ_RELATIVE_INDEX + (int64_t)offset;
+
+    return index >= 0 && index < (int64_t)count ? index : -1;
 }
 
 void Obj::read(Scene &scene)
 {
-    HitableList &list = scene.getHitableList();
-
     // auto defmat = std::make_shared<Metal>(Color(0.9,0.9,0.9), 0.5);
     // auto defmat = std::make_shared<Lambertian>(std::make_shared<UVTexture>());
     auto defmat = std::make_shared<PBR>(std::make_shared<SolidColor>(0.8, 0.1, 0.1), 1, 0, 0, std::make_shared<SolidColor>(0), 0);
 
-    if (!m_infile.is_open())
+    MappedFile map(m_infile_name);
+    if (!map.isOpen())
     {
         WARN("Returning empty HitableList.");
         return;
     }
 
-    std::string line;
-    std::vector<std::string> parts;
-    parts.reserve(5); // most will not be larger than this so we reduce size increases.
-    while (!m_infile.eof())
+    const char *begin = reinterpret_cast<const char *>(map.data());
+    const char *end = begin + map.size();
+
+    // Every chunk starts at the beginning of a line
+    size_t chunk_count = map.size() / OBJ_BYTES_PER_CHUNK + 1;
+    std::vector<const char *> bounds(chunk_count + 1, end);
+    bounds[0] = begin;
+    for (size_t i = 1; i < chunk_count; i++)
     {
-        std::getline(m_infile, line);
+        const char *start = begin + i * OBJ_BYTES_PER_CHUNK;
+        const char *newline = static_cast<const char *>(memchr(start, '\n', end - start));
+        bounds[i] = newline != nullptr ? newline + 1 : end;
+    }
 
-        // Skip over comments and empty lines
-        if (line.size() == 0 || line.front() == '#')
-            continue;
+    std::vector<ObjChunk> chunks(chunk_count);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < (int)chunk_count; i++)
+        parseChunk(bounds[i], bounds[i + 1], chunks[i]);
 
-        // Split the line into parts by space since this is makes the whole thing easier
-        // to parse
-        splitAtChar(line, parts, ' ');
+    // Where the data of every chunk goes in the arrays of the whole file
+    struct Offsets
+    {
+        size_t positions = 0;
+        size_t texcoords = 0;
+        size_t normals = 0;
+        size_t corners = 0;
+    };
+
+    std::vector<Offsets> offsets(chunk_count + 1);
+    size_t malformed_lines = 0, texcoord_corners = 0, normal_corners = 0;
+    for (size_t i = 0; i < chunk_count; i++)
+    {
+        const ObjChunk &chunk = chunks[i];
+        offsets[i + 1].positions = offsets[i].positions + chunk.positions.size();
+        offsets[i + 1].texcoords = offsets[i].texcoords + chunk.texcoords.size();
+        offsets[i + 1].normals = offsets[i].normals + chunk.normals.size();
+        offsets[i + 1].corners = offsets[i].corners + chunk.position_indices.size();
+        texcoord_corners += chunk.texcoord_indices.size();
+        normal_corners += chunk.normal_indices.size();
+        malformed_lines += chunk.malformed_lines;
+    }
+    const Offsets &total = offsets[chunk_count];
+
+    if (malformed_lines > 0)
+        WARN("Skipped " << malformed_lines << " malformed lines in OBJ file " << m_infile_name);
+
+    if (total.corners == 0)
+    {
+        WARN("OBJ file " << m_infile_name << " has no faces");
+        return;
+    }
+
+    if (total.positions > UINT32_MAX || total.corners > UINT32_MAX)
+    {
+        ERROR("OBJ file " << m_infile_name << " has too many vertices or faces");
+        exit(1);
+    }
+
+    // Texture coordinates and normals are all or nothing for a mesh
+    bool has_texcoords = texcoord_corners == total.corners;
+    bool has_normals = normal_corners == total.corners;
+    if (texcoord_corners > 0 && !has_texcoords)
+        WARN("Not every face in OBJ file " << m_infile_name << " has texture coordinates, they are ignored");
+    if (normal_corners > 0 && !has_normals)
+        WARN("Not every face in OBJ file " << m_infile_name << " has normals, they are ignored");
+
+    auto positions = std::make_shared<std::vector<Vec3f>>(total.positions);
+    auto texcoords = std::make_shared<std::vector<TexCoord>>(has_texcoords ? total.texcoords : 0);
+    auto normals = std::make_shared<std::vector<Vec3f>>(has_normals ? total.normals : 0);
+
+    std::vector<uint32_t> position_indices(total.corners);
+    std::vector<uint32_t> texcoord_indices(has_texcoords ? total.corners : 0);
+    std::vector<uint32_t> normal_indices(has_normals ? total.corners : 0);
+
+    // The first index of every chunk that is out of range, for the error
+    struct InvalidIndex
+    {
+        const char *kind = nullptr;
+        int64_t index = 0;
+    };
+    std::vector<InvalidIndex> invalid(chunk_count);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < (int)chunk_count; i++)
+    {
+        ObjChunk &chunk = chunks[i];
+        const Offsets &offset = offsets[i];
+
+        auto resolve = [&](const std::vector<int64_t> &from, size_t element_offset, size_t element_count,
+                           std::vector<uint32_t> &to, const char *kind) {
+            for (size_t k = 0; k < from.size(); k++)
+            {
+                int64_t index = resolveIndex(from[k], element_offset, element_count);
+                if (index < 0 && invalid[i].kind == nullptr)
+                {
+                    invalid[i].kind = kind;
+                    invalid[i].index = from[k] >= OBJ_RELATIVE_INDEX / 2 ? from[k] - OBJ_RELATIVE_INDEX + (int64_t)element_offset + 1 : from[k] + 1;
+                }
+                to[offset.corners + k] = index < 0 ? 0 : (uint32_t)index;
+            }
+        };
+
+        std::copy(chunk.positions.begin(), chunk.positions.end(), positions->begin() + offset.positions);
+        resolve(chunk.position_indices, offset.positions, total.positions, position_indices, "vertex");
+
+        if (has_texcoords)
+        {
+            std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords->begin() + offset.texcoords);
+            resolve(chunk.texcoord_indices, offset.texcoords, total.texcoords, texcoord_indices, "texture coordinate");
+        }
 
-        // @todo: make sure the parts vector is actually large enough for vector parsing
-        if (parts.front() == "v")
+        if (has_normals)
         {
-            m_verts.push_back(parseVec(parts, 1));
+            std::copy(chunk.normals.begin(), chunk.normals.end(), normals->begin() + offset.normals);
+            resolve(chunk.normal_indices, offset.normals, total.normals, normal_indices, "normal");
         }
-        else if (parts.front() == "f")
+
+        // The chunk is not needed anymore, big files should not be in
+        // memory twice
+        chunk = ObjChunk();
+    }
+
+    for (const InvalidIndex &index : invalid)
+    {
+        if (index.kind != nullptr)
+        {
+            ERROR("OBJ face refers to " << index.kind << " " << index.index << " which does not exist");
+            exit(1);
+        }
+    }
+
+    auto indices = std::make_shared<std::vector<uint32_t>>(std::move(position_indices));
+    if (!has_texcoords && !has_normals)
+    {
+        scene.addMesh(std::make_shared<Mesh>(positions, indices, defmat));
+        return;
+    }
+
+    // Meshes index all vertex data with the same index. When the file does
+    // that too the arrays are used as they are, otherwise every corner of a
+    // triangle gets a vertex of its own.
+    bool shared = (!has_texcoords || texcoords->size() == positions->size()) &&
+                  (!has_normals || normals->size() == positions->size());
+#pragma omp parallel for reduction(&& : shared)
+    for (size_t k = 0; k < total.corners; k++)
+    {
+        shared = shared && (!has_texcoords || texcoord_indices[k] == (*indices)[k]) &&
+                 (!has_normals || normal_indices[k] == (*indices)[k]);
+    }
+
+    if (!shared)
+    {
+        auto corner_positions = std::make_shared<std::vector<Vec3f>>(total.corners);
+        auto corner_texcoords = std::make_shared<std::vector<TexCoord>>(has_texcoords ? total.corners : 0);
+        auto corner_normals = std::make_shared<std::vector<Vec3f>>(has_normals ? total.corners : 0);
+
+#pragma omp parallel for
+        for (size_t k = 0; k < total.corners; k++)
         {
-            auto triangle = new Triangle(getVert(parts[1]), getVert(parts[2]), getVert(parts[3]), defmat);
-            list.add(triangle);
+            (*corner_positions)[k] = (*positions)[(*indices)[k]];
+            if (has_texcoords)
+                (*corner_texcoords)[k] = (*texcoords)[texcoord_indices[k]];
+            if (has_normals)
+                (*corner_normals)[k] = (*normals)[normal_indices[k]];
         }
+
+        std::iota(indices->begin(), indices->end(), 0);
+        positions = corner_positions;
+        texcoords = corner_texcoords;
+        normals = corner_normals;
     }
-}
\ No newline at end of file
+
+    scene.addMesh(std::make_shared<Mesh>(positions, indices, defmat,
+                                         has_normals ? normals : nullptr,
+                                         has_texcoords ? texcoords : nullptr));
+}
@@ -0,0 +1,486 @@
+#include <fileformats/rts.h>
+#include <hitables/mesh.h>
+#include <materials/pbr.h>
+#include <textures/image_texture.h>
+#include <textures/texture_cache.h>
+#include <mapped_file.h>
+
+#include <cstring>
+#include <map>
+#include <type_traits>
+
+static_assert(std::is_trivially_copyable<Camera>::value, "The camera is stored as it is in memory");
+static_assert(std::is_trivially_copyable<FlatBvhNode>::value, "BVH nodes are stored as they are in memory");
+static_assert(sizeof(TexelSrgb8) == 4 && sizeof(TexelRgb16f) == 6 && sizeof(TexelRgb32f) == 12 && sizeof(TexelBc1) == 8,
+              "Texels are stored as they are in memory");
+
+static uint64_t alignUp(uint64_t value)
+{
+    return (value + RTS_ALIGNMENT - 1) / RTS_ALIGNMENT * RTS_ALIGNMENT;
+}
+
+// The data section is written straight from the buffers of the scene, this
+// only keeps track of where every buffer goes
+class RtsData
+{
+private:
+    struct Chunk
+    {
+        const void *bytes;
+        size_t size;
+        uint64_t offset;
+    };
+
+    std::vector<Chunk> m_chunks;
+    std::map<const void *, uint64_t> m_buffers;
+    uint64_t m_size = 0;
+
+public:
+    uint64_t size() const { return m_size; }
+
+    // Consecutive chunks that are not aligned form a single buffer
+    uint64_t add(const void *bytes, size_t size, bool align = true)
+    {
+        uint64_t offset = align ? alignUp(m_size) : m_size;
+        m_chunks.push_back({bytes, size, offset});
+        m_size = offset + size;
+        return offset;
+    }
+
+    // Buffers shared by meshes are stored once
+    template <typename T>
+    uint64_t addBuffer(const SharedBuffer<T> &buffer)
+    {
+        if (!buffer)
+            return RTS_NO_BUFFER;
+
+        auto found = m_buffers.find(buffer.data());
+        if (found != m_buffers.end())
+            return found->second;
+
+        uint64_t offset = add(buffer.data(), buffer.size() * sizeof(T));
+        m_buffers[buffer.data()] = offset;
+        return offset;
+    }
+
+    void write(std::ofstream &output) const
+    {
+        static const char zeros[RTS_ALIGNMENT] = {};
+        uint64_t position = 0;
+        for (const Chunk &chunk : m_chunks)
+        {
+            output.write(zeros, chunk.offset - position);
+            output.write((const char *)chunk.bytes, chunk.size);
+            position = chunk.offset + chunk.size;
+        }
+    }
+};
+
+class RtsTables
+{
+public:
+    std::vector<RtsTexture> textures;
+    std::vector<RtsMaterial> materials;
+    std::map<const Texture *, int> texture_index;
+    std::map<const Material *, uint32_t> material_index;
+
+    template <typename Texel>
+    static void addMipMap(const MipMap<Texel> &mipmap, RtsTexture &record, RtsData &data)
+    {
+        record.type = RTS_TEXTURE_IMAGE;
+        record.width = mipmap.width();
+        record.height = mipmap.height();
+        record.format = Texel::format;
+        record.level_count = mipmap.levels();
+        for (int i = 0; i < mipmap.levels(); i++)
+        {
+            const auto &level = mipmap.level(i);
+            uint64_t offset = data.add(level.texels.data(), level.texels.size() * sizeof(Texel), i == 0);
+            if (i == 0)
+                record.texels = offset;
+        }
+    }
+
+    int addTexture(const std::shared_ptr<Texture> &texture, RtsData &data)
+    {
+        auto found = texture_index.find(texture.get());
+        if (found != texture_index.end())
+            return found->second;
+
+        RtsTexture record = {};
+        if (auto solid = std::dynamic_pointer_cast<SolidColor>(texture))
+        {
+            record.type = RTS_TEXTURE_SOLID;
+            for (int i = 0; i < 3; i++)
+                record.color[i] = solid->color()[i];
+        }
+        else if (auto scaled = std::dynamic_pointer_cast<ScaledTexture>(texture))
+        {
+            record.type = RTS_TEXTURE_SCALED;
+            record.texture = addTexture(scaled->texture(), data);
+            if (record.texture < 0)
+                return -1;
+            for (int i = 0; i < 3; i++)
+                record.color[i] = scaled->scale()[i];
+        }
+        else if (!visitImageTexture(texture, [&](const auto &image) { addMipMap(image->mipmap(), record, data); }))
+        {
+            ERROR("Only solid, scaled and image textures can be stored in a scene file");
+            return -1;
+        }
+
+        textures.push_back(record);
+        texture_index[texture.get()] = textures.size() - 1;
+        return textures.size() - 1;
+    }
+
+    int addMaterial(const std::shared_ptr<Material> &material, RtsData &data)
+    {
+        auto found = material_index.find(material.get());
+        if (found != material_index.end())
+            return found->second;
+
+        auto pbr = std::dynamic_pointer_cast<PBR>(material);
+        if (pbr == nullptr)
+        {
+            ERROR("Only PBR materials can be stored in a scene file");
+            return -1;
+        }
+
+        RtsMaterial record = {};
+        record.base_color = addTexture(pbr->baseColor(), data);
+        record.emission = addTexture(pbr->emission(), data);
+        if (record.base_color < 0 || record.emission < 0)
+            return -1;
+
+        record.roughness = pbr->roughness();
+        record.transmission = pbr->transmission();
+        record.emission_strength = pbr->emissionStrength();
+        record.metallic = pbr->metallic();
+
+        materials.push_back(record);
+        material_index[material.get()] = materials.size() - 1;
+        return materials.size() - 1;
+    }
+};
+
+int Rts::write(Scene &scene, const FlatBvh *bvh, std::string filename)
+{
+    RtsData data;
+    RtsTables tables;
+
+    std::vector<RtsMesh> meshes;
+    for (const std::shared_ptr<Mesh> &mesh : scene.getMeshes())
+    {
+        RtsMesh record = {};
+        int material = tables.addMaterial(mesh->material(), data);
+        if (material < 0)
+            return -1;
+        record.material = material;
+
+        for (const std::shared_ptr<HitableList> &light : scene.getLightList())
+        {
+            if (light == mesh)
+                record.flags |= RTS_MESH_LIGHT;
+        }
+
+        record.vertex_count = mesh->positions().size();
+        record.index_count = mesh->indices().size();
+        record.positions = data.addBuffer(mesh->positions());
+        record.indices = data.addBuffer(mesh->indices());
+        record.normals = data.addBuffer(mesh->normals());
+        record.texcoords = data.addBuffer(mesh->texcoords());
+        meshes.push_back(record);
+    }
+
+    RtsBvh bvh_record = {};
+    if (bvh != nullptr)
+    {
+        bvh_record.root = bvh->root;
+        bvh_record.object_count = bvh->object_count;
+        bvh_record.node_count = bvh->nodes.size();
+        bvh_record.list_count = bvh->lists.size();
+        bvh_record.list_object_count = bvh->list_objects.size();
+        bvh_record.nodes = data.addBuffer(bvh->nodes);
+        bvh_record.lists = data.addBuffer(bvh->lists);
+        bvh_record.list_objects = data.addBuffer(bvh->list_objects);
+    }
+
+    const Camera &camera = scene.getCamera();
+    struct Section
+    {
+        uint32_t type;
+        const void *bytes;
+        size_t size;
+    };
+    std::vector<Section> sections = {
+        {RTS_SECTION_CAMERA, &camera, sizeof(Camera)},
+        {RTS_SECTION_TEXTURES, tables.textures.data(), tables.textures.size() * sizeof(RtsTexture)},
+        {RTS_SECTION_MATERIALS, tables.materials.data(), tables.materials.size() * sizeof(RtsMaterial)},
+        {RTS_SECTION_MESHES, meshes.data(), meshes.size() * sizeof(RtsMesh)},
+    };
+    if (bvh != nullptr)
+        sections.push_back({RTS_SECTION_BVH, &bvh_record, sizeof(RtsBvh)});
+    sections.push_back({RTS_SECTION_DATA, nullptr, data.size()});
+
+    RtsHeader header = {};
+    header.magic = RTS_MAGIC_BYTES;
+    header.version = RTS_VERSION;
+    header.point_size = sizeof(Vec3f);
+    header.texcoord_size = sizeof(TexCoord);
+    header.bvh_node_size = sizeof(FlatBvhNode);
+    header.camera_size = sizeof(Camera);
+    header.section_count = sections.size();
+
+    std::vector<RtsSection> table(sections.size());
+    uint64_t offset = sizeof(RtsHeader) + table.size() * sizeof(RtsSection);
+    for (size_t i = 0; i < sections.size(); i++)
+    {
+        offset = alignUp(offset);
+        table[i] = {sections[i].type, 0, offset, sections[i].size};
+        offset += sections[i].size;
+    }
+
+    std::ofstream output;
+    output.open(filename, std::ios::out | std::ios::binary);
+    if (!output.is_open())
+        return -1;
+
+    output.write((const char *)&header, sizeof(header));
+    output.write((const char *)table.data(), table.size() * sizeof(RtsSection));
+
+    static const char zeros[RTS_ALIGNMENT] = {};
+    uint64_t position = sizeof(RtsHeader) + table.size() * sizeof(RtsSection);
+    for (size_t i = 0; i < sections.size(); i++)
+    {
+        output.write(zeros, table[i].offset - position);
+        if (sections[i].type == RTS_SECTION_DATA)
+            data.write(output);
+        else
+            output.write((const char *)sections[i].bytes, sections[i].size);
+        position = table[i].offset + table[i].size;
+    }
+
+    return output.good() ? 0 : -1;
+}
+
+#define RTS_FAIL(x) \
+    do              \
+    {               \
+        ERROR(x);   \
+        exit(1);    \
+    } while (0)
+
+// A table of records in a section, the section has to hold a whole number
+// of them
+template <typename T>
+static const T *sectionTable(const uint8_t *file, const RtsSection *section, size_t &count)
+{
+    count = 0;
+    if (section == nullptr)
+        return nullptr;
+
+    if (section->size % sizeof(T) != 0)
+        RTS_FAIL("Invalid scene file, section " << section->type << " has a broken size");
+
+    count = section->size / sizeof(T);
+    return reinterpret_cast<const T *>(file + section->offset);
+}
+
+void Rts::read(Scene &scene)
+{
+    auto map = std::make_shared<MappedFile>(m_infile_name);
+    if (!map->isOpen())
+        RTS_FAIL("Could not read scene file: " << m_infile_name);
+
+    const uint8_t *file = map->data();
+    size_t size = map->size();
+
+    RtsHeader header;
+    if (size < sizeof(RtsHeader))
+        RTS_FAIL("Invalid scene file");
+    memcpy(&header, file, sizeof(RtsHeader));
+
+    if (header.magic != RTS_MAGIC_BYTES)
+        RTS_FAIL("Invalid scene file");
+    if (header.version != RTS_VERSION)
+        RTS_FAIL("Scene file version " << header.version << " is not supported, convert the scene again");
+    if (header.point_size != sizeof(Vec3f) || header.texcoord_size != sizeof(TexCoord) ||
+        header.bvh_node_size != sizeof(FlatBvhNode) || header.camera_size != sizeof(Camera))
+        RTS_FAIL("Scene file was written by a different build, convert the scene again");
+
+    if (header.section_count > (size - sizeof(RtsHeader)) / sizeof(RtsSection))
+        RTS_FAIL("Invalid scene file, the file is truncated");
+    const RtsSection *table = reinterpret_cast<const RtsSection *>(file + sizeof(RtsHeader));
+
+    std::map<uint32_t, const RtsSection *> sections;
+    for (uint32_t i = 0; i < header.section_count; i++)
+    {
+        const RtsSection &section = table[i];
+        if (section.offset % RTS_ALIGNMENT != 0 || section.offset > size || section.size > size - section.offset)
+            RTS_FAIL("Invalid scene file, the file is truncated");
+        sections[section.type] = &section;
+    }
+
+    if (!sections.count(RTS_SECTION_CAMERA) || !sections.count(RTS_SECTION_DATA))
+        RTS_FAIL("Invalid scene file, it has no camera or data");
+
+    const RtsSection *data_section = sections.at(RTS_SECTION_DATA);
+    const uint8_t *data = file + data_section->offset;
+
+    // A buffer of count elements in the data section
+    auto buffer = [&](uint64_t offset, uint64_t count, size_t element_size) -> const uint8_t * {
+        if (offset % RTS_ALIGNMENT != 0 || offset > data_section->size ||
+            count > (data_section->size - offset) / element_size)
+            RTS_FAIL("Invalid scene file, a buffer is out of range");
+        return data + offset;
+    };
+
+    // The levels of an image follow each other and are used in place
+    auto mappedMipMap = [&](const RtsTexture &record, auto texel) {
+        using Texel = decltype(texel);
+
+        // Levels are stored in whole blocks
+        uint64_t total = 0;
+        uint64_t level_width = record.width;
+        uint64_t level_height = record.height;
+        for (uint32_t i = 0; i < record.level_count; i++)
+        {
+            total += (uint64_t)MipMap<Texel>::blockCount(level_width) * MipMap<Texel>::blockCount(level_height);
+            level_width = std::max<uint64_t>(level_width / 2, 1);
+            level_height = std::max<uint64_t>(level_height / 2, 1);
+        }
+        const Texel *texels = reinterpret_cast<const Texel *>(buffer(record.texels, total, sizeof(Texel)));
+
+        std::vector<typename MipMap<Texel>::Level> levels;
+        int width = record.width;
+        int height = record.height;
+        for (uint32_t i = 0; i < record.level_count; i++)
+        {
+            size_t count = (size_t)MipMap<Texel>::blockCount(width) * MipMap<Texel>::blockCount(height);
+            levels.push_back({width, height, SharedBuffer<Texel>(map, texels, count)});
+            texels += count;
+            width = std::max(width / 2, 1);
+            height = std::max(height / 2, 1);
+        }
+        return MipMap<Texel>(std::move(levels));
+    };
+
+    const RtsSection *camera_section = sections.at(RTS_SECTION_CAMERA);
+    if (camera_section->size != sizeof(Camera))
+        RTS_FAIL("Invalid scene file, the camera has the wrong size");
+    Camera camera = scene.getCamera();
+    memcpy((void *)&camera, file + camera_section->offset, sizeof(Camera));
+    scene.setCamera(camera);
+
+    size_t texture_count;
+    const RtsTexture *texture_records = sectionTable<RtsTexture>(file, sections[RTS_SECTION_TEXTURES], texture_count);
+    std::vector<std::shared_ptr<Texture>> textures;
+    for (size_t i = 0; i < texture_count; i++)
+    {
+        const RtsTexture &record = texture_records[i];
+        Color color(record.color[0], record.color[1], record.color[2]);
+        switch (record.type)
+        {
+        case RTS_TEXTURE_SOLID:
+            textures.push_back(std::make_shared<SolidColor>(color));
+            break;
+        case RTS_TEXTURE_SCALED:
+            if (record.texture < 0 || (size_t)record.texture >= i)
+                RTS_FAIL("Invalid scene file, texture " << i << " scales a texture that does not exist");
+            textures.push_back(std::make_shared<ScaledTexture>(textures[record.texture], color));
+            break;
+        case RTS_TEXTURE_IMAGE:
+        {
+            if (record.width == 0 || record.height == 0 || record.width > INT32_MAX || record.height > INT32_MAX ||
+                record.level_count != (uint32_t)MipMap<TexelSrgb8>::levelCount(record.width, record.height))
+                RTS_FAIL("Invalid scene file, texture " << i << " has no pixels");
+
+            if (record.format == TEXEL_SRGB8)
+                textures.push_back(cacheTexture(std::make_shared<ImageTexture<TexelSrgb8>>(mappedMipMap(record, TexelSrgb8()))));
+            else if (record.format == TEXEL_BC1)
+                textures.push_back(cacheTexture(std::make_shared<ImageTexture<TexelBc1>>(mappedMipMap(record, TexelBc1()))));
+            else if (record.format == TEXEL_RGB16F)
+                textures.push_back(cacheTexture(std::make_shared<ImageTexture<TexelRgb16f>>(mappedMipMap(record, TexelRgb16f()))));
+            else if (record.format == TEXEL_RGB32F)
+                textures.push_back(cacheTexture(std::make_shared<ImageTexture<TexelRgb32f>>(mappedMipMap(record, TexelRgb32f()))));
+            else
+                RTS_FAIL("Invalid scene file, texture " << i << " has unknown format " << record.format);
+            break;
+        }
+        default:
+            RTS_FAIL("Invalid scene file, texture " << i << " has unknown type " << record.type);
+        }
+    }
+
+    size_t material_count;
+    const RtsMaterial *material_records = sectionTable<RtsMaterial>(file, sections[RTS_SECTION_MATERIALS], material_count);
+    std::vector<std::shared_ptr<Material>> materials;
+    for (size_t i = 0; i < material_count; i++)
+    {
+        const RtsMaterial &record = material_records[i];
+        if (record.base_color < 0 || (size_t)record.base_color >= textures.size() ||
+            record.emission < 0 || (size_t)record.emission >= textures.size())
+            RTS_FAIL("Invalid scene file, material " << i << " uses a texture that does not exist");
+
+        materials.push_back(std::make_shared<PBR>(textures[record.base_color], record.roughness, record.metallic != 0,
+                                                  record.transmission, textures[record.emission], record.emission_strength));
+    }
+
+    // The buffers point into the mapping, which stays open as long as a
+    // mesh uses it
+    size_t mesh_count;
+    const RtsMesh *mesh_records = sectionTable<RtsMesh>(file, sections[RTS_SECTION_MESHES], mesh_count);
+    for (size_t i = 0; i < mesh_count; i++)
+    {
+        const RtsMesh &record = mesh_records[i];
+        if (record.material >= materials.size())
+            RTS_FAIL("Invalid scene file, mesh " << i << " uses a material that does not exist");
+        if (record.positions == RTS_NO_BUFFER || record.indices == RTS_NO_BUFFER || record.vertex_count > UINT32_MAX)
+            RTS_FAIL("Invalid scene file, mesh " << i << " has no vertices");
+
+        MeshBuffer<Vec3f> positions(map, (const Vec3f *)buffer(record.positions, record.vertex_count, sizeof(Vec3f)), record.vertex_count);
+        MeshBuffer<uint32_t> indices(map, (const uint32_t *)buffer(record.indices, record.index_count, sizeof(uint32_t)), record.index_count);
+
+        MeshBuffer<Vec3f> normals;
+        if (record.normals != RTS_NO_BUFFER)
+            normals = MeshBuffer<Vec3f>(map, (const Vec3f *)buffer(record.normals, record.vertex_count, sizeof(Vec3f)), record.vertex_count);
+
+        MeshBuffer<TexCoord> texcoords;
+        if (record.texcoords != RTS_NO_BUFFER)
+            texcoords = MeshBuffer<TexCoord>(map, (const TexCoord *)buffer(record.texcoords, record.vertex_count, sizeof(TexCoord)), record.vertex_count);
+
+        // Nothing else is checked, but an index out of range would read
+        // outside of the mapping
+        bool valid = true;
+#pragma omp parallel for reduction(&& : valid)
+        for (size_t k = 0; k < indices.size(); k++)
+            valid = valid && indices[k] < record.vertex_count;
+        if (!valid)
+            RTS_FAIL("Invalid scene file, mesh " << i << " has indices that are out of range");
+
+        auto mesh = std::make_shared<Mesh>(positions, indices, materials[record.material], normals, texcoords);
+        scene.addMesh(mesh);
+        if (record.flags & RTS_MESH_LIGHT)
+            scene.getLightList().push_back(mesh);
+    }
+
+    // The BVH is only checked when the renderer builds its nodes from it
+    if (sections.count(RTS_SECTION_BVH))
+    {
+        const RtsSection *section = sections.at(RTS_SECTION_BVH);
+        if (section->size != sizeof(RtsBvh))
+            RTS_FAIL("Invalid scene file, the BVH has the wrong size");
+
+        RtsBvh record;
+        memcpy(&record, file + section->offset, sizeof(RtsBvh));
+
+        auto bvh = std::make_shared<FlatBvh>();
+        bvh->root = record.root;
+        bvh->object_count = record.object_count;
+        bvh->nodes = SharedBuffer<FlatBvhNode>(map, (const FlatBvhNode *)buffer(record.nodes, record.node_count, sizeof(FlatBvhNode)), record.node_count);
+        bvh->lists = SharedBuffer<FlatBvhList>(map, (const FlatBvhList *)buffer(record.lists, record.list_count, sizeof(FlatBvhList)), record.list_count);
+        bvh->list_objects = SharedBuffer<uint32_t>(map, (const uint32_t *)buffer(record.list_objects, record.list_object_count, sizeof(uint32_t)), record.list_object_count);
+        scene.setBvh(bvh);
+    }
+}
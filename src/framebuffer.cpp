@@ -0,0 +1,377 @@
+#include <framebuffer.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+// The range of the gamma table, 2^-18 is below (1 / 255.999)^2.2
+#define GAMMA_TABLE_OCTAVES     18
+#define GAMMA_TABLE_BUCKET_BITS 7
+
+static size_t alignedRow(size_t bytes)
+{
+    return (bytes + FRAMEBUFFER_ALIGNMENT - 1) / FRAMEBUFFER_ALIGNMENT * FRAMEBUFFER_ALIGNMENT;
+}
+
+// Map [0, 1] to a byte without gamma correction
+static uint8_t toByte(double value)
+{
+    return static_cast<uint8_t>(255.999 * std::clamp(value, 0.0, 1.0));
+}
+
+// Gamma corrects linear values to bytes without a pow per channel, this
+// gives the same bytes as 255.999 * pow(value, 1 / 2.2). Byte k starts at
+// the threshold (k / 255.999)^2.2. The table holds the byte at the start of
+// small ranges of floats, 2^GAMMA_TABLE_BUCKET_BITS per power of two, which
+// are narrow enough to hold at most one threshold. So the table entry is at
+// most one off, the thresholds around it tell which way.
+struct GammaTable
+{
+    double thresholds[257];
+    uint8_t start[GAMMA_TABLE_OCTAVES << GAMMA_TABLE_BUCKET_BITS];
+
+    // The bits of the float 2^-GAMMA_TABLE_OCTAVES, smaller values are
+    // below the first threshold
+    static constexpr uint32_t min_bits = (127 - GAMMA_TABLE_OCTAVES) << 23;
+
+    GammaTable()
+    {
+        auto reference = [](double value) { return (int)(255.999 * pow(value, 1.0 / 2.2)); };
+
+        // The inverse is off by a few ulps, nudge it onto the exact boundary
+        thresholds[0] = 0;
+        for (int k = 1; k < 256; k++)
+        {
+            double t = pow(k / 255.999, 2.2);
+            while (reference(t) < k)
+                t = std::nextafter(t, 1.0);
+            while (reference(std::nextafter(t, 0.0)) >= k)
+                t = std::nextafter(t, 0.0);
+            thresholds[k] = t;
+        }
+        thresholds[256] = std::numeric_limits<double>::infinity();
+
+        for (uint32_t i = 0; i < sizeof(start); i++)
+        {
+            uint32_t bits = min_bits + (i << (23 - GAMMA_TABLE_BUCKET_BITS));
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+
+            int k = 0;
+            while (k < 255 && thresholds[k + 1] <= value)
+                k++;
+            start[i] = k;
+        }
+    }
+
+    uint8_t operator()(double value) const
+    {
+        // NaNs end up here as well
+        if (!(value >= thresholds[1]))
+            return 0;
+        if (value >= 1)
+            return 255;
+
+        // Rounding to a float can move the value into the next range
+        float rounded = value;
+        uint32_t bits;
+        memcpy(&bits, &rounded, sizeof(bits));
+        int k = start[(bits - min_bits) >> (23 - GAMMA_TABLE_BUCKET_BITS)];
+
+        // Without branches, both are about as likely in noisy images
+        return k - (value < thresholds[k]) + (value >= thresholds[k + 1]);
+    }
+};
+
+const char *aovName(Aov aov)
+{
+    switch (aov)
+    {
+    case AOV_ALBEDO:
+        return "albedo";
+    case AOV_NORMAL:
+        return "normal";
+    case AOV_DEPTH:
+        return "depth";
+    case AOV_SAMPLES:
+        return "samples";
+    case AOV_VARIANCE:
+        return "variance";
+    default:
+        return "none";
+    }
+}
+
+Framebuffer::Framebuffer(int width, int height, uint32_t aovs)
+    : Framebuffer(0, 0, width, height, aovs)
+{
+}
+
+Framebuffer::Framebuffer(int x, int y, int width, int height, uint32_t aovs)
+    : m_aovs(aovs)
+{
+    setRegion(x, y, width, height);
+}
+
+Framebuffer::Framebuffer(int width, int height, uint32_t aovs, void *storage)
+    : m_width(width), m_height(height), m_aovs(aovs)
+{
+    setStorage(storage);
+}
+
+size_t Framebuffer::storageSize(int width, int height, uint32_t aovs)
+{
+    size_t color_plane = alignedRow(width * sizeof(FramebufferPixel)) * height;
+    size_t depth_plane = alignedRow(width * sizeof(float)) * height;
+
+    size_t size = color_plane;
+    if (aovs & AOV_ALBEDO)
+        size += color_plane;
+    if (aovs & AOV_NORMAL)
+        size += color_plane;
+    if (aovs & AOV_VARIANCE)
+        size += color_plane;
+    if (aovs & AOV_DEPTH)
+        size += depth_plane;
+
+    return size;
+}
+
+void Framebuffer::setStorage(void *storage)
+{
+    m_stride = alignedRow(m_width * sizeof(FramebufferPixel)) / sizeof(FramebufferPixel);
+    m_depth_stride = alignedRow(m_width * sizeof(float)) / sizeof(float);
+    size_t plane = (size_t)m_stride * m_height;
+
+    m_color = static_cast<FramebufferPixel *>(storage);
+    FramebufferPixel *next = m_color + plane;
+
+    m_albedo = nullptr;
+    m_normal = nullptr;
+    m_variance = nullptr;
+    m_depth = nullptr;
+
+    if (m_aovs & AOV_ALBEDO)
+    {
+        m_albedo = next;
+        next += plane;
+    }
+    if (m_aovs & AOV_NORMAL)
+    {
+        m_normal = next;
+        next += plane;
+    }
+    if (m_aovs & AOV_VARIANCE)
+    {
+        m_variance = next;
+        next += plane;
+    }
+    if (m_aovs & AOV_DEPTH)
+        m_depth = reinterpret_cast<float *>(next);
+}
+
+void Framebuffer::setRegion(int x, int y, int width, int height)
+{
+    m_x = x;
+    m_y = y;
+    m_width = width;
+    m_height = height;
+
+    size_t size = storageSize(width, height, m_aovs);
+    if (size > m_capacity)
+    {
+        m_storage.reset(static_cast<uint8_t *>(aligned_alloc(FRAMEBUFFER_ALIGNMENT, size)));
+        m_capacity = size;
+    }
+
+    setStorage(m_storage.get());
+    if (size > 0)
+        memset(m_storage.get(), 0, size);
+}
+
+Color Framebuffer::resolve(int x, int y) const
+{
+    const FramebufferPixel &pixel = m_color[index(x, y)];
+
+    // Pixels that have not been reached yet (render was stopped early) stay black
+    if (pixel.a == 0)
+        return Color(0);
+
+    return Color(pixel.r, pixel.g, pixel.b) / pixel.a;
+}
+
+Color Framebuffer::resolve(int x, int y, Aov aov) const
+{
+    size_t idx = index(x, y);
+    double samples = m_color[idx].a;
+
+    if (aov == AOV_SAMPLES)
+        return Color(samples);
+    if (samples == 0)
+        return Color(0);
+
+    switch (aov)
+    {
+    case AOV_ALBEDO:
+        return m_albedo ? Color(m_albedo[idx].r, m_albedo[idx].g, m_albedo[idx].b) / samples : Color(0);
+    case AOV_NORMAL:
+        return m_normal ? Color(m_normal[idx].r, m_normal[idx].g, m_normal[idx].b) / samples : Color(0);
+    case AOV_DEPTH:
+        return m_depth ? Color(m_depth[depthIndex(x, y)] / samples) : Color(0);
+    case AOV_VARIANCE:
+    {
+        if (!m_variance || samples < 2)
+            return Color(0);
+
+        const FramebufferPixel &color = m_color[idx];
+        Color mean = Color(color.r, color.g, color.b) / samples;
+        Color squared = Color(m_variance[idx].r, m_variance[idx].g, m_variance[idx].b) / samples;
+        return maxValues(squared - mean * mean, Color(0)) / (samples - 1);
+    }
+    default:
+        return Color(0);
+    }
+}
+
+void Framebuffer::display(std::vector<uint8_t> &output) const
+{
+    static const GammaTable gamma;
+    output.resize((size_t)m_width * m_height * 3);
+
+#pragma omp parallel for
+    for (int y = 0; y < m_height; y++)
+    {
+        const FramebufferPixel *row = &m_color[index(m_x, m_y + y)];
+        uint8_t *out = &output[(size_t)y * m_width * 3];
+
+        for (int x = 0; x < m_width; x++)
+        {
+            // Pixels that have not been reached yet stay black
+            if (row[x].a == 0)
+            {
+                out[3 * x + 0] = out[3 * x + 1] = out[3 * x + 2] = 0;
+                continue;
+            }
+
+            double scale = 1.0 / row[x].a;
+            out[3 * x + 0] = gamma(row[x].r * scale);
+            out[3 * x + 1] = gamma(row[x].g * scale);
+            out[3 * x + 2] = gamma(row[x].b * scale);
+        }
+    }
+}
+
+void Framebuffer::display(Aov aov, std::vector<uint8_t> &output) const
+{
+    static const GammaTable gamma;
+    output.resize((size_t)m_width * m_height * 3);
+
+    double max = 0;
+    if (aov != AOV_ALBEDO && aov != AOV_NORMAL)
+    {
+#pragma omp parallel for reduction(max : max)
+        for (int y = 0; y < m_height; y++)
+        {
+            for (int x = 0; x < m_width; x++)
+                max = std::max(max, maxVal(resolve(m_x + x, m_y + y, aov)));
+        }
+    }
+    double scale = max > 0 ? 1.0 / max : 0;
+
+#pragma omp parallel for
+    for (int y = 0; y < m_height; y++)
+    {
+        uint8_t *out = &output[(size_t)y * m_width * 3];
+
+        for (int x = 0; x < m_width; x++)
+        {
+            Color value = resolve(m_x + x, m_y + y, aov);
+            for (int c = 0; c < 3; c++)
+            {
+                if (aov == AOV_ALBEDO)
+                    out[3 * x + c] = gamma(value[c]);
+                else if (aov == AOV_NORMAL)
+                    out[3 * x + c] = toByte(value[c] * 0.5 + 0.5);
+                else
+                    out[3 * x + c] = toByte(value[c] * scale);
+            }
+        }
+    }
+}
+
+void Framebuffer::merge(const Framebuffer &other)
+{
+    // Only the area both framebuffers cover
+    int x0 = std::max(m_x, other.m_x);
+    int y0 = std::max(m_y, other.m_y);
+    int x1 = std::min(m_x + m_width, other.m_x + other.m_width);
+    int y1 = std::min(m_y + m_height, other.m_y + other.m_height);
+
+    bool albedo = m_albedo && other.m_albedo;
+    bool normal = m_normal && other.m_normal;
+    bool variance = m_variance && other.m_variance;
+    bool depth = m_depth && other.m_depth;
+
+    // This is called by many threads at once, each with its own tile
+    for (int y = y0; y < y1; y++)
+    {
+        FramebufferPixel *color = &m_color[index(x0, y)];
+        const FramebufferPixel *other_color = &other.m_color[other.index(x0, y)];
+
+        for (int i = 0; i < x1 - x0; i++)
+        {
+            color[i].r += other_color[i].r;
+            color[i].g += other_color[i].g;
+            color[i].b += other_color[i].b;
+            color[i].a += other_color[i].a;
+        }
+
+        for (int x = x0; x < x1; x++)
+        {
+            size_t idx = index(x, y);
+            size_t other_idx = other.index(x, y);
+
+            if (albedo)
+            {
+                m_albedo[idx].r += other.m_albedo[other_idx].r;
+                m_albedo[idx].g += other.m_albedo[other_idx].g;
+                m_albedo[idx].b += other.m_albedo[other_idx].b;
+            }
+            if (normal)
+            {
+                m_normal[idx].r += other.m_normal[other_idx].r;
+                m_normal[idx].g += other.m_normal[other_idx].g;
+                m_normal[idx].b += other.m_normal[other_idx].b;
+            }
+            if (variance)
+            {
+                m_variance[idx].r += other.m_variance[other_idx].r;
+                m_variance[idx].g += other.m_variance[other_idx].g;
+                m_variance[idx].b += other.m_variance[other_idx].b;
+            }
+            if (depth)
+                m_depth[depthIndex(x, y)] += other.m_depth[other.depthIndex(x, y)];
+        }
+    }
+}
+
+void Framebuffer::clear()
+{
+    memset(data(), 0, size());
+}
+
+void Framebuffer::clear(int x, int y, int x_end, int y_end)
+{
+    for (int j = y; j < y_end; j++)
+    {
+        std::fill(&m_color[index(x, j)], &m_color[index(x_end, j)], FramebufferPixel{0, 0, 0, 0});
+        if (m_albedo)
+            std::fill(&m_albedo[index(x, j)], &m_albedo[index(x_end, j)], FramebufferPixel{0, 0, 0, 0});
+        if (m_normal)
+            std::fill(&m_normal[index(x, j)], &m_normal[index(x_end, j)], FramebufferPixel{0, 0, 0, 0});
+        if (m_variance)
+            std::fill(&m_variance[index(x, j)], &m_variance[index(x_end, j)], FramebufferPixel{0, 0, 0, 0});
+        if (m_depth)
+            std::fill(&m_depth[depthIndex(x, j)], &m_depth[depthIndex(x_end, j)], 0.0f);
+    }
+}
@@ -0,0 +1,128 @@
+#include <hdr.h>
+
+#include <cstring>
+
+#define READ_ERR(x)     \
+    do                  \
+    {                   \
+        WARN(x);        \
+        return nullptr; \
+    } while (0);
+
+static inline void rgbeToFloat(const uint8_t *rgbe, float *out)
+{
+    if (rgbe[3] == 0)
+    {
+        out[0] = out[1] = out[2] = 0;
+        return;
+    }
+
+    // The exponent is shared by all channels, the mantissas are 8 bit
+    float f = ldexp(1.0f, (int)rgbe[3] - (128 + 8));
+    out[0] = rgbe[0] * f;
+    out[1] = rgbe[1] * f;
+    out[2] = rgbe[2] * f;
+}
+
+std::shared_ptr<HdrImage> Hdr::read(std::string filename)
+{
+    std::ifstream input;
+    input.open(filename, std::ios::binary | std::ios::in);
+
+    if (!input.is_open())
+        READ_ERR("Could not open '" << filename << "'");
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(input)), std::istreambuf_iterator<char>());
+    size_t pos = 0;
+
+    auto readLine = [&]()
+    {
+        std::string line;
+        while (pos < data.size() && data[pos] != '\n')
+            line += data[pos++];
+        pos++;
+        return line;
+    };
+
+    std::string magic = readLine();
+    if (magic.rfind("#?", 0) != 0)
+        READ_ERR("'" << filename << "' is not a radiance HDR file");
+
+    // The header ends with an empty line
+    while (pos < data.size())
+    {
+        std::string line = readLine();
+        if (line.empty())
+            break;
+
+        if (line.rfind("FORMAT=", 0) == 0 && line != "FORMAT=32-bit_rle_rgbe")
+            READ_ERR("Unsupported HDR format '" << line.substr(7) << "' in '" << filename << "'");
+    }
+
+    int width, height;
+    std::string resolution = readLine();
+    if (sscanf(resolution.c_str(), "-Y %d +X %d", &height, &width) != 2 || width <= 0 || height <= 0)
+        READ_ERR("Unsupported HDR orientation '" << resolution << "' in '" << filename << "'");
+
+    auto image = std::make_shared<HdrImage>();
+    image->width = width;
+    image->height = height;
+    image->pixels.resize((size_t)width * height * 3);
+
+    std::vector<uint8_t> scanline((size_t)width * 4);
+    for (int y = 0; y < height; y++)
+    {
+        if (pos + 4 > data.size())
+            READ_ERR("Unexpected end of '" << filename << "'");
+
+        const uint8_t *p = &data[pos];
+        bool rle = width >= HDR_MIN_RLE_WIDTH && width <= HDR_MAX_RLE_WIDTH &&
+                   p[0] == 2 && p[1] == 2 && !(p[2] & 0x80);
+
+        if (!rle)
+        {
+            // Flat scanline, the pixels are stored as is
+            if (pos + scanline.size() > data.size())
+                READ_ERR("Unexpected end of '" << filename << "'");
+
+            memcpy(scanline.data(), p, scanline.size());
+            pos += scanline.size();
+        }
+        else
+        {
+            if ((p[2] << 8 | p[3]) != width)
+                READ_ERR("Invalid scanline width in '" << filename << "'");
+            pos += 4;
+
+            // Every channel is encoded separately, as runs of one repeated
+            // value or as literal values.
+            for (int c = 0; c < 4; c++)
+            {
+                int x = 0;
+                while (x < width)
+                {
+                    if (pos >= data.size())
+                        READ_ERR("Unexpected end of '" << filename << "'");
+
+                    int count = data[pos++];
+                    bool run = count > 128;
+                    if (run)
+                        count -= 128;
+
+                    if (count == 0 || x + count > width || pos + (run ? 1 : count) > data.size())
+                        READ_ERR("Invalid run length encoding in '" << filename << "'");
+
+                    for (int i = 0; i < count; i++, x++)
+                        scanline[x * 4 + c] = run ? data[pos] : data[pos + i];
+                    pos += run ? 1 : count;
+                }
+            }
+        }
+
+        float *row = &image->pixels[(size_t)y * width * 3];
+        for (int x = 0; x < width; x++)
+            rgbeToFloat(&scanline[x * 4], &row[x * 3]);
+    }
+
+    return image;
+}
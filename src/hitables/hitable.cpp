@@ -1,11 +1,12 @@
 #include <hitables/hitable.h>
-#include <random.h>
+#include <sampler.h>
 
 Point3 Hitable::randomPointIn() const
 {
     AABB box;
     this->boundingBox(box);
-    return randomGen.getPoint3() * (box.maxPoint() - box.minPoint()) + box.minPoint();
+    auto [u, v] = sampler->get2D();
+    return Point3(u, v, sampler->get1D()) * (box.maxPoint() - box.minPoint()) + box.minPoint();
 }
 
 double Hitable::pdf(const Ray &r) const
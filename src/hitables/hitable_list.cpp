@@ -1,5 +1,5 @@
 #include <hitables/hitable_list.h>
-#include <random.h>
+#include <sampler.h>
 
 bool HitableList::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) const
 {
@@ -29,7 +29,8 @@ bool HitableList::boundingBox(AABB &bounding_box) const
 
 Point3 HitableList::randomPointIn() const
 {
-    return m_objects.at(randomGen.getInt() % m_objects.size())->randomPointIn();
+    size_t idx = std::min<size_t>(sampler->get1D() * m_objects.size(), m_objects.size() - 1);
+    return m_objects.at(idx)->randomPointIn();
 }
 
 double HitableList::pdf(const Ray &r) const
@@ -59,4 +60,13 @@ void HitableList::add(HitablePtr object)
     }
 
     m_objects.push_back(object);
-}
\ No newline at end of file
+}
+
+void HitableList::add(const std::vector<HitablePtr> &objects, AABB box)
+{
+    if (objects.empty())
+        return;
+
+    m_box = m_objects.empty() ? box : AABB::surroundingBox(m_box, box);
+    m_objects.insert(m_objects.end(), objects.begin(), objects.end());
+}
@@ -0,0 +1,51 @@
+#include <hitables/mesh.h>
+
+Mesh::Mesh(MeshBuffer<Vec3f> positions, MeshBuffer<uint32_t> indices, std::shared_ptr<Material> mat,
+           MeshBuffer<Vec3f> normals, MeshBuffer<TexCoord> texcoords)
+    : m_positions(positions), m_indices(indices), m_normals(normals), m_texcoords(texcoords), m_mat(mat)
+{
+    if (m_normals && m_normals.size() != m_positions.size())
+    {
+        WARN("Mesh has " << m_normals.size() << " normals for " << m_positions.size() << " vertices, ignoring them");
+        m_normals = nullptr;
+    }
+    if (m_texcoords && m_texcoords.size() != m_positions.size())
+    {
+        WARN("Mesh has " << m_texcoords.size() << " texture coordinates for " << m_positions.size() << " vertices, ignoring them");
+        m_texcoords = nullptr;
+    }
+
+    size_t count = m_indices.size() / 3;
+    if (count == 0)
+        return;
+
+    m_triangles.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        m_triangles.emplace_back(this, i);
+
+    // The box of the mesh is reduced per thread, then combined
+    std::vector<HitablePtr> objects(count);
+    AABB box;
+    m_triangles.front().boundingBox(box);
+    const AABB first = box;
+
+#pragma omp parallel
+    {
+        AABB thread_box = first;
+
+#pragma omp for nowait
+        for (size_t i = 0; i < count; i++)
+        {
+            objects[i] = &m_triangles[i];
+
+            AABB triangle_box;
+            m_triangles[i].boundingBox(triangle_box);
+            thread_box = AABB::surroundingBox(thread_box, triangle_box);
+        }
+
+#pragma omp critical
+        box = AABB::surroundingBox(box, thread_box);
+    }
+
+    add(objects, box);
+}
@@ -39,8 +39,17 @@ bool Sphere::hit(const Ray &ray, double t_min, double t_max, HitRecord &rec) con
     Direction outward_normal = (rec.p - center()) / radius();
     rec.set_face_normal(ray, outward_normal);
     rec.mat = material();
+    rec.light = -1;
     getUV(outward_normal, rec.u, rec.v);
 
+    // The texture covers the surface of the sphere once
+    rec.footprint = 0;
+    if (ray.hasCone())
+    {
+        double cos_theta = std::max(std::fabs(dot(ray.direction(), outward_normal)), 0.001);
+        rec.footprint = ray.coneWidth(root) / (2 * std::sqrt(pi) * radius() * cos_theta);
+    }
+
     return true;
 }
 
@@ -1,8 +1,70 @@
 #include <hitables/triangle.h>
-#include <random.h>
+#include <hitables/mesh.h>
+#include <sampler.h>
 #include <core.h>
 #include <config.h>
 
+Point3 Triangle::point(int corner) const
+{
+    return m_mesh->vertex(m_index, corner);
+}
+
+std::shared_ptr<Material> Triangle::material() const
+{
+    return m_mesh->material();
+}
+
+void Triangle::setSurface(const Ray &r, double b1, double b2, const Direction &geometric_normal, HitRecord &rec) const
+{
+    // The side that was hit follows from the geometry. The interpolated
+    // normal is only used for shading, it is kept on the side of the hit.
+    rec.set_face_normal(r, normalize(geometric_normal));
+    double b0 = 1 - b1 - b2;
+
+    if (m_mesh->hasNormals())
+    {
+        Direction n = b0 * m_mesh->normal(m_index, 0) + b1 * m_mesh->normal(m_index, 1) + b2 * m_mesh->normal(m_index, 2);
+        if (n.length_squared() > 0)
+        {
+            n = normalize(n);
+            rec.normal = dot(n, rec.normal) < 0 ? -n : n;
+        }
+    }
+
+    if (m_mesh->hasTexCoords())
+    {
+        const TexCoord &t0 = m_mesh->texcoord(m_index, 0);
+        const TexCoord &t1 = m_mesh->texcoord(m_index, 1);
+        const TexCoord &t2 = m_mesh->texcoord(m_index, 2);
+        rec.u = b0 * t0.u + b1 * t1.u + b2 * t2.u;
+        rec.v = b0 * t0.v + b1 * t1.v + b2 * t2.v;
+    }
+    else
+    {
+        rec.u = b1;
+        rec.v = b2;
+    }
+
+    // The cone is scaled from world to texture space by the ratio of the
+    // areas of the triangle, and gets wider the more it hits at an angle.
+    // Without texture coordinates u and v are barycentric.
+    rec.footprint = 0;
+    if (r.hasCone())
+    {
+        double texture_area = 1;
+        if (m_mesh->hasTexCoords())
+        {
+            const TexCoord &t0 = m_mesh->texcoord(m_index, 0);
+            const TexCoord &t1 = m_mesh->texcoord(m_index, 1);
+            const TexCoord &t2 = m_mesh->texcoord(m_index, 2);
+            texture_area = std::fabs((t1.u - t0.u) * (t2.v - t0.v) - (t2.u - t0.u) * (t1.v - t0.v));
+        }
+        double area = geometric_normal.length();
+        double cos_theta = std::max(std::fabs(dot(r.direction(), geometric_normal)) / area, 0.001);
+        rec.footprint = r.coneWidth(rec.t) * std::sqrt(texture_area / area) / cos_theta;
+    }
+}
+
 #if TRIANGLE_INTERSECTION_ALGO == TRIANGLE_INTERSECTION_CRAMMER
 
 inline double det3x3(Direction &a, Direction &b, Direction &c)
@@ -27,9 +89,9 @@ bool Triangle::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) con
     // This algorithm is wrong, which causes the runtimes to be rediculous, I suspect the normals to be pointed outwards
 
     Direction dir = r.direction();
-    Direction edge1 = m_points[0] - m_points[1];
-    Direction edge2 = m_points[0] - m_points[2];
-    Direction rhs = m_points[0] - r.origin();
+    Direction edge1 = point(0) - point(1);
+    Direction edge2 = point(0) - point(2);
+    Direction rhs = point(0) - r.origin();
 
     double d = det3x3(dir, edge1, edge2);
     double inv_d = 1.0 / d;
@@ -42,10 +104,9 @@ bool Triangle::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) con
 
     rec.p = r.at(t);
     rec.t = t;
-    rec.u = u;
-    rec.v = v;
     rec.mat = material();
-    rec.set_face_normal(r, normalize(cross(edge1, edge2)));
+    rec.light = m_mesh->light(m_index);
+    setSurface(r, u, v, cross(edge1, edge2), rec);
 
     return (!backfaced || m_doublesided) && t >= 0.0 && u >= 0.0 && v >= 0.0 && u + v <= 1.0;
 }
@@ -61,8 +122,8 @@ bool Triangle::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) con
     // The UV coordinates
     double u, v;
 
-    Direction edge1 = m_points[1] - m_points[0];
-    Direction edge2 = m_points[2] - m_points[0];
+    Direction edge1 = point(1) - point(0);
+    Direction edge2 = point(2) - point(0);
     Point3 pvec = cross(r.direction(), edge2);
     double d = dot(edge1, pvec);
 
@@ -75,7 +136,7 @@ bool Triangle::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) con
         return false;
 
     float inverted_d = 1 / d;
-    Direction tvec = r.origin() - m_points[0];
+    Direction tvec = r.origin() - point(0);
     u = dot(tvec, pvec) * inverted_d;
 
     // U cannot be greater than 1 or smaller than 0, since, well, that is
@@ -97,11 +158,10 @@ bool Triangle::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) con
 
     rec.p = r.at(t);
     rec.t = t;
-    rec.u = u;
-    rec.v = v;
     rec.mat = material();
     rec.hitable = this;
-    rec.set_face_normal(r, normalize(cross(edge1, edge2)));
+    rec.light = m_mesh->light(m_index);
+    setSurface(r, u, v, cross(edge1, edge2), rec);
 
     return true;
 }
@@ -111,12 +171,12 @@ bool Triangle::hit(const Ray &r, double t_min, double t_max, HitRecord &rec) con
 bool Triangle::boundingBox(AABB &bounding_box) const
 {
     // Is there a better way?
-    double z_min = fmin(fmin(m_points[0].z(), m_points[1].z()), m_points[2].z());
-    double z_max = fmax(fmax(m_points[0].z(), m_points[1].z()), m_points[2].z());
-    double x_min = fmin(fmin(m_points[0].x(), m_points[1].x()), m_points[2].x());
-    double x_max = fmax(fmax(m_points[0].x(), m_points[1].x()), m_points[2].x());
-    double y_min = fmin(fmin(m_points[0].y(), m_points[1].y()), m_points[2].y());
-    double y_max = fmax(fmax(m_points[0].y(), m_points[1].y()), m_points[2].y());
+    double z_min = fmin(fmin(point(0).z(), point(1).z()), point(2).z());
+    double z_max = fmax(fmax(point(0).z(), point(1).z()), point(2).z());
+    double x_min = fmin(fmin(point(0).x(), point(1).x()), point(2).x());
+    double x_max = fmax(fmax(point(0).x(), point(1).x()), point(2).x());
+    double y_min = fmin(fmin(point(0).y(), point(1).y()), point(2).y());
+    double y_max = fmax(fmax(point(0).y(), point(1).y()), point(2).y());
 
     const double e = 0.0001;
     // Sometimes triangles are x y or z plane aligned and we get an infinitely thin AABB
@@ -132,11 +192,10 @@ Point3 Triangle::randomPointIn() const
 
     // TODO: not sure if this actually works
 
-    Direction edge1 = m_points[1] - m_points[0];
-    Direction edge2 = m_points[2] - m_points[0];
+    Direction edge1 = point(1) - point(0);
+    Direction edge2 = point(2) - point(0);
 
-    double r1 = randomGen.getDouble();
-    double r2 = randomGen.getDouble();
+    auto [r1, r2] = sampler->get2D();
 
     if (r1 + r2 > 1)
     {
@@ -144,7 +203,7 @@ Point3 Triangle::randomPointIn() const
         r2 = 1 - r2;
     }
 
-    return (edge1 * r1 + edge2 * r2) + m_points[0];
+    return (edge1 * r1 + edge2 * r2) + point(0);
 }
 
 double Triangle::pdf(const Ray &r) const
@@ -155,8 +214,8 @@ double Triangle::pdf(const Ray &r) const
 
     // Should be 1/area of triangle
 
-    Direction edge1 = m_points[1] - m_points[0];
-    Direction edge2 = m_points[2] - m_points[0];
+    Direction edge1 = point(1) - point(0);
+    Direction edge2 = point(2) - point(0);
 
     double area = cross(edge1, edge2).length() / 2.0;
 
@@ -167,5 +226,5 @@ double Triangle::pdf(const Ray &r) const
 
 Point3 Triangle::center() const
 {
-    return (m_points[0] + m_points[1] + m_points[2]) / 3.0;
+    return (point(0) + point(1) + point(2)) / 3.0;
 }
\ No newline at end of file
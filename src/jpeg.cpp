@@ -0,0 +1,600 @@
+#include <jpeg.h>
+
+#include <cstring>
+
+#define READ_ERR(x)     \
+    do                  \
+    {                   \
+        WARN(x);        \
+        return nullptr; \
+    } while (0);
+
+#define JPEG_MARKER_SOF0    0xC0
+#define JPEG_MARKER_SOF1    0xC1
+#define JPEG_MARKER_DHT     0xC4
+#define JPEG_MARKER_RST0    0xD0
+#define JPEG_MARKER_RST7    0xD7
+#define JPEG_MARKER_SOI     0xD8
+#define JPEG_MARKER_EOI     0xD9
+#define JPEG_MARKER_SOS     0xDA
+#define JPEG_MARKER_DQT     0xDB
+#define JPEG_MARKER_DRI     0xDD
+#define JPEG_MARKER_APP14   0xEE
+
+// Codes of at most this many bits are decoded with a single table lookup
+#define JPEG_FAST_BITS      9
+
+// Position in the block of the coefficients in the order they are stored
+static const uint8_t zigzag[64] = {0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+                                   12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+                                   35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+                                   58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63};
+
+// Reads the entropy coded data of a scan, most significant bit first. A
+// 0xFF byte in the data is followed by a stuffed zero byte, any other byte
+// after it is a marker that ends the data. Bits past the end read as zeros.
+class JpegBitReader
+{
+private:
+    const uint8_t *m_data;
+    size_t m_size;
+    size_t m_pos;
+    uint32_t m_bits = 0;
+    int m_count = 0;
+    bool m_marker = false;
+
+    void fill()
+    {
+        while (m_count <= 24)
+        {
+            uint32_t byte = 0;
+            if (!m_marker && m_pos < m_size)
+            {
+                byte = m_data[m_pos];
+                if (byte != 0xFF)
+                    m_pos++;
+                else if (m_pos + 1 < m_size && m_data[m_pos + 1] == 0)
+                    m_pos += 2;
+                else
+                {
+                    m_marker = true;
+                    byte = 0;
+                }
+            }
+            m_bits |= byte << (24 - m_count);
+            m_count += 8;
+        }
+    }
+
+public:
+    JpegBitReader(const uint8_t *data, size_t size, size_t pos) : m_data(data), m_size(size), m_pos(pos) {}
+
+    // The next count bits without consuming them, count is 1 to 16
+    uint32_t peek(int count)
+    {
+        if (m_count < count)
+            fill();
+        return m_bits >> (32 - count);
+    }
+
+    void consume(int count)
+    {
+        m_bits <<= count;
+        m_count -= count;
+    }
+
+    // A coefficient of the given size in bits, the values with a leading
+    // zero bit are the negative ones
+    int receive(int size)
+    {
+        if (size == 0)
+            return 0;
+
+        int value = peek(size);
+        consume(size);
+        return value < (1 << (size - 1)) ? value - (1 << size) + 1 : value;
+    }
+
+    // Drop the rest of the current interval and skip the restart marker
+    // after it
+    bool restart()
+    {
+        m_bits = 0;
+        m_count = 0;
+        m_marker = false;
+
+        while (m_pos + 1 < m_size &&
+               !(m_data[m_pos] == 0xFF && m_data[m_pos + 1] >= JPEG_MARKER_RST0 && m_data[m_pos + 1] <= JPEG_MARKER_RST7))
+            m_pos++;
+        if (m_pos + 1 >= m_size)
+            return false;
+
+        m_pos += 2;
+        return true;
+    }
+
+    size_t position() const { return m_pos; }
+};
+
+struct JpegHuffman
+{
+    bool defined = false;
+    uint8_t values[256];
+
+    // The largest code of every length, -1 when there is none, and the
+    // index in values minus the first code of every length
+    int32_t max_code[17];
+    int32_t offsets[17];
+
+    // Value << 4 | length, 0 when the code is longer than the table
+    uint16_t fast[1 << JPEG_FAST_BITS];
+
+    // Codes are assigned in order of length, see annex C of the standard.
+    // Returns false when there are more values than codes.
+    bool build(const uint8_t *counts, const uint8_t *symbols)
+    {
+        memset(fast, 0, sizeof(fast));
+
+        int code = 0;
+        int k = 0;
+        for (int len = 1; len <= 16; len++)
+        {
+            offsets[len] = k - code;
+            for (int i = 0; i < counts[len - 1]; i++, k++, code++)
+            {
+                values[k] = symbols[k];
+                if (len > JPEG_FAST_BITS)
+                    continue;
+
+                int shift = JPEG_FAST_BITS - len;
+                for (int j = 0; j < (1 << shift); j++)
+                    fast[(code << shift) | j] = values[k] << 4 | len;
+            }
+            max_code[len] = counts[len - 1] > 0 ? code - 1 : -1;
+
+            if (code > (1 << len))
+                return false;
+            code <<= 1;
+        }
+
+        defined = true;
+        return true;
+    }
+
+    // Returns -1 for codes that are not in the table
+    int decode(JpegBitReader &reader) const
+    {
+        uint16_t entry = fast[reader.peek(JPEG_FAST_BITS)];
+        if (entry != 0)
+        {
+            reader.consume(entry & 0xF);
+            return entry >> 4;
+        }
+
+        uint32_t bits = reader.peek(16);
+        for (int len = JPEG_FAST_BITS + 1; len <= 16; len++)
+        {
+            int32_t code = bits >> (16 - len);
+            if (code <= max_code[len])
+            {
+                reader.consume(len);
+                return values[offsets[len] + code];
+            }
+        }
+        return -1;
+    }
+};
+
+struct JpegComponent
+{
+    int id;
+    int h;          // Sampling factors
+    int v;
+    int quant;
+    int dc_table = 0;
+    int ac_table = 0;
+    int dc_prediction = 0;
+
+    // The decoded samples of the whole MCUs, so the size is a multiple of
+    // 8 times the sampling factor
+    int stride = 0;
+    std::vector<uint8_t> plane;
+};
+
+// Inverse DCT of a block of dequantized coefficients, the rows and columns
+// are transformed separately
+static void idct(const int *coefficients, uint8_t *out, int stride)
+{
+    // Basis function u at sample x, including the scale of the transform
+    static const std::vector<float> basis = []() {
+        std::vector<float> basis(64);
+        for (int x = 0; x < 8; x++)
+        {
+            for (int u = 0; u < 8; u++)
+                basis[x * 8 + u] = (u == 0 ? std::sqrt(0.5) : 1.0) * std::cos((2 * x + 1) * u * pi / 16) / 2;
+        }
+        return basis;
+    }();
+
+    float columns[64];
+    for (int u = 0; u < 8; u++)
+    {
+        // Most columns are only a DC value or empty
+        bool flat = true;
+        for (int v = 1; v < 8 && flat; v++)
+            flat = coefficients[v * 8 + u] == 0;
+
+        for (int y = 0; y < 8; y++)
+        {
+            if (flat)
+            {
+                columns[y * 8 + u] = coefficients[u] * basis[0];
+                continue;
+            }
+
+            float sum = 0;
+            for (int v = 0; v < 8; v++)
+                sum += basis[y * 8 + v] * coefficients[v * 8 + u];
+            columns[y * 8 + u] = sum;
+        }
+    }
+
+    for (int y = 0; y < 8; y++)
+    {
+        for (int x = 0; x < 8; x++)
+        {
+            float sum = 128.5f;
+            for (int u = 0; u < 8; u++)
+                sum += basis[x * 8 + u] * columns[y * 8 + u];
+            out[y * stride + x] = std::min(255, std::max(0, (int)std::floor(sum)));
+        }
+    }
+}
+
+static bool decodeBlock(JpegBitReader &reader, JpegComponent &component, const JpegHuffman &dc,
+                        const JpegHuffman &ac, const uint16_t *quant, uint8_t *out)
+{
+    int coefficients[64] = {};
+
+    // The DC value is stored as the difference to the previous block
+    int size = dc.decode(reader);
+    if (size < 0 || size > 11)
+        return false;
+    component.dc_prediction += reader.receive(size);
+    coefficients[0] = component.dc_prediction * quant[0];
+
+    for (int k = 1; k < 64;)
+    {
+        int symbol = ac.decode(reader);
+        if (symbol < 0)
+            return false;
+
+        // A run of zeros and the size of the next value, a run without a
+        // value ends the block unless it is a run of 16 zeros
+        int run = symbol >> 4;
+        size = symbol & 0xF;
+        if (size == 0)
+        {
+            if (run != 15)
+                break;
+            k += 16;
+            continue;
+        }
+
+        k += run;
+        if (k > 63)
+            return false;
+        coefficients[zigzag[k]] = reader.receive(size) * quant[k];
+        k++;
+    }
+
+    idct(coefficients, out, component.stride);
+    return true;
+}
+
+std::shared_ptr<LdrImage> Jpeg::read(const uint8_t *data, size_t size)
+{
+    if (size < 4 || data[0] != 0xFF || data[1] != JPEG_MARKER_SOI)
+        READ_ERR("Could not read JPEG image because it has no JPEG signature");
+
+    JpegHuffman dc_tables[4];
+    JpegHuffman ac_tables[4];
+    uint16_t quant_tables[4][64];
+    bool quant_defined[4] = {};
+
+    std::vector<JpegComponent> components;
+    int width = 0;
+    int height = 0;
+    int h_max = 1;
+    int v_max = 1;
+    int mcus_x = 0;
+    int mcus_y = 0;
+    int restart_interval = 0;
+    int adobe_transform = -1;
+    bool scanned = false;
+
+    size_t pos = 2;
+    while (true)
+    {
+        // Skip what is left of the last scan and the fill bytes in front of
+        // the marker
+        while (pos < size && data[pos] != 0xFF)
+            pos++;
+        while (pos < size && data[pos] == 0xFF)
+            pos++;
+
+        // Files that end without an end marker are common enough
+        if (pos >= size)
+            break;
+
+        int marker = data[pos++];
+        if (marker == JPEG_MARKER_EOI)
+            break;
+
+        // Stuffed bytes and restart markers left in the scan data
+        if (marker == 0 || (marker >= JPEG_MARKER_RST0 && marker <= JPEG_MARKER_RST7))
+            continue;
+
+        if (size - pos < 2)
+            READ_ERR("Could not read JPEG image because it ends early");
+        size_t length = data[pos] << 8 | data[pos + 1];
+        if (length < 2 || length > size - pos)
+            READ_ERR("Could not read JPEG image because it ends early");
+
+        const uint8_t *segment = &data[pos + 2];
+        size_t segment_size = length - 2;
+        pos += length;
+
+        switch (marker)
+        {
+        case JPEG_MARKER_DHT:
+            for (size_t offset = 0; offset < segment_size;)
+            {
+                int table_class = segment[offset] >> 4;
+                int id = segment[offset] & 0xF;
+                if (table_class > 1 || id > 3 || segment_size - offset < 17)
+                    READ_ERR("Could not read JPEG image because of an invalid Huffman table");
+
+                const uint8_t *counts = &segment[offset + 1];
+                size_t total = 0;
+                for (int len = 0; len < 16; len++)
+                    total += counts[len];
+                if (total > 256 || segment_size - offset - 17 < total)
+                    READ_ERR("Could not read JPEG image because of an invalid Huffman table");
+
+                JpegHuffman &table = table_class == 0 ? dc_tables[id] : ac_tables[id];
+                if (!table.build(counts, &segment[offset + 17]))
+                    READ_ERR("Could not read JPEG image because of an invalid Huffman table");
+                offset += 17 + total;
+            }
+            break;
+
+        case JPEG_MARKER_DQT:
+            for (size_t offset = 0; offset < segment_size;)
+            {
+                int precision = segment[offset] >> 4;
+                int id = segment[offset] & 0xF;
+                size_t table_size = precision ? 128 : 64;
+                if (precision > 1 || id > 3 || segment_size - offset - 1 < table_size)
+                    READ_ERR("Could not read JPEG image because of an invalid quantization table");
+
+                const uint8_t *values = &segment[offset + 1];
+                for (int k = 0; k < 64; k++)
+                    quant_tables[id][k] = precision ? values[2 * k] << 8 | values[2 * k + 1] : values[k];
+                quant_defined[id] = true;
+                offset += 1 + table_size;
+            }
+            break;
+
+        case JPEG_MARKER_SOF0:
+        case JPEG_MARKER_SOF1:
+        {
+            if (!components.empty() || segment_size < 6)
+                READ_ERR("Could not read JPEG image because of an invalid frame header");
+
+            int precision = segment[0];
+            height = segment[1] << 8 | segment[2];
+            width = segment[3] << 8 | segment[4];
+            int count = segment[5];
+            if (precision != 8)
+                READ_ERR("Could not read JPEG image because it has " << precision << " bit samples");
+            if (count != 1 && count != 3)
+                READ_ERR("Could not read JPEG image because it has " << count << " components");
+            if (width == 0 || height == 0 || segment_size < 6 + 3 * (size_t)count)
+                READ_ERR("Could not read JPEG image because of an invalid frame header");
+
+            for (int i = 0; i < count; i++)
+            {
+                const uint8_t *spec = &segment[6 + 3 * i];
+                JpegComponent component;
+                component.id = spec[0];
+                component.h = spec[1] >> 4;
+                component.v = spec[1] & 0xF;
+                component.quant = spec[2];
+                if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 || component.quant > 3)
+                    READ_ERR("Could not read JPEG image because of an invalid frame header");
+
+                h_max = std::max(h_max, component.h);
+                v_max = std::max(v_max, component.v);
+                components.push_back(component);
+            }
+
+            // Every MCU holds h by v blocks of every component
+            mcus_x = (width + 8 * h_max - 1) / (8 * h_max);
+            mcus_y = (height + 8 * v_max - 1) / (8 * v_max);
+
+            // Every block takes at least two bits, a header that claims
+            // more blocks than that is broken
+            size_t blocks = 0;
+            for (const JpegComponent &component : components)
+                blocks += (size_t)mcus_x * mcus_y * component.h * component.v;
+            if (blocks / 4 > size - pos)
+                READ_ERR("Could not read JPEG image because it has less image data than its size needs");
+
+            for (JpegComponent &component : components)
+            {
+                component.stride = mcus_x * component.h * 8;
+                component.plane.resize((size_t)component.stride * mcus_y * component.v * 8);
+            }
+            break;
+        }
+
+        case JPEG_MARKER_DRI:
+            if (segment_size < 2)
+                READ_ERR("Could not read JPEG image because of an invalid restart interval");
+            restart_interval = segment[0] << 8 | segment[1];
+            break;
+
+        case JPEG_MARKER_APP14:
+            // Adobe files say whether the color is stored as YCbCr
+            if (segment_size >= 12 && memcmp(segment, "Adobe", 5) == 0)
+                adobe_transform = segment[11];
+            break;
+
+        case JPEG_MARKER_SOS:
+        {
+            int count = segment_size > 0 ? segment[0] : 0;
+            if (components.empty() || count < 1 || count > (int)components.size() ||
+                segment_size < 4 + 2 * (size_t)count)
+                READ_ERR("Could not read JPEG image because of an invalid scan header");
+
+            std::vector<JpegComponent *> scan;
+            for (int i = 0; i < count; i++)
+            {
+                const uint8_t *spec = &segment[1 + 2 * i];
+                JpegComponent *component = nullptr;
+                for (JpegComponent &c : components)
+                {
+                    if (c.id == spec[0])
+                        component = &c;
+                }
+                if (!component)
+                    READ_ERR("Could not read JPEG image because of an invalid scan header");
+
+                component->dc_table = spec[1] >> 4;
+                component->ac_table = spec[1] & 0xF;
+                component->dc_prediction = 0;
+                if (component->dc_table > 3 || component->ac_table > 3 ||
+                    !dc_tables[component->dc_table].defined || !ac_tables[component->ac_table].defined ||
+                    !quant_defined[component->quant])
+                    READ_ERR("Could not read JPEG image because a scan uses a table that is not defined");
+                scan.push_back(component);
+            }
+
+            // A scan of a single component holds its blocks in plain order,
+            // without the padding of the MCUs
+            int units_x = mcus_x;
+            int units_y = mcus_y;
+            if (count == 1)
+            {
+                const JpegComponent &c = *scan[0];
+                units_x = ((width * c.h + h_max - 1) / h_max + 7) / 8;
+                units_y = ((height * c.v + v_max - 1) / v_max + 7) / 8;
+            }
+
+            JpegBitReader reader(data, size, pos);
+            int units = units_x * units_y;
+            for (int unit = 0; unit < units; unit++)
+            {
+                if (restart_interval > 0 && unit > 0 && unit % restart_interval == 0)
+                {
+                    if (!reader.restart())
+                        READ_ERR("Could not read JPEG image because a restart marker is missing");
+                    for (JpegComponent *c : scan)
+                        c->dc_prediction = 0;
+                }
+
+                int unit_x = unit % units_x;
+                int unit_y = unit / units_x;
+                for (JpegComponent *c : scan)
+                {
+                    int blocks_x = count == 1 ? 1 : c->h;
+                    int blocks_y = count == 1 ? 1 : c->v;
+                    for (int by = 0; by < blocks_y; by++)
+                    {
+                        for (int bx = 0; bx < blocks_x; bx++)
+                        {
+                            size_t x = (size_t)(unit_x * blocks_x + bx) * 8;
+                            size_t y = (size_t)(unit_y * blocks_y + by) * 8;
+                            uint8_t *out = &c->plane[y * c->stride + x];
+                            if (!decodeBlock(reader, *c, dc_tables[c->dc_table], ac_tables[c->ac_table],
+                                             quant_tables[c->quant], out))
+                                READ_ERR("Could not read JPEG image because its image data is corrupt");
+                        }
+                    }
+                }
+            }
+
+            pos = reader.position();
+            scanned = true;
+            break;
+        }
+
+        default:
+            if (marker >= 0xC2 && marker <= 0xCF)
+                READ_ERR("Could not read JPEG image because progressive, lossless and arithmetic coded images are not supported");
+            break;
+        }
+    }
+
+    if (!scanned)
+        READ_ERR("Could not read JPEG image because it has no image data");
+
+    auto image = std::make_shared<LdrImage>();
+    image->width = width;
+    image->height = height;
+    image->channels = components.size();
+    image->pixels.resize((size_t)width * height * image->channels);
+
+    // Color is stored as YCbCr, unless the file says otherwise or names
+    // its components R, G and B
+    bool ycbcr = components.size() == 3 && adobe_transform != 0 &&
+                 !(components[0].id == 'R' && components[1].id == 'G' && components[2].id == 'B');
+
+    // Subsampled components are upsampled by repeating their samples
+    std::vector<std::vector<int>> columns(components.size());
+    for (size_t c = 0; c < components.size(); c++)
+    {
+        columns[c].resize(width);
+        for (int x = 0; x < width; x++)
+            columns[c][x] = x * components[c].h / h_max;
+    }
+
+#pragma omp parallel for
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t *rows[3];
+        for (size_t c = 0; c < components.size(); c++)
+            rows[c] = &components[c].plane[(size_t)(y * components[c].v / v_max) * components[c].stride];
+
+        uint8_t *out = &image->pixels[(size_t)y * width * image->channels];
+        for (int x = 0; x < width; x++)
+        {
+            if (components.size() == 1)
+            {
+                out[x] = rows[0][columns[0][x]];
+                continue;
+            }
+
+            float c0 = rows[0][columns[0][x]];
+            float c1 = rows[1][columns[1][x]];
+            float c2 = rows[2][columns[2][x]];
+            if (ycbcr)
+            {
+                // See the JFIF specification
+                float luma = c0;
+                float cb = c1 - 128;
+                float cr = c2 - 128;
+                c0 = luma + 1.402f * cr;
+                c1 = luma - 0.344136f * cb - 0.714136f * cr;
+                c2 = luma + 1.772f * cb;
+            }
+
+            out[3 * x + 0] = std::min(255, std::max(0, (int)std::lround(c0)));
+            out[3 * x + 1] = std::min(255, std::max(0, (int)std::lround(c1)));
+            out[3 * x + 2] = std::min(255, std::max(0, (int)std::lround(c2)));
+        }
+    }
+
+    return image;
+}
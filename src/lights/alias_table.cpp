@@ -0,0 +1,62 @@
+#include <lights/alias_table.h>
+
+AliasTable::AliasTable(const std::vector<double> &weights)
+{
+    int n = weights.size();
+    m_bins.resize(n);
+    m_pmf.resize(n);
+
+    double total = 0;
+    for (double w : weights)
+        total += w;
+
+    // Without any weight everything is equally likely
+    for (int i = 0; i < n; i++)
+        m_pmf[i] = total > 0 ? weights[i] / total : 1.0 / n;
+
+    // Scale the probabilities so the average bin is 1, then fill every bin
+    // that is too small with a part of a bin that is too large.
+    std::vector<double> scaled(n);
+    std::vector<int> small, large;
+    for (int i = 0; i < n; i++)
+    {
+        scaled[i] = m_pmf[i] * n;
+        if (scaled[i] < 1)
+            small.push_back(i);
+        else
+            large.push_back(i);
+    }
+
+    while (!small.empty() && !large.empty())
+    {
+        int s = small.back();
+        small.pop_back();
+        int l = large.back();
+
+        m_bins[s] = Bin{scaled[s], l};
+
+        scaled[l] -= 1 - scaled[s];
+        if (scaled[l] < 1)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // What is left over is 1 up to rounding errors
+    for (int i : large)
+        m_bins[i] = Bin{1, i};
+    for (int i : small)
+        m_bins[i] = Bin{1, i};
+}
+
+int AliasTable::sample(double u) const
+{
+    // The integer part picks the bin, the fraction decides between the bin
+    // and its alias.
+    double scaled = u * m_bins.size();
+    int bin = std::min<int>(scaled, m_bins.size() - 1);
+    double remainder = scaled - bin;
+
+    return remainder < m_bins[bin].probability ? bin : m_bins[bin].alias;
+}
@@ -0,0 +1,119 @@
+#include <lights/environment_map.h>
+
+// Turn the running sums in cdf[0..n] into a CDF, rows without any weight
+// are made uniform so every row is still a valid distribution.
+static void normalizeCdf(float *cdf, int n)
+{
+    double total = cdf[n];
+    for (int i = 1; i < n; i++)
+        cdf[i] = total > 0 ? cdf[i] / total : (double)i / n;
+    cdf[n] = 1;
+}
+
+// Find the interval of cdf[0..n] that u falls in and how far into it u is
+static int sampleCdf(const float *cdf, int n, double u, double &offset)
+{
+    int i = std::upper_bound(cdf, cdf + n + 1, (float)u) - cdf - 1;
+    i = std::clamp(i, 0, n - 1);
+
+    double width = cdf[i + 1] - cdf[i];
+    offset = width > 0 ? std::clamp((u - cdf[i]) / width, 0.0, 1.0) : 0.5;
+    return i;
+}
+
+EnvironmentMap::EnvironmentMap(std::shared_ptr<HdrImage> image, double strength)
+    : m_image(image), m_strength(strength)
+{
+#if ENVIRONMENT_HALF_RES_CDF
+    m_rows = std::max(1, image->height / 2);
+    m_cols = std::max(1, image->width / 2);
+#else
+    m_rows = image->height;
+    m_cols = image->width;
+#endif
+
+    m_conditional_cdf.resize((size_t)m_rows * (m_cols + 1));
+    m_marginal_cdf.resize(m_rows + 1);
+
+    m_marginal_cdf[0] = 0;
+    for (int r = 0; r < m_rows; r++)
+    {
+        // Rows near the poles cover less of the sphere
+        double sin_theta = sin(pi * (r + 0.5) / m_rows);
+        int y0 = r * image->height / m_rows;
+        int y1 = (r + 1) * image->height / m_rows;
+
+        float *cdf = &m_conditional_cdf[(size_t)r * (m_cols + 1)];
+        cdf[0] = 0;
+        for (int c = 0; c < m_cols; c++)
+        {
+            int x0 = c * image->width / m_cols;
+            int x1 = (c + 1) * image->width / m_cols;
+
+            double sum = 0;
+            for (int y = y0; y < y1; y++)
+            {
+                for (int x = x0; x < x1; x++)
+                    sum += std::max(0.0, luminance(image->at(x, y)));
+            }
+
+            cdf[c + 1] = cdf[c] + sum / ((y1 - y0) * (x1 - x0)) * sin_theta;
+        }
+
+        m_marginal_cdf[r + 1] = m_marginal_cdf[r] + cdf[m_cols];
+        normalizeCdf(cdf, m_cols);
+    }
+
+    normalizeCdf(m_marginal_cdf.data(), m_rows);
+}
+
+void EnvironmentMap::toImage(const Direction &dir, double &u, double &v, double &sin_theta)
+{
+    Direction d = normalize(dir);
+    double theta = acos(std::clamp(d.y(), -1.0, 1.0));
+    double phi = atan2(d.z(), d.x());
+
+    u = phi / (2 * pi) + 0.5;
+    v = theta / pi;
+    sin_theta = sqrt(d.x() * d.x() + d.z() * d.z());
+}
+
+Color EnvironmentMap::value(const Direction &dir) const
+{
+    double u, v, sin_theta;
+    toImage(dir, u, v, sin_theta);
+
+    int x = std::clamp((int)(u * m_image->width), 0, m_image->width - 1);
+    int y = std::clamp((int)(v * m_image->height), 0, m_image->height - 1);
+    return m_image->at(x, y) * m_strength;
+}
+
+Direction EnvironmentMap::sample(double u, double v) const
+{
+    double row_offset, col_offset;
+    int row = sampleCdf(m_marginal_cdf.data(), m_rows, u, row_offset);
+    int col = sampleCdf(&m_conditional_cdf[(size_t)row * (m_cols + 1)], m_cols, v, col_offset);
+
+    double theta = pi * (row + row_offset) / m_rows;
+    double phi = 2 * pi * ((col + col_offset) / m_cols - 0.5);
+    return Direction(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+}
+
+double EnvironmentMap::pdf(const Direction &dir) const
+{
+    double u, v, sin_theta;
+    toImage(dir, u, v, sin_theta);
+    if (sin_theta <= 0)
+        return 0;
+
+    int row = std::clamp((int)(v * m_rows), 0, m_rows - 1);
+    int col = std::clamp((int)(u * m_cols), 0, m_cols - 1);
+
+    const float *cdf = &m_conditional_cdf[(size_t)row * (m_cols + 1)];
+    double pdf_row = (m_marginal_cdf[row + 1] - m_marginal_cdf[row]) * m_rows;
+    double pdf_col = (cdf[col + 1] - cdf[col]) * m_cols;
+
+    // From the density over the image to one over the sphere, the image
+    // spans 2 pi by pi radians.
+    return pdf_row * pdf_col / (2 * pi * pi * sin_theta);
+}
@@ -0,0 +1,341 @@
+#include <lights/light_bvh.h>
+
+static Direction rotate(const Direction &v, const Direction &axis, double angle)
+{
+    // Rodrigues' rotation formula, axis has to be normalized
+    return v * cos(angle) + cross(axis, v) * sin(angle) + axis * dot(axis, v) * (1 - cos(angle));
+}
+
+// Whether the cone with spread theta_o contains a cone with spread theta_i
+// whose axis is theta_d away, min(theta_d + theta_i, pi) <= theta_o.
+static bool coneContains(double cos_theta_o, double cos_theta_d, double cos_theta_i)
+{
+    if (cos_theta_o <= -1)
+        return true;
+    if (cos_theta_i <= -1)
+        return false;
+
+    double sin_theta_d = sqrt(std::max(0.0, 1 - cos_theta_d * cos_theta_d));
+    double sin_theta_i = sqrt(std::max(0.0, 1 - cos_theta_i * cos_theta_i));
+
+    // theta_d + theta_i past pi, only the whole sphere contains that
+    if (sin_theta_d * cos_theta_i + cos_theta_d * sin_theta_i < 0)
+        return false;
+
+    return cos_theta_d * cos_theta_i - sin_theta_d * sin_theta_i >= cos_theta_o;
+}
+
+LightBounds LightBounds::merge(const LightBounds &a, const LightBounds &b)
+{
+    if (a.power == 0)
+        return b;
+    if (b.power == 0)
+        return a;
+
+    LightBounds out;
+    AABB box_a = a.box;
+    AABB box_b = b.box;
+    out.box = AABB::surroundingBox(box_a, box_b);
+    out.power = a.power + b.power;
+    out.two_sided = a.two_sided || b.two_sided;
+    out.cos_theta_e = std::min(a.cos_theta_e, b.cos_theta_e);
+
+    // The smallest cone that contains both normal cones. Most merges end up
+    // in one of the cones containing the other, that is checked without
+    // inverse trigonometry.
+    double cos_theta_d = std::clamp(dot(a.axis, b.axis), -1.0, 1.0);
+
+    if (coneContains(a.cos_theta_o, cos_theta_d, b.cos_theta_o))
+    {
+        out.axis = a.axis;
+        out.cos_theta_o = a.cos_theta_o;
+        return out;
+    }
+
+    if (coneContains(b.cos_theta_o, cos_theta_d, a.cos_theta_o))
+    {
+        out.axis = b.axis;
+        out.cos_theta_o = b.cos_theta_o;
+        return out;
+    }
+
+    double theta_a = acos(std::clamp(a.cos_theta_o, -1.0, 1.0));
+    double theta_b = acos(std::clamp(b.cos_theta_o, -1.0, 1.0));
+    double theta_d = acos(cos_theta_d);
+    double theta_o = (theta_a + theta_d + theta_b) / 2;
+    Direction rotation_axis = cross(a.axis, b.axis);
+    if (theta_o >= pi || rotation_axis.length_squared() == 0)
+    {
+        out.axis = a.axis;
+        out.cos_theta_o = -1;
+        return out;
+    }
+
+    out.axis = normalize(rotate(a.axis, normalize(rotation_axis), theta_o - theta_a));
+    out.cos_theta_o = cos(theta_o);
+    return out;
+}
+
+// cos(max(0, a - b)) and sin(max(0, a - b)) given the sines and cosines of a and b
+static double cosSubClamped(double sin_a, double cos_a, double sin_b, double cos_b)
+{
+    if (cos_a > cos_b)
+        return 1;
+    return cos_a * cos_b + sin_a * sin_b;
+}
+
+static double sinSubClamped(double sin_a, double cos_a, double sin_b, double cos_b)
+{
+    if (cos_a > cos_b)
+        return 0;
+    return sin_a * cos_b - cos_a * sin_b;
+}
+
+double LightBounds::importance(const Point3 &p) const
+{
+    Point3 center = (box.minPoint() + box.maxPoint()) / 2;
+    double radius = (box.maxPoint() - center).length();
+
+    // Do not let the importance blow up for points close to or inside the bounds
+    double d2 = std::max((p - center).length_squared(), radius);
+
+    // The angle between the cone axis and the direction to p
+    Direction wi = (p - center).length_squared() > 0 ? normalize(p - center) : axis;
+    double cos_theta_w = dot(axis, wi);
+    if (two_sided)
+        cos_theta_w = fabs(cos_theta_w);
+    double sin_theta_w = sqrt(std::max(0.0, 1 - cos_theta_w * cos_theta_w));
+
+    // The angle the bounding sphere of the box takes up seen from p
+    double cos_theta_b = -1;
+    if ((p - center).length_squared() > radius * radius)
+    {
+        double sin2_theta_b = radius * radius / (p - center).length_squared();
+        cos_theta_b = sqrt(std::max(0.0, 1 - sin2_theta_b));
+    }
+    double sin_theta_b = sqrt(std::max(0.0, 1 - cos_theta_b * cos_theta_b));
+
+    // The smallest angle between p and any normal in the cone, from any point in the box
+    double sin_theta_o = sqrt(std::max(0.0, 1 - cos_theta_o * cos_theta_o));
+    double cos_theta_x = cosSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    double sin_theta_x = sinSubClamped(sin_theta_w, cos_theta_w, sin_theta_o, cos_theta_o);
+    double cos_theta_p = cosSubClamped(sin_theta_x, cos_theta_x, sin_theta_b, cos_theta_b);
+
+    if (cos_theta_p <= cos_theta_e)
+        return 0;
+
+    return power * cos_theta_p / d2;
+}
+
+// The surface area orientation cost of a group of lights, see "Importance
+// Sampling of Many Lights with Adaptive Tree Splitting".
+static double orientationCost(const LightBounds &bounds)
+{
+    double cos_theta_o = std::clamp(bounds.cos_theta_o, -1.0, 1.0);
+    double theta_o = acos(cos_theta_o);
+    double theta_e = acos(std::clamp(bounds.cos_theta_e, -1.0, 1.0));
+    double theta_w = std::min(theta_o + theta_e, pi);
+    double sin_theta_o = sqrt(std::max(0.0, 1 - cos_theta_o * cos_theta_o));
+
+    double m_omega = 2 * pi * (1 - cos_theta_o) +
+                     pi / 2 * (2 * theta_w * sin_theta_o - cos(theta_o - 2 * theta_w) - 2 * theta_o * sin_theta_o + cos_theta_o);
+
+    return bounds.power * m_omega * bounds.box.surfaceArea();
+}
+
+LightBvh::LightBvh(const std::vector<LightBounds> &lights)
+{
+    if (lights.empty())
+        return;
+
+    std::vector<std::pair<int, LightBounds>> items;
+    items.reserve(lights.size());
+    for (size_t i = 0; i < lights.size(); i++)
+        items.push_back({i, lights[i]});
+
+    m_nodes.reserve(2 * lights.size() - 1);
+    m_parents.reserve(2 * lights.size() - 1);
+    m_light_leaf.resize(lights.size());
+
+    build(items, 0, items.size(), -1);
+}
+
+int LightBvh::build(std::vector<std::pair<int, LightBounds>> &lights, int start, int end, int parent)
+{
+    int index = m_nodes.size();
+    m_nodes.push_back(LightBvhNode());
+    m_parents.push_back(parent);
+
+    if (end - start == 1)
+    {
+        m_nodes[index] = LightBvhNode{lights[start].second, lights[start].first, true};
+        m_light_leaf[lights[start].first] = index;
+        return index;
+    }
+
+    AABB box = lights[start].second.box;
+    Point3 centroid_min = (box.minPoint() + box.maxPoint()) / 2;
+    Point3 centroid_max = centroid_min;
+    for (int i = start + 1; i < end; i++)
+    {
+        AABB light_box = lights[i].second.box;
+        box = AABB::surroundingBox(box, light_box);
+
+        Point3 centroid = (light_box.minPoint() + light_box.maxPoint()) / 2;
+        centroid_min = minValues(centroid_min, centroid);
+        centroid_max = maxValues(centroid_max, centroid);
+    }
+
+    // Find the cheapest split over a few buckets per axis
+    Direction extent = box.maxPoint() - box.minPoint();
+    double max_extent = std::max({extent.x(), extent.y(), extent.z()});
+
+    double best_cost = inf;
+    int best_axis = -1;
+    int best_split = 0;
+
+    LightBounds bounds = {};
+    bool has_bounds = false;
+
+    auto bucketOf = [&](const LightBounds &b, int axis)
+    {
+        double centroid = (b.box.minPoint()[axis] + b.box.maxPoint()[axis]) / 2;
+        double span = centroid_max[axis] - centroid_min[axis];
+        int bucket = LIGHT_BVH_BUCKETS * (centroid - centroid_min[axis]) / span;
+        return std::clamp(bucket, 0, LIGHT_BVH_BUCKETS - 1);
+    };
+
+    // Two lights can only be split one way
+    for (int axis = 0; axis < 3 && end - start > 2; axis++)
+    {
+        if (centroid_max[axis] <= centroid_min[axis])
+            continue;
+
+        LightBounds buckets[LIGHT_BVH_BUCKETS] = {};
+        for (int i = start; i < end; i++)
+        {
+            int b = bucketOf(lights[i].second, axis);
+            buckets[b] = LightBounds::merge(buckets[b], lights[i].second);
+        }
+
+        // The buckets of any axis together hold all lights of this node
+        if (!has_bounds)
+        {
+            for (int b = 0; b < LIGHT_BVH_BUCKETS; b++)
+                bounds = LightBounds::merge(bounds, buckets[b]);
+            has_bounds = true;
+        }
+
+        // Long thin boxes should rather be split along their long side
+        double regularization = extent[axis] > 0 ? max_extent / extent[axis] : 1;
+
+        // Sweep once from each side so every split costs a single merge. A
+        // split right after an empty bucket divides the lights the same way
+        // as the split before it, so its cost is not computed again.
+        double above_cost[LIGHT_BVH_BUCKETS];
+        LightBounds above = {};
+        for (int split = LIGHT_BVH_BUCKETS - 1; split > 0; split--)
+        {
+            above = LightBounds::merge(above, buckets[split]);
+            above_cost[split] = above.power > 0 && buckets[split - 1].power > 0 ? orientationCost(above) : -1;
+        }
+
+        LightBounds below = {};
+        for (int split = 1; split < LIGHT_BVH_BUCKETS; split++)
+        {
+            below = LightBounds::merge(below, buckets[split - 1]);
+            if (above_cost[split] < 0)
+                continue;
+
+            double cost = regularization * (orientationCost(below) + above_cost[split]);
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = split;
+            }
+        }
+    }
+
+    if (!has_bounds)
+    {
+        for (int i = start; i < end; i++)
+            bounds = LightBounds::merge(bounds, lights[i].second);
+    }
+
+    int mid = (start + end) / 2;
+    if (best_axis >= 0)
+    {
+        auto it = std::partition(lights.begin() + start, lights.begin() + end, [&](const auto &light)
+                                 { return bucketOf(light.second, best_axis) < best_split; });
+        mid = it - lights.begin();
+    }
+
+    // All centroids in one place, any split is as good as the other
+    if (mid == start || mid == end)
+        mid = (start + end) / 2;
+
+    build(lights, start, mid, index);
+    int second = build(lights, mid, end, index);
+
+    m_nodes[index] = LightBvhNode{bounds, second, false};
+    return index;
+}
+
+double LightBvh::firstChildProbability(int node, const Point3 &p) const
+{
+    double first = m_nodes[node + 1].bounds.importance(p);
+    double second = m_nodes[m_nodes[node].child_or_light].bounds.importance(p);
+
+    // When neither side looks important, both stay possible so every light
+    // keeps a non zero probability.
+    if (first + second <= 0)
+        return 0.5;
+
+    return first / (first + second);
+}
+
+int LightBvh::sample(const Point3 &p, double u, double &pmf) const
+{
+    int node = 0;
+    pmf = 1;
+
+    while (!m_nodes[node].leaf)
+    {
+        // Reuse the sample for the next level by rescaling the part of it
+        // that was not needed to pick a side.
+        double first = firstChildProbability(node, p);
+        if (u < first)
+        {
+            u = u / first;
+            pmf *= first;
+            node = node + 1;
+        }
+        else
+        {
+            u = (u - first) / (1 - first);
+            pmf *= 1 - first;
+            node = m_nodes[node].child_or_light;
+        }
+
+        u = std::min(u, 1 - 1e-12);
+    }
+
+    return m_nodes[node].child_or_light;
+}
+
+double LightBvh::pmf(const Point3 &p, int light) const
+{
+    int node = m_light_leaf[light];
+    double pmf = 1;
+
+    while (m_parents[node] >= 0)
+    {
+        int parent = m_parents[node];
+        double first = firstChildProbability(parent, p);
+        pmf *= node == parent + 1 ? first : 1 - first;
+        node = parent;
+    }
+
+    return pmf;
+}
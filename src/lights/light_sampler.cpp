@@ -0,0 +1,109 @@
+#include <lights/light_sampler.h>
+#include <hitables/mesh.h>
+#include <materials/material.h>
+
+LightSampler::LightSampler(const std::vector<std::shared_ptr<HitableList>> &lights)
+{
+    std::vector<double> weights;
+    std::vector<LightBounds> bounds;
+    int skipped = 0;
+
+    for (const auto &list : lights)
+    {
+        // The triangles are told their light index through their mesh
+        Mesh *mesh = dynamic_cast<Mesh *>(list.get());
+        for (const auto &object : list->objects())
+        {
+            const Triangle *triangle = dynamic_cast<const Triangle *>(object);
+            if (triangle == nullptr || triangle->mesh() != mesh)
+            {
+                skipped++;
+                continue;
+            }
+
+            EmissiveTriangle tri;
+            tri.p0 = triangle->x();
+            tri.edge1 = triangle->y() - triangle->x();
+            tri.edge2 = triangle->z() - triangle->x();
+
+            Direction n = cross(tri.edge1, tri.edge2);
+            tri.area = n.length() / 2;
+            if (tri.area <= 0)
+                continue;
+            tri.normal = normalize(n);
+
+            // The emission is evaluated at the center of the triangle, this
+            // is only used to pick lights so it does not have to be exact.
+            Color emission = Color(0);
+            Point3 center = tri.p0 + (tri.edge1 + tri.edge2) / 3;
+            triangle->material()->emitted(1.0 / 3, 1.0 / 3, center, emission);
+
+            tri.power = tri.area * luminance(emission);
+            if (tri.power <= 0)
+                continue;
+
+            mesh->setLight(triangle->index(), m_triangles.size());
+            m_triangles.push_back(tri);
+            weights.push_back(tri.power);
+
+            // Pad the box a little, a triangle that lies in an axis plane
+            // would otherwise have a box that no ray can hit.
+            const double e = 0.0001;
+            Point3 p1 = tri.p0 + tri.edge1;
+            Point3 p2 = tri.p0 + tri.edge2;
+            AABB box(minValues(tri.p0, minValues(p1, p2)) - Point3(e, e, e), maxValues(tri.p0, maxValues(p1, p2)) + Point3(e, e, e));
+
+            // The materials emit on both sides of the triangle
+            bounds.push_back(LightBounds{box, tri.normal, 1, 0, tri.power, true});
+        }
+    }
+
+    if (skipped > 0)
+        WARN(skipped << " emissive objects are not triangles of a mesh and are not sampled as lights");
+
+#if LIGHT_BVH
+    m_bvh = LightBvh(bounds);
+#else
+    if (!m_triangles.empty())
+        m_table = AliasTable(weights);
+#endif
+}
+
+Direction LightSampler::sample(const Point3 &origin, double u_light, double u, double v, int &light) const
+{
+#if LIGHT_BVH
+    double pmf;
+    light = m_bvh.sample(origin, u_light, pmf);
+#else
+    light = m_table.sample(u_light);
+#endif
+    const EmissiveTriangle &tri = m_triangles[light];
+
+    // Uniform over the area of the triangle
+    double s = sqrt(u);
+    Point3 p = tri.p0 + s * (1 - v) * tri.edge1 + s * v * tri.edge2;
+
+    return p - origin;
+}
+
+double LightSampler::pdf(const Point3 &origin, const HitRecord &hit) const
+{
+    if (hit.light < 0)
+        return 0;
+
+    // Convert the area density of the light to a density over solid angle
+    // at origin
+    const EmissiveTriangle &tri = m_triangles[hit.light];
+    Direction to_light = hit.p - origin;
+    double distance_squared = to_light.length_squared();
+    double cosine = fabs(dot(to_light, tri.normal)) / sqrt(distance_squared);
+    if (cosine <= 0)
+        return 0;
+
+#if LIGHT_BVH
+    double pmf = m_bvh.pmf(origin, hit.light);
+#else
+    double pmf = m_table.pmf(hit.light);
+#endif
+    return pmf * distance_squared / (tri.area * cosine);
+}
@@ -15,12 +15,17 @@
 #include <textures/checker_texture.h>
 #include <textures/noise_texture.h>
 #include <textures/image_texture.h>
+#include <textures/texture_cache.h>
 
 #include <fileformats/obj.h>
 #include <fileformats/gltf.h>
+#include <fileformats/rts.h>
+
+#include <distributed/worker.h>
 
 #include <argparse/argparse.hpp>
 #include <thread>
+#include <sstream>
 
 void setupGLTFBenchmarkScene(Renderer &renderer, std::string path, int width=800, double aspect_ratio=1, int samples=200)
 {
@@ -33,6 +38,24 @@ void setupGLTFBenchmarkScene(Renderer &renderer, std::string path, int width=800
     gltf.read(renderer.get_scene());
 }
 
+bool hasExtension(const std::string &filename, const std::string &extension)
+{
+    return filename.size() >= extension.size() &&
+           filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+// Scene files are told apart by their extension, anything that is not an
+// OBJ or native scene file is read as glTF
+void loadScene(Scene &scene, std::string path)
+{
+    if (hasExtension(path, ".obj"))
+        Obj(path).read(scene);
+    else if (hasExtension(path, ".rts"))
+        Rts(path).read(scene);
+    else
+        GLTF(path).read(scene);
+}
+
 void loadPreset(Renderer &renderer, std::string preset_name)
 {
     if (preset_name == "fast_cornell_benchmark") 
@@ -56,6 +79,57 @@ void loadPreset(Renderer &renderer, std::string preset_name)
     exit(1);
 }
 
+SamplerType parseSampler(std::string name)
+{
+    if (name == "random")
+        return SamplerType::Random;
+    if (name == "sobol")
+        return SamplerType::Sobol;
+    if (name == "bluenoise")
+        return SamplerType::BlueNoise;
+
+    ERROR("Unknown sampler " << name << ", expected random, sobol or bluenoise");
+    exit(1);
+}
+
+uint32_t parseAovs(std::string names)
+{
+    uint32_t aovs = AOV_NONE;
+    std::stringstream stream(names);
+    std::string name;
+    while (std::getline(stream, name, ','))
+    {
+        bool found = false;
+        for (Aov aov : {AOV_ALBEDO, AOV_NORMAL, AOV_DEPTH, AOV_SAMPLES, AOV_VARIANCE})
+        {
+            if (name == aovName(aov))
+            {
+                aovs |= aov;
+                found = true;
+            }
+        }
+
+        if (!found)
+        {
+            ERROR("Unknown AOV " << name << ", expected albedo, normal, depth, samples or variance");
+            exit(1);
+        }
+    }
+
+    return aovs;
+}
+
+ExrCompression parseExrCompression(std::string name)
+{
+    if (name == "none")
+        return ExrCompression::None;
+    if (name == "zip")
+        return ExrCompression::Zip;
+
+    ERROR("Unknown EXR compression " << name << ", expected none or zip");
+    exit(1);
+}
+
 int main(int argc, char **argv)
 {
     argparse::ArgumentParser program("Raytracer");
@@ -86,11 +160,96 @@ int main(int argc, char **argv)
 
     program.add_argument("-o", "--outfile")
         .default_value(std::string("out.bmp"))
-        .help("specify the file the output image needs to be written to (BMP format)");
+        .help("specify the file the output image needs to be written to (BMP format, or PNG or OpenEXR when the name ends in .png or .exr)");
+
+    program.add_argument("--aov")
+        .help("also render these comma separated AOVs: albedo, normal, depth, samples and variance, every AOV is written next to the output image (or as a layer of an EXR image)");
+
+    program.add_argument("--stream")
+        .default_value(false)
+        .implicit_value(true)
+        .help("render the image in bands that are written to the output file as soon as they are done, so the whole image never has to fit in memory (EXR output only)");
+
+    program.add_argument("--exr-compression")
+        .default_value(std::string("zip"))
+        .help("specify the compression of EXR output: none or zip");
+
+    program.add_argument("--exr-float")
+        .default_value(false)
+        .implicit_value(true)
+        .help("store the color channels of EXR output as 32 bit floats instead of halfs");
 
     program.add_argument("--preset")
         .help("specify a preset to run");
 
+    program.add_argument("--scene")
+        .help("render this scene file (.glb, .obj or .rts) with the given dimensions, samples and bounces");
+
+    program.add_argument("--convert")
+        .nargs(2)
+        .help("convert the scene file IN (.glb or .obj) to the native scene format OUT (.rts) with a prebuilt BVH, and exit");
+
+    program.add_argument("--benchmark-noise")
+        .default_value(false)
+        .implicit_value(true)
+        .help("time lookups of the noise textures and of an image texture, and exit");
+
+    program.add_argument("--texture-cache")
+        .default_value(0)
+        .help("keep image textures in tiles on disk and at most this many MB of them in memory, instead of all of them")
+        .scan<'i', int>();
+
+    program.add_argument("--sampler")
+        .default_value(std::string("sobol"))
+        .help("specify how the sample points are generated: random, sobol (owen scrambled) or bluenoise");
+
+    program.add_argument("--seed")
+        .default_value(0)
+        .help("specify the seed of the render, the same seed and settings always give the same image")
+        .scan<'i', int>();
+
+    program.add_argument("--pass-samples")
+        .default_value(0)
+        .help("render progressively, taking this amount of samples per pixel every pass (0 renders everything in one pass)")
+        .scan<'i', int>();
+
+    program.add_argument("--write-interval")
+        .default_value(0.0)
+        .help("when rendering progressively, write the intermediate image at most every this many seconds (0 writes after every pass)")
+        .scan<'g', double>();
+
+    program.add_argument("--checkpoint")
+        .help("periodically write a checkpoint of the render to this file, it can be continued with --resume");
+
+    program.add_argument("--checkpoint-interval")
+        .default_value(60.0)
+        .help("the minimum amount of seconds between two checkpoints")
+        .scan<'g', double>();
+
+    program.add_argument("--resume")
+        .help("continue the render stored in this checkpoint file, new checkpoints are written to the same file");
+
+    program.add_argument("--workers")
+        .default_value(0)
+        .help("spread the render over this many local worker processes, the threads are divided over the workers")
+        .scan<'i', int>();
+
+    program.add_argument("--worker")
+        .help("run as a worker of the coordinator listening on this socket (used internally by --workers)");
+
+    program.add_argument("--hdri")
+        .help("light the scene with this environment map (radiance .hdr, equirectangular)");
+
+    program.add_argument("--hdri-strength")
+        .default_value(1.0)
+        .help("multiply the brightness of the environment map by this")
+        .scan<'g', double>();
+
+    program.add_argument("--time-budget")
+        .default_value(0.0)
+        .help("stop rendering after this many seconds and write the image rendered so far (0 means no limit)")
+        .scan<'g', double>();
+
     try
     {
         program.parse_args(argc, argv);
@@ -102,6 +261,31 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    if (program.is_used("--convert"))
+    {
+        auto files = program.get<std::vector<std::string>>("--convert");
+        Scene scene;
+        loadScene(scene, files[0]);
+
+        // Only the tree is kept, the first hit cache does not matter
+        BvhManager bvh(scene.getHitableList(), 1, 1, 1);
+        FlatBvh flat = bvh.flatten(scene.getHitableList());
+        if (Rts::write(scene, &flat, files[1]) != 0)
+        {
+            ERROR("Could not write scene file " << files[1]);
+            return 1;
+        }
+
+        OUT("Converted " << files[0] << " to " << files[1]);
+        return 0;
+    }
+
+    if (program.get<bool>("--benchmark-noise"))
+    {
+        benchmarkNoise();
+        return 0;
+    }
+
     Renderer renderer = Renderer();
     
     int samples = program.get<int>("--samples");
@@ -109,9 +293,21 @@ int main(int argc, char **argv)
     int threads = program.get<int>("--threads");
     int width = program.get<int>("--width");
     int height = program.get<int>("--height");
-    auto preset = program.get<std::string>("--preset");
 
     renderer.set_threads(threads);
+    renderer.set_sampler(parseSampler(program.get<std::string>("--sampler")));
+    renderer.set_seed(program.get<int>("--seed"));
+    renderer.set_pass_samples(program.get<int>("--pass-samples"));
+    renderer.set_time_budget(program.get<double>("--time-budget"));
+
+    if (program.present("--checkpoint"))
+        renderer.set_checkpoint(program.get<std::string>("--checkpoint"), program.get<double>("--checkpoint-interval"));
+    if (program.present("--resume"))
+        renderer.set_resume(program.get<std::string>("--resume"));
+
+    int texture_cache_size = program.get<int>("--texture-cache");
+    if (texture_cache_size > 0)
+        texture_cache = std::make_shared<TextureCache>((size_t)texture_cache_size << 20);
 
     if (program.present("--preset"))
     {
@@ -122,11 +318,89 @@ int main(int argc, char **argv)
         renderer.set_dimensions(width, height);
         renderer.set_samples_per_pixel(samples);
         renderer.set_max_bounces(bounces);
+
+        if (program.present("--scene"))
+            loadScene(renderer.get_scene(), program.get<std::string>("--scene"));
     }
 
-    renderer.render();
+    if (program.present("--aov"))
+        renderer.set_aovs(parseAovs(program.get<std::string>("--aov")));
+
+    renderer.set_exr_output(parseExrCompression(program.get<std::string>("--exr-compression")),
+                            !program.get<bool>("--exr-float"));
+
+    if (program.present("--hdri"))
+        renderer.set_environment(program.get<std::string>("--hdri"), program.get<double>("--hdri-strength"));
+
+    if (program.present("--worker"))
+    {
+        Worker worker(program.get<std::string>("--worker"));
+        return worker.run(renderer);
+    }
+
+    int workers = program.get<int>("--workers");
+    if (workers > 0)
+    {
+        // Workers are started with the same scene settings, the rest of the
+        // options (output, checkpoints, ...) are handled by the coordinator.
+        std::vector<std::string> command = {"/proc/self/exe",
+                                            "--threads", std::to_string(std::max(1, threads / workers)),
+                                            "--samples", std::to_string(samples),
+                                            "--bounces", std::to_string(bounces),
+                                            "--width", std::to_string(width),
+                                            "--height", std::to_string(height),
+                                            "--sampler", program.get<std::string>("--sampler"),
+                                            "--texture-cache", std::to_string(texture_cache_size)};
+        if (program.present("--preset"))
+        {
+            command.push_back("--preset");
+            command.push_back(program.get<std::string>("--preset"));
+        }
+        if (program.present("--scene"))
+        {
+            command.push_back("--scene");
+            command.push_back(program.get<std::string>("--scene"));
+        }
+        if (program.present("--hdri"))
+        {
+            command.push_back("--hdri");
+            command.push_back(program.get<std::string>("--hdri"));
+            command.push_back("--hdri-strength");
+            command.push_back(std::to_string(program.get<double>("--hdri-strength")));
+        }
+        if (program.present("--aov"))
+        {
+            command.push_back("--aov");
+            command.push_back(program.get<std::string>("--aov"));
+        }
+
+        renderer.set_workers(workers, command);
+    }
 
     std::string outfile = program.get("--outfile");
-    renderer.writeToFile(outfile);
+    bool stream = program.get<bool>("--stream");
+    if (stream)
+    {
+        // Without a framebuffer of the whole image there is nothing to
+        // render passes into or to checkpoint
+        if (outfile.size() < 4 || outfile.substr(outfile.size() - 4) != ".exr")
+        {
+            ERROR("--stream needs an EXR output file");
+            return 1;
+        }
+        if (program.get<int>("--pass-samples") > 0 || program.present("--checkpoint") || program.present("--resume"))
+        {
+            ERROR("--stream can not be combined with --pass-samples, --checkpoint or --resume");
+            return 1;
+        }
+
+        renderer.set_stream_output(outfile);
+    }
+    else if (program.get<int>("--pass-samples") > 0)
+        renderer.set_intermediate_output(outfile, program.get<double>("--write-interval"));
+
+    renderer.render();
+    if (!stream)
+        renderer.writeToFile(outfile);
     return 0;
 }
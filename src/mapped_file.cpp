@@ -0,0 +1,35 @@
+#include <mapped_file.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(std::string filename)
+{
+    m_fd = ::open(filename.c_str(), O_RDONLY);
+    if (m_fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(m_fd, &st) != 0 || st.st_size == 0)
+        return;
+    m_size = st.st_size;
+
+    void *map = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (map == MAP_FAILED)
+        return;
+
+    // The whole file is going to be used, start reading it in right away
+    madvise(map, m_size, MADV_WILLNEED);
+    m_data = static_cast<const uint8_t *>(map);
+}
+
+MappedFile::~MappedFile()
+{
+    if (m_data != nullptr)
+        munmap((void *)m_data, m_size);
+
+    if (m_fd >= 0)
+        close(m_fd);
+}
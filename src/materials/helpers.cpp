@@ -1,6 +1,7 @@
 #include <vec3.h>
 #include <onb.h>
 #include <random.h>
+#include <sampler.h>
 #include <materials/helpers.h>
 
 Direction reflect(const Direction v, const Direction n)
@@ -102,8 +103,7 @@ Direction sampleGGX(const Direction &view, const Direction &normal, double rough
     Direction n = Direction(0, 0, 1);
 
     // TODO: see https://schuttejoe.github.io/post/ggximportancesamplingpart2/ for better sampler
-    double r0 = randomGen.getDouble();
-    double r1 = randomGen.getDouble();
+    auto [r0, r1] = sampler->get2D();
     double a2 = roughness * roughness;
     double theta = acosf(sqrtf((1 - r0) / ((a2 - 1) * r0 + 1)));
     double phi = 2 * pi * r1;
@@ -20,7 +20,7 @@ bool Lambertian::scatter(const Ray &ray, const HitRecord &rec, Color &attenuatio
         scatter_direction = rec.normal;
 
     scattered = Ray(rec.p, scatter_direction);
-    attenuation = m_texture->value(rec.u, rec.v, rec.p);
+    attenuation = m_texture->filteredValue(rec.u, rec.v, rec.footprint, rec.p);
     return true;
 }
 
@@ -60,7 +60,7 @@ bool Dielectric::scatter(const Ray &ray, const HitRecord &rec, Color &attenuatio
 Color Pbr::color(const Ray &ray, const HitRecord &rec, const Ray &light_ray) const
 {
 
-    const Color base = m_baseColor->value(rec.u, rec.v, rec.p);
+    const Color base = m_baseColor->filteredValue(rec.u, rec.v, rec.footprint, rec.p);
 
     // Metallic materials use the base color as attenuation to the reflected ray.
     // if (m_metallic)
@@ -101,7 +101,7 @@ bool Pbr::scatter(const Ray &ray, const HitRecord &rec, Ray &scatter, Color atte
 
 #if 0
     // TODO this is code duplication
-    const Color base = m_baseColor->value(rec.u, rec.v, rec.p);
+    const Color base = m_baseColor->filteredValue(rec.u, rec.v, rec.footprint, rec.p);
     Color F0 = lerp(Color(0.04), base, m_metallic);
 
     // TODO: what to do with this reflectance
@@ -122,7 +122,7 @@ bool Pbr::scatter(const Ray &ray, const HitRecord &rec, Ray &scatter, Color atte
         scatter_direction = rec.normal;
 
     scattered = Ray(rec.p, scatter_direction);
-    attenuation = m_texture->value(rec.u, rec.v, rec.p);
+    attenuation = m_texture->filteredValue(rec.u, rec.v, rec.footprint, rec.p);
     return true;
 
 #endif
@@ -6,46 +6,110 @@
 #include <pdfs/uniformpdf.h>
 #include <vec3.h>
 #include <pdfs/ggxpdf.h>
+#include <sampler.h>
 
+// The Smith visibility term of GGX for the view or light direction
+static double visibilityGGX(const Direction &n, const Direction &h, const Direction &v_or_l, double roughness)
+{
+    double a = roughness * roughness;
+    double a2 = a * a;
+    double d = dot(n, v_or_l);
+    double nom = dot(h, v_or_l) > 0 ? 1 : 0;
+    double denom = d + sqrt(a2 + (1 - a2) * d * d);
+    return nom / denom;
+}
 
-#define USE_COOK_TORRANCE 0
-
-#if 1
+// The GGX microfacet lobe without its color, n and v are normalized and h
+// is the half vector of v and l
+static double specularLobe(const Direction &n, const Direction &v, const Direction &l, const Direction &h, double roughness)
+{
+    // It does not make sense to get a H that is larger than perpendicular to the view angle
+    // And you also dont want a H that is points down from the normal vector
+    if (dot(v, h) < 0.0 || dot(n, h) < 0.0 || dot(n, l) < 0.0 || dot(n, v) < 0.0)
+        return 0;
 
+    return distributionGGX(n, h, roughness) * (visibilityGGX(n, h, v, roughness) * visibilityGGX(n, h, l, roughness));
+}
 
-bool PBR::scatter(const Ray &ray, const HitRecord &rec, ScatterRecord &scatter) const
+// The density of sampling the GGX distribution of half vectors
+static double specularPdf(const Direction &n, const Direction &v, const Direction &h, double roughness)
 {
-    // TODO: may have to be removed once nan/inf issues are resolved
-    if (m_emission_strength > 0.01) {
-        return false;
-    }
+    return fmax(distributionGGX(n, h, roughness) * dot(n, h) / (4 * dot(v, h)), 0);
+}
 
+template <>
+Color BsdfClosure::eval<BsdfType::Dielectric>(const Ray &in, const HitRecord &rec, const Direction &out) const
+{
+    // Light from below the surface reaches neither lobe
+    Direction n = normalize(rec.normal);
+    double cos_theta = dot(n, out);
+    if (cos_theta < 0)
+        return 0;
 
-    m_brdf.scatter(ray, rec, scatter);
+    Direction v = normalize(-in.direction());
+    Direction h = normalize(v + out);
 
-    return true;
+    Color diffuse = color->filteredValue(rec.u, rec.v, rec.footprint, rec.p) * cos_theta / pi;
+    double specular = specularLobe(n, v, out, h, roughness);
+    return lerp(diffuse, Color(specular), schlickFresnel(0.04, fabs(dot(v, h)))) * cos_theta;
 }
 
-bool PBR::emitted(double u, double v, const Point3 &p, Color &emission) const
+template <>
+Color BsdfClosure::eval<BsdfType::Metal>(const Ray &in, const HitRecord &rec, const Direction &out) const
 {
-    emission = m_emission->value(u, v, p) * m_emission_strength;
+    Direction n = normalize(rec.normal);
+    Direction v = normalize(-in.direction());
+    Direction h = normalize(v + out);
 
-    return true;
+    double specular = specularLobe(n, v, out, h, roughness);
+    if (specular == 0)
+        return 0;
+    return color->filteredValue(rec.u, rec.v, rec.footprint, rec.p) * specular * dot(n, out);
+}
+
+// The fresnel term depends on the outgoing direction, so it can not be
+// used to pick which lobe of a dielectric to sample. Both are sampled
+// equally often.
+template <>
+double BsdfClosure::pdf<BsdfType::Dielectric>(const Ray &in, const HitRecord &rec, const Direction &out) const
+{
+    Direction n = normalize(rec.normal);
+    Direction v = normalize(-in.direction());
+    Direction h = normalize(v + out);
+    return lerp(fmax(dot(out, n) / pi, 0), specularPdf(n, v, h, roughness), 0.5);
 }
 
-Color PBR::eval(const Ray &in, const HitRecord &rec, const ScatterRecord &srec) const 
+template <>
+double BsdfClosure::pdf<BsdfType::Metal>(const Ray &in, const HitRecord &rec, const Direction &out) const
 {
+    Direction n = normalize(rec.normal);
+    Direction v = normalize(-in.direction());
+    return specularPdf(n, v, normalize(v + out), roughness);
+}
 
-    Color out = m_brdf.evaluate(in, rec, srec) * dot(normalize(rec.normal), normalize(srec.scattered_ray.direction()));
+template <>
+Direction BsdfClosure::sample<BsdfType::Dielectric>(const Ray &in, const HitRecord &rec) const
+{
+    if (sampler->get1D() < 0.5)
+        return GGXPDF(in, rec.normal, roughness).generate();
+    return CosinePDF(rec.normal).generate();
+}
 
-    return out;
+template <>
+Direction BsdfClosure::sample<BsdfType::Metal>(const Ray &in, const HitRecord &rec) const
+{
+    return GGXPDF(in, rec.normal, roughness).generate();
 }
-#else
+
 bool PBR::scatter(const Ray &ray, const HitRecord &rec, ScatterRecord &scatter) const
 {
+    // TODO: may have to be removed once nan/inf issues are resolved
+    if (m_emission_strength > 0.01) {
+        return false;
+    }
+
+
     scatter.skip_pdf = false;
-    scatter.pdf = std::make_shared<GGXPDF>(ray, normalize(rec.normal), m_roughness);
-    //scatter.pdf = std::make_shared<CosinePDF>(rec.normal);
 
     return true;
 }
@@ -57,15 +121,28 @@ bool PBR::emitted(double u, double v, const Point3 &p, Color &emission) const
     return true;
 }
 
-Color PBR::eval(const Ray &in, const HitRecord &rec, const ScatterRecord &srec) const 
+Color PBR::eval(const Ray &in, const HitRecord &rec, const Direction &out) const
 {
-    Color base = m_baseColor->value(rec.u, rec.v, rec.p);
+    if (m_bsdf.type == BsdfType::Metal)
+        return m_bsdf.eval<BsdfType::Metal>(in, rec, out);
+    return m_bsdf.eval<BsdfType::Dielectric>(in, rec, out);
+}
 
-    Direction v = normalize(-in.direction());
-    Direction l = normalize(srec.scattered_ray.direction());
-    Direction n = normalize(rec.normal);
+double PBR::pdf(const Ray &in, const HitRecord &rec, const Direction &out) const
+{
+    if (m_bsdf.type == BsdfType::Metal)
+        return m_bsdf.pdf<BsdfType::Metal>(in, rec, out);
+    return m_bsdf.pdf<BsdfType::Dielectric>(in, rec, out);
+}
 
-    return BRDFCookTorrance(v, l, n, m_metallic, m_roughness, base) * dot(n, l);
+Direction PBR::sample(const Ray &in, const HitRecord &rec) const
+{
+    if (m_bsdf.type == BsdfType::Metal)
+        return m_bsdf.sample<BsdfType::Metal>(in, rec);
+    return m_bsdf.sample<BsdfType::Dielectric>(in, rec);
 }
 
-#endif
+Color PBR::albedo(const HitRecord &rec) const
+{
+    return m_baseColor->filteredValue(rec.u, rec.v, rec.footprint, rec.p);
+}
@@ -0,0 +1,431 @@
+#include <png.h>
+#include <deflate.h>
+
+#include <cstring>
+
+#define PNG_FILTER_NONE     0
+#define PNG_FILTER_SUB      1
+#define PNG_FILTER_UP       2
+#define PNG_FILTER_AVERAGE  3
+#define PNG_FILTER_PAETH    4
+
+#define PNG_BYTES_PER_PIXEL 3
+
+static const uint8_t png_signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+
+static uint32_t crc32(const uint8_t *data, size_t size, uint32_t crc = 0)
+{
+    // Four tables handle four bytes per step ("slicing by 4"), table k gives
+    // the CRC of a byte followed by k zero bytes
+    static const std::vector<uint32_t> table = []() {
+        std::vector<uint32_t> table(4 * 256);
+        for (uint32_t n = 0; n < 256; n++)
+        {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        for (int k = 1; k < 4; k++)
+        {
+            for (int n = 0; n < 256; n++)
+            {
+                uint32_t c = table[(k - 1) * 256 + n];
+                table[k * 256 + n] = (c >> 8) ^ table[c & 0xFF];
+            }
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (; size >= 4; data += 4, size -= 4)
+    {
+        // Little endian, the first byte is the lowest
+        uint32_t word;
+        memcpy(&word, data, sizeof(word));
+        crc ^= word;
+        crc = table[3 * 256 + (crc & 0xFF)] ^ table[2 * 256 + ((crc >> 8) & 0xFF)] ^
+              table[256 + ((crc >> 16) & 0xFF)] ^ table[crc >> 24];
+    }
+    for (; size > 0; data++, size--)
+        crc = table[(crc ^ *data) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void putBigEndian(std::vector<uint8_t> &output, uint32_t value)
+{
+    output.push_back(value >> 24);
+    output.push_back(value >> 16);
+    output.push_back(value >> 8);
+    output.push_back(value);
+}
+
+static void putChunk(std::vector<uint8_t> &output, const char *type, const uint8_t *data, size_t size)
+{
+    putBigEndian(output, size);
+    size_t start = output.size();
+    output.insert(output.end(), type, type + 4);
+    output.insert(output.end(), data, data + size);
+
+    // The CRC covers the type and the data
+    putBigEndian(output, crc32(&output[start], size + 4));
+}
+
+static uint8_t paeth(int a, int b, int c)
+{
+    int pa = abs(b - c);
+    int pb = abs(a - c);
+    int pc = abs(a + b - 2 * c);
+    int nearest = pb <= pc ? b : c;
+    return pa <= pb && pa <= pc ? a : nearest;
+}
+
+// Filter a row with the given filter type, prev is the row above it. The
+// first row is filtered against a row of zeros.
+static void filterRow(int type, const uint8_t *row, const uint8_t *prev, size_t size, uint8_t *output)
+{
+    const size_t bpp = PNG_BYTES_PER_PIXEL;
+
+    // The first pixel has no left neighbour, which counts as zero
+    switch (type)
+    {
+    case PNG_FILTER_NONE:
+        memcpy(output, row, size);
+        break;
+    case PNG_FILTER_SUB:
+        memcpy(output, row, bpp);
+        for (size_t i = bpp; i < size; i++)
+            output[i] = row[i] - row[i - bpp];
+        break;
+    case PNG_FILTER_UP:
+        for (size_t i = 0; i < size; i++)
+            output[i] = row[i] - prev[i];
+        break;
+    case PNG_FILTER_AVERAGE:
+        for (size_t i = 0; i < bpp; i++)
+            output[i] = row[i] - prev[i] / 2;
+        for (size_t i = bpp; i < size; i++)
+            output[i] = row[i] - (row[i - bpp] + prev[i]) / 2;
+        break;
+    case PNG_FILTER_PAETH:
+        for (size_t i = 0; i < bpp; i++)
+            output[i] = row[i] - prev[i];
+        for (size_t i = bpp; i < size; i++)
+            output[i] = row[i] - paeth(row[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    }
+}
+
+static uint64_t filterCost(const uint8_t *filtered, size_t size)
+{
+    // The bytes are differences, so small values in both directions are cheap
+    uint64_t cost = 0;
+    for (size_t i = 0; i < size; i++)
+        cost += abs((int8_t)filtered[i]);
+    return cost;
+}
+
+int Png::write(const std::vector<uint8_t> &pixels, std::string filename, int width, int height, int level)
+{
+    std::ofstream output;
+    output.open(filename, std::ios::out | std::ios::binary);
+
+    if (!output.is_open())
+        return -1;
+
+    // Every row starts with its filter type. PNG starts at the top row.
+    size_t row_size = (size_t)width * PNG_BYTES_PER_PIXEL;
+    std::vector<uint8_t> filtered((row_size + 1) * height);
+    std::vector<uint8_t> zeros(row_size, 0);
+
+#pragma omp parallel for
+    for (int y = 0; y < height; y++)
+    {
+        const uint8_t *row = &pixels[(size_t)(height - 1 - y) * row_size];
+        const uint8_t *prev = y > 0 ? &pixels[(size_t)(height - y) * row_size] : zeros.data();
+        uint8_t *out = &filtered[(size_t)y * (row_size + 1)];
+
+        // Stored data does not get any smaller by filtering
+        if (level == 0)
+        {
+            out[0] = PNG_FILTER_NONE;
+            memcpy(&out[1], row, row_size);
+            continue;
+        }
+
+        std::vector<uint8_t> candidate(row_size);
+        uint64_t best_cost = UINT64_MAX;
+        for (int type = PNG_FILTER_NONE; type <= PNG_FILTER_PAETH; type++)
+        {
+            filterRow(type, row, prev, row_size, candidate.data());
+            uint64_t cost = filterCost(candidate.data(), row_size);
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                out[0] = type;
+                memcpy(&out[1], candidate.data(), row_size);
+            }
+        }
+    }
+
+    std::vector<uint8_t> compressed;
+    Deflate::zlibCompress(filtered.data(), filtered.size(), level, compressed);
+
+    // Signature, three chunks with 12 bytes each around their data
+    std::vector<uint8_t> file;
+    file.reserve(sizeof(png_signature) + 3 * 12 + 13 + compressed.size() +
+                 compressed.size() / PNG_MAX_CHUNK_SIZE * 12);
+    file.insert(file.end(), png_signature, png_signature + sizeof(png_signature));
+
+    std::vector<uint8_t> ihdr;
+    putBigEndian(ihdr, width);
+    putBigEndian(ihdr, height);
+    ihdr.push_back(8);  // Bit depth
+    ihdr.push_back(2);  // Color type, RGB
+    ihdr.push_back(0);  // Compression method, deflate
+    ihdr.push_back(0);  // Filter method
+    ihdr.push_back(0);  // No interlacing
+    putChunk(file, "IHDR", ihdr.data(), ihdr.size());
+
+    for (size_t start = 0; start < compressed.size(); start += PNG_MAX_CHUNK_SIZE)
+        putChunk(file, "IDAT", &compressed[start], std::min<size_t>(PNG_MAX_CHUNK_SIZE, compressed.size() - start));
+
+    putChunk(file, "IEND", nullptr, 0);
+
+    output.write((const char *)file.data(), file.size());
+    return output.good() ? 0 : -1;
+}
+
+#define READ_ERR(x)     \
+    do                  \
+    {                   \
+        WARN(x);        \
+        return nullptr; \
+    } while (0);
+
+#define PNG_COLOR_GRAY          0
+#define PNG_COLOR_RGB           2
+#define PNG_COLOR_PALETTE       3
+#define PNG_COLOR_GRAY_ALPHA    4
+#define PNG_COLOR_RGBA          6
+
+static uint32_t getBigEndian(const uint8_t *data)
+{
+    return (uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3];
+}
+
+// Undo the filter of a row in place, prev is the unfiltered row above it
+static bool unfilterRow(int type, uint8_t *row, const uint8_t *prev, size_t size, size_t bpp)
+{
+    switch (type)
+    {
+    case PNG_FILTER_NONE:
+        break;
+    case PNG_FILTER_SUB:
+        for (size_t i = bpp; i < size; i++)
+            row[i] += row[i - bpp];
+        break;
+    case PNG_FILTER_UP:
+        for (size_t i = 0; i < size; i++)
+            row[i] += prev[i];
+        break;
+    case PNG_FILTER_AVERAGE:
+        for (size_t i = 0; i < bpp; i++)
+            row[i] += prev[i] / 2;
+        for (size_t i = bpp; i < size; i++)
+            row[i] += (row[i - bpp] + prev[i]) / 2;
+        break;
+    case PNG_FILTER_PAETH:
+        for (size_t i = 0; i < bpp; i++)
+            row[i] += prev[i];
+        for (size_t i = bpp; i < size; i++)
+            row[i] += paeth(row[i - bpp], prev[i], prev[i - bpp]);
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+std::shared_ptr<LdrImage> Png::read(const uint8_t *data, size_t size)
+{
+    if (size < sizeof(png_signature) || memcmp(data, png_signature, sizeof(png_signature)) != 0)
+        READ_ERR("Could not read PNG image because it has no PNG signature");
+
+    uint32_t width = 0;
+    uint32_t height = 0;
+    int depth = 0;
+    int color_type = 0;
+    bool interlaced = false;
+    std::vector<uint8_t> palette;
+    std::vector<uint8_t> palette_alpha;
+    std::vector<uint8_t> compressed;
+
+    size_t pos = sizeof(png_signature);
+    bool ended = false;
+    while (!ended)
+    {
+        if (size - pos < 12)
+            READ_ERR("Could not read PNG image because it ends early");
+
+        uint32_t length = getBigEndian(&data[pos]);
+        const uint8_t *type = &data[pos + 4];
+        const uint8_t *chunk = &data[pos + 8];
+        if (length > size - pos - 12)
+            READ_ERR("Could not read PNG image because it ends early");
+        if (crc32(type, length + 4) != getBigEndian(chunk + length))
+            READ_ERR("Could not read PNG image because the '" << std::string((const char *)type, 4) << "' chunk is corrupt");
+        pos += length + 12;
+
+        if (memcmp(type, "IHDR", 4) == 0 && length == 13)
+        {
+            width = getBigEndian(chunk);
+            height = getBigEndian(chunk + 4);
+            depth = chunk[8];
+            color_type = chunk[9];
+            interlaced = chunk[12] == 1;
+            if (chunk[10] != 0 || chunk[11] != 0 || chunk[12] > 1)
+                READ_ERR("Could not read PNG image because it uses an unknown compression, filter or interlace method");
+        }
+        else if (memcmp(type, "PLTE", 4) == 0)
+            palette.assign(chunk, chunk + length);
+        else if (memcmp(type, "tRNS", 4) == 0)
+            palette_alpha.assign(chunk, chunk + length);
+        else if (memcmp(type, "IDAT", 4) == 0)
+            compressed.insert(compressed.end(), chunk, chunk + length);
+        else if (memcmp(type, "IEND", 4) == 0)
+            ended = true;
+        else if (!(type[0] & 0x20))
+            READ_ERR("Could not read PNG image because of the unknown critical chunk '" << std::string((const char *)type, 4) << "'");
+    }
+
+    int file_channels;
+    switch (color_type)
+    {
+    case PNG_COLOR_GRAY:
+        file_channels = 1;
+        break;
+    case PNG_COLOR_RGB:
+        file_channels = 3;
+        break;
+    case PNG_COLOR_PALETTE:
+        file_channels = 1;
+        break;
+    case PNG_COLOR_GRAY_ALPHA:
+        file_channels = 2;
+        break;
+    case PNG_COLOR_RGBA:
+        file_channels = 4;
+        break;
+    default:
+        READ_ERR("Could not read PNG image because of the unknown color type " << color_type);
+    }
+
+    bool valid_depth = depth == 8 || depth == 16 ||
+                       ((color_type == PNG_COLOR_GRAY || color_type == PNG_COLOR_PALETTE) && (depth == 1 || depth == 2 || depth == 4));
+    if (width == 0 || height == 0 || width > (1 << 24) || height > (1 << 24) || !valid_depth ||
+        (color_type == PNG_COLOR_PALETTE && (depth == 16 || palette.size() < 3)))
+        READ_ERR("Could not read PNG image because its header is invalid");
+
+    // Transparency of gray and RGB images is a single color key, which is
+    // not worth an extra channel
+    if (color_type != PNG_COLOR_PALETTE)
+        palette_alpha.clear();
+
+    // Interlaced images are stored as seven smaller images (passes) of every
+    // n-th pixel, a plain image is a single pass
+    struct Pass
+    {
+        int x, y, dx, dy;
+    };
+    static const Pass adam7[7] = {{0, 0, 8, 8}, {4, 0, 8, 8}, {0, 4, 4, 8}, {2, 0, 4, 4},
+                                  {0, 2, 2, 4}, {1, 0, 2, 2}, {0, 1, 1, 2}};
+    static const Pass single = {0, 0, 1, 1};
+    const Pass *passes = interlaced ? adam7 : &single;
+    int pass_count = interlaced ? 7 : 1;
+
+    size_t bits_per_pixel = (size_t)depth * file_channels;
+    size_t bpp = std::max<size_t>(1, bits_per_pixel / 8);
+
+    size_t expected = 0;
+    for (int p = 0; p < pass_count; p++)
+    {
+        size_t pass_width = (width - passes[p].x + passes[p].dx - 1) / passes[p].dx;
+        size_t pass_height = (height - passes[p].y + passes[p].dy - 1) / passes[p].dy;
+        if (pass_width > 0 && pass_height > 0)
+            expected += ((pass_width * bits_per_pixel + 7) / 8 + 1) * pass_height;
+    }
+
+    // Deflate does not get better than about 1:1032, a header that claims
+    // more data is broken
+    if (expected / 1032 > compressed.size())
+        READ_ERR("Could not read PNG image because it has less image data than its size needs");
+
+    auto image = std::make_shared<LdrImage>();
+    image->width = width;
+    image->height = height;
+    image->channels = color_type == PNG_COLOR_PALETTE ? (palette_alpha.empty() ? 3 : 4) : file_channels;
+    image->pixels.resize((size_t)width * height * image->channels);
+
+    std::vector<uint8_t> filtered;
+    filtered.reserve(expected);
+    if (!Deflate::zlibDecompress(compressed.data(), compressed.size(), filtered) || filtered.size() < expected)
+        READ_ERR("Could not read PNG image because its image data is corrupt");
+
+    uint8_t *in = filtered.data();
+    for (int p = 0; p < pass_count; p++)
+    {
+        const Pass &pass = passes[p];
+        size_t pass_width = (width - pass.x + pass.dx - 1) / pass.dx;
+        size_t pass_height = (height - pass.y + pass.dy - 1) / pass.dy;
+        if (pass_width == 0 || pass_height == 0)
+            continue;
+
+        size_t row_size = (pass_width * bits_per_pixel + 7) / 8;
+        std::vector<uint8_t> zeros(row_size, 0);
+        const uint8_t *prev = zeros.data();
+
+        for (size_t y = 0; y < pass_height; y++)
+        {
+            uint8_t *row = in + 1;
+            if (!unfilterRow(in[0], row, prev, row_size, bpp))
+                READ_ERR("Could not read PNG image because of the unknown filter type " << (int)in[0]);
+
+            uint8_t *out_row = &image->pixels[((size_t)(pass.y + y * pass.dy) * width) * image->channels];
+            for (size_t x = 0; x < pass_width; x++)
+            {
+                uint8_t *out = out_row + (pass.x + x * pass.dx) * image->channels;
+
+                if (depth <= 8 && file_channels == 1)
+                {
+                    size_t bit = x * depth;
+                    int value = depth == 8 ? row[x] : (row[bit / 8] >> (8 - depth - bit % 8)) & ((1 << depth) - 1);
+                    if (color_type == PNG_COLOR_GRAY)
+                    {
+                        out[0] = value * 255 / ((1 << depth) - 1);
+                        continue;
+                    }
+
+                    // Indices past the palette are an error, libpng shows them as black
+                    size_t entry = (size_t)value * 3;
+                    for (int c = 0; c < 3; c++)
+                        out[c] = entry + 2 < palette.size() ? palette[entry + c] : 0;
+                    if (image->channels == 4)
+                        out[3] = (size_t)value < palette_alpha.size() ? palette_alpha[value] : 255;
+                }
+                else
+                {
+                    // Only the high byte of 16 bit samples is kept
+                    size_t sample_size = depth / 8;
+                    for (int c = 0; c < file_channels; c++)
+                        out[c] = row[(x * file_channels + c) * sample_size];
+                }
+            }
+
+            prev = row;
+            in += row_size + 1;
+        }
+    }
+
+    return image;
+}
@@ -1,14 +1,18 @@
 #include <renderer.h>
 #include <random.h>
+#include <sampler.h>
 #include <bmp.h>
+#include <png.h>
 #include <core.h>
 #include <scene.h>
 #include <config.h>
+#include <hdr.h>
+#include <exr.h>
 
 #include <hitables/hitable.h>
 #include <materials/material.h>
 #include <pdfs/lightpdf.h>
-#include <pdfs/mixturepdf.h>
+#include <textures/texture_cache.h>
 
 #include <omp.h>
 
@@ -21,17 +25,39 @@ void Renderer::set_dimensions(int width, int height)
 {
     m_width = width;
     m_height = height;
+}
+
+void Renderer::set_aovs(uint32_t aovs)
+{
+    m_aovs = aovs;
+}
 
-    m_screen_buf = std::make_unique<ColorArray>(width, height);
+void Renderer::set_exr_output(ExrCompression compression, bool half)
+{
+    m_exr_compression = compression;
+    m_exr_half = half;
 }
 
 void Renderer::generate_bvh()
 {
     auto start_chrono = std::chrono::high_resolution_clock::now();
-    m_world = BvhManager(m_scene.getHitableList(), m_width, m_height, m_samples_per_pixel);
+    std::shared_ptr<const FlatBvh> bvh = m_scene.getBvh();
+    if (bvh)
+        m_world = BvhManager(m_scene.getHitableList(), *bvh, m_width, m_height, m_samples_per_pixel);
+    else
+        m_world = BvhManager(m_scene.getHitableList(), m_width, m_height, m_samples_per_pixel);
     auto stop_chrono = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop_chrono - start_chrono);
     OUT("BVH generation done, took: " << (double)duration.count() / 1000 << " seconds");
+
+    start_chrono = std::chrono::high_resolution_clock::now();
+    m_lights = LightSampler(m_scene.getLightList());
+    stop_chrono = std::chrono::high_resolution_clock::now();
+    duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop_chrono - start_chrono);
+    OUT("Sampling " << m_lights.size() << " emissive triangles as lights");
+#if LIGHT_BVH
+    OUT("Light BVH generation done, took: " << (double)duration.count() / 1000 << " seconds");
+#endif
 }
 
 void Renderer::set_background_color(Color bg)
@@ -39,6 +65,19 @@ void Renderer::set_background_color(Color bg)
     m_background = bg;
 }
 
+void Renderer::set_environment(std::string file, double strength)
+{
+    std::shared_ptr<HdrImage> image = Hdr::read(file);
+    if (!image)
+    {
+        ERROR("Could not load environment map " << file);
+        exit(1);
+    }
+
+    m_environment = std::make_shared<EnvironmentMap>(image, strength);
+    OUT("Environment map: " << file << " (" << image->width << "x" << image->height << ")");
+}
+
 void Renderer::set_threads(int threads)
 {
     m_thread_amount = threads;
@@ -54,40 +93,162 @@ void Renderer::set_max_bounces(int max_bounces)
     m_max_bounces = max_bounces;
 }
 
-Color Renderer::rayColor(const Ray &r, int bounces, int x, int y, int sample)
+void Renderer::set_sampler(SamplerType type)
+{
+    m_sampler_type = type;
+}
+
+void Renderer::set_seed(uint32_t seed)
+{
+    m_seed = seed;
+}
+
+void Renderer::set_pass_samples(int samples)
+{
+    m_pass_samples = samples;
+}
+
+void Renderer::set_time_budget(double seconds)
+{
+    m_time_budget = seconds;
+}
+
+void Renderer::set_intermediate_output(std::string file, double interval)
+{
+    m_intermediate_file = file;
+    m_write_interval = interval;
+}
+
+void Renderer::set_stream_output(std::string file)
+{
+    m_stream_file = file;
+}
+
+void Renderer::set_checkpoint(std::string file, double interval)
+{
+    m_checkpoint_file = file;
+    m_checkpoint_interval = interval;
+}
+
+void Renderer::set_workers(int workers, std::vector<std::string> command)
+{
+    m_worker_amount = workers;
+    m_worker_command = command;
+}
+
+void Renderer::set_resume(std::string file)
+{
+    m_checkpoint_file = file;
+    m_resume = true;
+}
+
+int Renderer::setupCheckpoint()
+{
+    if (m_resume)
+    {
+        m_checkpoint = Checkpoint::open(m_checkpoint_file);
+        if (!m_checkpoint)
+            exit(1);
+
+        if (m_checkpoint->width() != m_width || m_checkpoint->height() != m_height)
+        {
+            ERROR("Checkpoint '" << m_checkpoint_file << "' is for a " << m_checkpoint->width() << "x"
+                                 << m_checkpoint->height() << " image, not " << m_width << "x" << m_height);
+            exit(1);
+        }
+
+        if (m_checkpoint->aovs() != m_aovs)
+        {
+            ERROR("Checkpoint '" << m_checkpoint_file << "' was rendered with other AOVs");
+            exit(1);
+        }
+
+        // The samples that are still missing have to continue the same sequences
+        m_seed = m_checkpoint->seed();
+        OUT("Resuming from checkpoint at " << m_checkpoint->samplesDone() << " samples per pixel");
+    }
+    else
+    {
+        m_checkpoint = Checkpoint::create(m_checkpoint_file, m_width, m_height, m_aovs, m_samples_per_pixel, m_seed);
+        if (!m_checkpoint)
+            exit(1);
+    }
+
+    // From now on all samples are accumulated straight into the checkpoint file
+    m_framebuffer = m_checkpoint->buffer();
+    return m_checkpoint->samplesDone();
+}
+
+bool Renderer::deadlineReached() const
+{
+    return m_time_budget > 0 && std::chrono::steady_clock::now() >= m_deadline;
+}
+
+static double misWeight(double pdf, double other_pdf)
+{
+#if MIS_POWER_HEURISTIC
+    pdf *= pdf;
+    other_pdf *= other_pdf;
+#endif
+    return pdf / (pdf + other_pdf);
+}
+
+Color Renderer::missColor(const Ray &r, double scatter_pdf)
+{
+    if (!m_environment)
+        return m_background;
+
+    // Like the emissive triangles the environment is also sampled directly
+    Direction dir = normalize(r.direction());
+    Color color = m_environment->value(dir);
+    if (scatter_pdf > 0)
+        color *= misWeight(scatter_pdf, LightPDF(r.origin(), m_lights, m_environment.get()).value(dir, nullptr));
+
+    return color;
+}
+
+Color Renderer::rayColor(const Ray &r, int bounces, int x, int y, int sample, double scatter_pdf, AovSample *aov)
 {
     if (bounces == m_max_bounces)
         return Color(0);
 
     // If we do not hit anything with this ray, we return the background color / texture
     HitRecord rec;
+    bool hit;
 #if BVH_FIRST_HIT_CACHING
     if (bounces == 0)
-    {
-        if (!m_world.cachedHit(x, y, sample, r, RAY_NEAR_CLIP, RAY_FAR_CLIP, rec))
-        {
-            // TODO: implement HDRI
-            return m_background;
-        }
-    }
+        hit = m_world.cachedHit(x, y, r, RAY_NEAR_CLIP, RAY_FAR_CLIP, rec);
     else
 #endif
+        hit = m_world.hit(r, RAY_NEAR_CLIP, RAY_FAR_CLIP, rec);
+
+    if (!hit)
     {
-        if (!m_world.hit(r, RAY_NEAR_CLIP, RAY_FAR_CLIP, rec))
-        {
-            // TODO: implement HDRI
-            return m_background;
-        }
+        Color background = missColor(r, scatter_pdf);
+        if (aov)
+            aov->albedo = background;
+        return background;
+    }
+
+    if (aov)
+    {
+        aov->albedo = rec.mat->albedo(rec);
+        aov->normal = rec.normal;
+        aov->depth = rec.t * r.direction().length();
     }
 
     // We did hit an object, now we calculate its color based on its material, the lights in the scene etc
-    Ray scattered;
 
     // The emitted function returns the amount of emission the material has,
     // if this is none, we assume the output variable is not changed and thus stays 0
     Color output = Color(0);
     rec.mat->emitted(rec.u, rec.v, rec.p, output);
 
+    // A light hit by sampling the material at the previous bounce could also
+    // have been picked by the light sampling there, both share its light.
+    if (scatter_pdf > 0 && hasLights() && !output.isNearZero())
+        output *= misWeight(scatter_pdf, LightPDF(r.origin(), m_lights, m_environment.get()).value(normalize(r.direction()), &rec));
+
     // Scatter the ray to calculate the next ray
     ScatterRecord srec;
     if (!rec.mat->scatter(r, rec, srec))
@@ -95,42 +256,65 @@ Color Renderer::rayColor(const Ray &r, int bounces, int x, int y, int sample)
         return output;
     }
 
-    double pdf_sample;
+    // The cones of the next rays start where this one hit, they keep its
+    // spread as if the surface was flat
+    double cone_width = r.coneWidth(rec.t);
+
     if (srec.skip_pdf)
     {
-        scattered = srec.scattered_ray;
-        pdf_sample = 1;
+        Direction scattered_dir = normalize(srec.scattered_ray.direction());
+        Ray scattered(srec.scattered_ray.origin(), scattered_dir, cone_width, r.coneSpread());
+        Color sample_eval = rec.mat->eval(r, rec, scattered_dir);
+        output += sample_eval * rayColor(scattered, bounces + 1, x, y, sample, 0);
+        return clamp(output, 0, MAX_SAMPLE_OUTPUT_COLOR);
     }
-    else
-    {
-        // Evaluate the PDF to find the scatter direction
-
-        auto light_pdf = std::make_shared<LightPDF>(rec.p, m_scene.getLightList().front());
-        auto pdf = std::make_shared<MixturePDF>(0.5, srec.pdf, light_pdf);
-        Direction dir = normalize(pdf->generate());
-        scattered = Ray(rec.p, dir);
-        pdf_sample = pdf->value(dir);
-
-        srec.scattered_ray = scattered;
 
-        // If an extreme PDF value occurs it causes extreme values in the pixel
-        // due to divisions by a very small number, in theory a good monte carlo
-        // simulation would still filter these out, however, the precision of
-        // computers is holding us back here and we have to create some form of
-        // cutoff to make sure we dont cause these extreme pixels.
-
-        // This tends to happen when a bad direction is chosen by the LightPDF
-        // which causes some epsilon somewhere to claim the ray does not hit the
-        // sampled light, which then causes a 0 probability.
+    // Sample a direction towards the lights, the light found this way is
+    // weighted against the chance of sampling it through the material. A
+    // light hit at the last bounce would not be counted by the material
+    // sample either, so stop sampling the lights there as well.
+    if (hasLights() && bounces + 1 < m_max_bounces)
+    {
+        LightPDF light_pdf(rec.p, m_lights, m_environment.get());
+        int light;
+        Direction dir = normalize(light_pdf.generate(light));
+
+        // The light only arrives when the shadow ray hits the light that was
+        // picked, a light in front of it is counted by its own samples
+        Color emission = Color(0);
+        double pdf_light = 0;
+        HitRecord light_rec;
+        if (m_world.hit(Ray(rec.p, dir), RAY_NEAR_CLIP, RAY_FAR_CLIP, light_rec))
+        {
+            if (light >= 0 && light_rec.light == light)
+            {
+                light_rec.mat->emitted(light_rec.u, light_rec.v, light_rec.p, emission);
+                pdf_light = light_pdf.value(dir, &light_rec);
+            }
+        }
+        else if (light < 0)
+        {
+            emission = m_environment->value(dir);
+            pdf_light = light_pdf.value(dir, nullptr);
+        }
 
-        if (pdf_sample < 0.001)
+        if (pdf_light > 0 && !emission.isNearZero())
         {
-            pdf_sample = 1;
+            Color sample_eval = rec.mat->eval(r, rec, dir);
+            if (!sample_eval.isNearZero())
+                output += sample_eval * emission * misWeight(pdf_light, rec.mat->pdf(r, rec, dir)) / pdf_light;
         }
     }
 
-    Color sample_eval = rec.mat->eval(r, rec, srec);
-    output += (sample_eval * rayColor(scattered, bounces + 1, x, y, sample)) / pdf_sample;
+    // Continue the path in a direction sampled from the material
+    Direction dir = normalize(rec.mat->sample(r, rec));
+    double pdf_sample = rec.mat->pdf(r, rec, dir);
+    if (pdf_sample > 0)
+    {
+        Color sample_eval = rec.mat->eval(r, rec, dir);
+        if (!sample_eval.isNearZero())
+            output += (sample_eval * rayColor(Ray(rec.p, dir, cone_width, r.coneSpread()), bounces + 1, x, y, sample, pdf_sample)) / pdf_sample;
+    }
 
     // Clamp the output value to reduce fireflies. This technique is not great because
     // it introduces bias, but it does work
@@ -139,102 +323,194 @@ Color Renderer::rayColor(const Ray &r, int bounces, int x, int y, int sample)
     return output;
 }
 
-void Renderer::renderPixel(ColorArray *array, int x, int y)
+void Renderer::renderPixel(const Framebuffer &target, Framebuffer *buffer, int x, int y, int sample_start, int sample_end)
 {
+    // A pixel can already be ahead of the pass when a render is resumed from a
+    // checkpoint that was made in the middle of a pass, only take the missing samples.
+    sample_start = std::max(sample_start, target.samples(x, y));
+    if (sample_start >= sample_end)
+        return;
+
     Color pixel_color;
-    for (int s = 0; s < m_samples_per_pixel; ++s)
+    AovSample pixel_aovs;
+    const Camera &camera = m_scene.getCamera();
+    const double spread = camera.pixelSpread(m_height);
+    for (int s = sample_start; s < sample_end; ++s)
     {
-        double x_coord = ((double)x + randomGen.getDouble()) / (m_width - 1);
-        double y_coord = ((double)y + randomGen.getDouble()) / (m_height - 1);
-        const Ray r = m_scene.getCamera().sendRay(x_coord, y_coord);
-        pixel_color += rayColor(r, 0, x, y, s);
-    }
-    Color linear_color = pixel_color / m_samples_per_pixel;
-    Color gamma_corrected = pow(linear_color, 1.0 / 2.2);
-    array->at(x)[y] = clamp(gamma_corrected, 0.0, 1.0);
-}
+        sampler->startPixelSample(x, y, s);
 
-#if THREADING_IMPLEMENTATION == THREAD_IMPL_NAIVE
+        // Anything along the path that does not go through the sampler still
+        // gets random numbers that only depend on the pixel sample.
+        randomGen = RandomGenerator(sampler->sampleKey());
 
-void Renderer::calcProgress(double *percentages)
-{
-    double cnt = 0;
-    while (cnt < 1.0)
-    {
-        cnt = 0;
-        for (int i = 0; i < m_thread_amount; i++)
+        auto [jitter_x, jitter_y] = sampler->get2D();
+        double x_coord = ((double)x + jitter_x) / (m_width - 1);
+        double y_coord = ((double)y + jitter_y) / (m_height - 1);
+        const Ray r = camera.sendRay(x_coord, y_coord, spread);
+
+        if (m_aovs == AOV_NONE)
         {
-            cnt += percentages[i];
+            pixel_color += rayColor(r, 0, x, y, s, 0);
+            continue;
         }
 
-        cnt /= m_thread_amount;
-
-        OUT(cnt * 100 << "% completed");
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        AovSample aov;
+        Color color = rayColor(r, 0, x, y, s, 0, &aov);
+        aov.squared = color * color;
+        pixel_color += color;
+        pixel_aovs += aov;
     }
+
+    // The buffer keeps the linear sum, gamma correction happens once the
+    // image is resolved.
+    buffer->add(x, y, pixel_color, sample_end - sample_start);
+    if (m_aovs != AOV_NONE)
+        buffer->add(x, y, pixel_aovs);
+    m_rendered_samples += sample_end - sample_start;
 }
 
-void Renderer::renderThread(ColorArray *buffer, int thread_idx, double *percentages)
+#if THREADING_IMPLEMENTATION == THREAD_IMPL_NAIVE
+
+void Renderer::renderThread(Framebuffer *target, Framebuffer *buffer, int thread_idx, RenderWorkBlock region, bool *complete)
 {
-    int work = m_height / m_thread_amount;
+    int height = region.y_end - region.y;
+    int work = height / m_thread_amount;
     int extra = 0;
 
-    randomGen = RandomGenerator();
+    sampler = Sampler::create(m_sampler_type, m_seed);
 
     if (thread_idx == m_thread_amount - 1)
-        extra = (m_height - work * m_thread_amount);
+        extra = (height - work * m_thread_amount);
 
-    for (int j = work * thread_idx; j < work * thread_idx + work + extra; ++j)
+    int start = region.y + work * thread_idx;
+    int end = start + work + extra;
+#if USE_COLOR_BUFFER_PER_THREAD
+    buffer->setRegion(region.x, start, 0, 0);
+#endif
+
+    for (int j = start; j < end; ++j)
     {
-        percentages[thread_idx] = (double)(j - work * thread_idx) / (work + extra);
+        if (deadlineReached())
+        {
+            *complete = false;
+            break;
+        }
+
+#if USE_COLOR_BUFFER_PER_THREAD
+        // The band of a thread is rendered as tiles of WORK_SQUARE_SIZE rows,
+        // the bands do not overlap so they can be merged at the same time.
+        if ((j - start) % WORK_SQUARE_SIZE == 0)
+        {
+            target->merge(*buffer);
+            buffer->setRegion(region.x, j, region.x_end - region.x, std::min(WORK_SQUARE_SIZE, end - j));
+        }
+#endif
 
-        for (int i = 0; i < m_width; ++i)
+        for (int i = region.x; i < region.x_end; ++i)
         {
-            renderPixel(buffer, i, j);
+            renderPixel(*target, buffer, i, j, region.sample_start, region.sample_end);
         }
     }
-    OUT("thread " << thread_idx << " has finished");
+
+#if USE_COLOR_BUFFER_PER_THREAD
+    target->merge(*buffer);
+#endif
 }
 
 #endif
 
 #if THREADING_IMPLEMENTATION == THREAD_IMPL_OPENMP_BLOCKS
 
-void Renderer::renderBlock(ColorArray *buffer, RenderWorkBlock work)
+void Renderer::renderBlock(const Framebuffer &target, Framebuffer *buffer, RenderWorkBlock work)
 {
     for (int y = work.y; y < work.y_end; ++y)
     {
         for (int x = work.x; x < work.x_end; ++x)
         {
-            renderPixel(buffer, x, y);
+            renderPixel(target, buffer, x, y, work.sample_start, work.sample_end);
         }
     }
 }
 
 #endif
 
-int Renderer::render()
+bool Renderer::renderPass(RenderWorkBlock region, Framebuffer &target)
 {
-    // First generate the acceleration structure
-    generate_bvh();
+    if (m_coordinator)
+    {
+        // Hand out the pass as tiles to the worker processes
+        std::vector<RenderWorkBlock> jobs;
+        for (int y = region.y; y < region.y_end; y += DISTRIBUTED_TILE_SIZE)
+        {
+            for (int x = region.x; x < region.x_end; x += DISTRIBUTED_TILE_SIZE)
+            {
+                int x_end = std::min(x + DISTRIBUTED_TILE_SIZE, region.x_end);
+                int y_end = std::min(y + DISTRIBUTED_TILE_SIZE, region.y_end);
+                jobs.push_back(RenderWorkBlock{x, y, x_end, y_end, region.sample_start, region.sample_end});
+            }
+        }
 
-    OUT("Rendering on " << m_thread_amount << " threads");
-    OUT("Image size: " << m_width << "x" << m_height);
-    OUT("Samples per pixel: " << m_samples_per_pixel);
-    OUT("Maximum ray bounces " << m_max_bounces);
+        return m_coordinator->render(jobs, target, m_rendered_samples, [this]()
+                                     { return deadlineReached(); });
+    }
 
-    auto start_chrono = std::chrono::high_resolution_clock::now();
+    return renderRegion(region, target);
+}
 
-#if USE_COLOR_BUFFER_PER_THREAD
-    std::vector<std::unique_ptr<ColorArray>> buffers;
-    for (int i = 0; i < m_thread_amount; i++)
+int Renderer::renderStreamed()
+{
+    ExrWriter writer(m_stream_file, m_width, m_height, m_aovs, m_exr_compression, m_exr_half);
+    if (!writer.isOpen())
     {
-        buffers.push_back(std::make_unique<ColorArray>(m_width, m_height));
+        ERROR("Could not open '" << m_stream_file << "'");
+        exit(1);
     }
+
+    // Bands are whole chunks of the file, the file starts at the top row
+    int lines_per_chunk = writer.linesPerChunk();
+    int band_height = (STREAM_BAND_HEIGHT + lines_per_chunk - 1) / lines_per_chunk * lines_per_chunk;
+
+    // Only this band is in memory, it takes all its samples at once. Once
+    // the deadline passes the rest of the bands stay black, the file is
+    // still complete.
+    Framebuffer band(0, 0, 0, 0, m_aovs);
+    bool complete = true;
+    for (int y_end = m_height; y_end > 0; y_end -= band_height)
+    {
+        int y = std::max(0, y_end - band_height);
+        band.setRegion(0, y, m_width, y_end - y);
+
+        complete &= renderPass(RenderWorkBlock{0, y, m_width, y_end, 0, m_samples_per_pixel}, band);
+
+        if (!writer.writeBand(band))
+        {
+            ERROR("Could not write to '" << m_stream_file << "'");
+            exit(1);
+        }
+    }
+
+    if (!writer.close())
+    {
+        ERROR("Could not write to '" << m_stream_file << "'");
+        exit(1);
+    }
+
+    return complete ? m_samples_per_pixel : 0;
+}
+
+bool Renderer::renderRegion(RenderWorkBlock region, Framebuffer &target)
+{
+    // Whether every pixel got its samples, a pass can be cut short by the deadline
+    bool complete = true;
+
+#if USE_COLOR_BUFFER_PER_THREAD
+    // The tile buffers only grow to the largest tile a thread renders, so
+    // they take up O(threads * tile) memory instead of an image per thread.
+    while ((int)m_thread_bufs.size() < m_thread_amount)
+        m_thread_bufs.push_back(std::make_unique<Framebuffer>(0, 0, 0, 0, m_aovs));
 #endif
 
 #if THREADING_IMPLEMENTATION == THREAD_IMPL_NAIVE
-    double *percentages = new double[m_thread_amount];
 
     // This multithreading approach is not great, we divide the work in
     // 'm_thread_amount' parts and this means that some threads will finish
@@ -243,86 +519,87 @@ int Renderer::render()
     // would be to queue the work in smaller parts and feed the threads like that
     // but this will do for now.
     std::thread *threads = new std::thread[m_thread_amount];
+    bool *thread_complete = new bool[m_thread_amount];
     for (int i = 0; i < m_thread_amount; i++)
     {
+        thread_complete[i] = true;
 
 #if USE_COLOR_BUFFER_PER_THREAD
-        ColorArray *buffer = buffers[i].get();
+        Framebuffer *buffer = m_thread_bufs[i].get();
 #else
-        ColorArray *buffer = m_screen_buf.get();
+        Framebuffer *buffer = &target;
 #endif
 
-        threads[i] = std::thread(&Renderer::renderThread, this, buffer, i, percentages);
+        threads[i] = std::thread(&Renderer::renderThread, this, &target, buffer, i, region, &thread_complete[i]);
     }
 
-#if ENABLE_PROGRESS_INDICATOR
-    // Display the progress
-    std::thread(&Renderer::calcProgress, this, percentages).detach();
-#endif
-
     for (int i = 0; i < m_thread_amount; i++)
     {
         threads[i].join();
+        complete &= thread_complete[i];
     }
 
-    delete[] percentages;
     delete[] threads;
+    delete[] thread_complete;
 
 #endif
 
 #if THREADING_IMPLEMENTATION == THREAD_IMPL_OPENMP_BLOCKS
 
     // Divide the work up into squares of computation and create a
-    // queue where threads can take work out of
+    // queue where threads can take work out of. The squares are widened to
+    // whole cache lines of the target, so two threads never write the same
+    // line.
+
+    int line = target.lineWidth();
+    int block_width = (WORK_SQUARE_SIZE + line - 1) / line * line;
 
     std::queue<RenderWorkBlock> work;
-    for (int x = 0; x < m_width; x += WORK_SQUARE_SIZE)
+    for (int x = region.x; x < region.x_end;)
     {
-        for (int y = 0; y < m_height; y += WORK_SQUARE_SIZE)
+        // A region that does not start on a line starts with a narrower block
+        int x_end = std::min(target.x() + ((x - target.x()) / block_width + 1) * block_width, region.x_end);
+        for (int y = region.y; y < region.y_end; y += WORK_SQUARE_SIZE)
         {
-            int width = x + WORK_SQUARE_SIZE >= m_width ? (m_width - x - 1) : WORK_SQUARE_SIZE;
-            int height = y + WORK_SQUARE_SIZE >= m_height ? (m_height - y - 1) : WORK_SQUARE_SIZE;
+            int y_end = std::min(y + WORK_SQUARE_SIZE, region.y_end);
 
-            work.push(RenderWorkBlock{x, y, x + width, y + height});
+            work.push(RenderWorkBlock{x, y, x_end, y_end, region.sample_start, region.sample_end});
         }
+        x = x_end;
     }
 
-    int total_work = work.size();
     RenderWorkQueue work_queue(work);
 
-#if ENABLE_PROGRESS_INDICATOR
-    std::thread progress([&]()
-                         {
-        int size = work_queue.size();
-        while ((size = work_queue.size()) != 0)
-        {
-            OUT((1 - (double)size / total_work)*100 << "% completed");
-            std::this_thread::sleep_for(std::chrono::milliseconds(3000));
-        } });
-    progress.detach();
-#endif
-
-    // Launch some parallel instances of the raytracing algorithm
+    // Launch some parallel instances of the raytracing algorithm, every
+    // thread has its own copy of complete that are combined at the end
     omp_set_num_threads(m_thread_amount);
-#pragma omp parallel
+#pragma omp parallel reduction(&&:complete)
     {
-        // Initialize the random generator for each thread
-        // This randomgen is stored in thread local storage.-
-        randomGen = RandomGenerator();
+        // Initialize the sampler for each thread
+        // This sampler is stored in thread local storage.
+        sampler = Sampler::create(m_sampler_type, m_seed);
 
+        // Once the deadline has passed we stop taking new work, blocks that
+        // are already being rendered are finished so every pixel stays valid.
         std::optional<RenderWorkBlock> work = work_queue.pop();
         while (work.has_value())
         {
+            if (deadlineReached())
+            {
+                complete = false;
+                break;
+            }
 
 #if USE_COLOR_BUFFER_PER_THREAD
-            int thread = omp_get_thread_num();
-            ColorArray *buffer = buffers[thread].get();
+            // The tiles do not overlap, so they can be merged at the same time
+            Framebuffer *buffer = m_thread_bufs[omp_get_thread_num()].get();
+            buffer->setRegion(work->x, work->y, work->x_end - work->x, work->y_end - work->y);
+            renderBlock(target, buffer, work.value());
+            target.merge(*buffer);
 #else
-            ColorArray *buffer = m_screen_buf.get();
+            renderBlock(target, &target, work.value());
 #endif
 
-            renderBlock(buffer, work.value());
-
             work = work_queue.pop();
         }
     }
@@ -332,39 +609,151 @@ int Renderer::render()
 #if THREADING_IMPLEMENTATION == THREAD_IMPL_OPENMP_PER_PIXEL
 
     omp_set_num_threads(m_thread_amount);
+#pragma omp parallel
+    {
+        sampler = Sampler::create(m_sampler_type, m_seed);
+    }
+
 #pragma omp parallel for collapse(2)
-    for (int y = 0; y < m_height; ++y)
+    for (int y = region.y; y < region.y_end; ++y)
     {
-        for (int x = 0; x < m_width; ++x)
+        for (int x = region.x; x < region.x_end; ++x)
         {
-
-#if USE_COLOR_BUFFER_PER_THREAD
-            int thread = omp_get_thread_num();
-            ColorArray *buffer = buffers[thread].get();
-#else
-            ColorArray *buffer = m_screen_buf.get();
-#endif
-
-            renderPixel(buffer, x, y);
+            // Every pixel is written once, a tile per thread would not save anything
+            renderPixel(target, &target, x, y, region.sample_start, region.sample_end);
         }
     }
 
 #endif
 
-#if USE_COLOR_BUFFER_PER_THREAD
-    // Merge the final buffers
-    for (int x = 0; x < m_width; x++)
+    return complete;
+}
+
+int Renderer::render()
+{
+    // The time budget also includes building the acceleration structure
+    m_deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(static_cast<long>(m_time_budget * 1000));
+
+    // A resumed render takes its seed from the checkpoint, so this has to
+    // happen before the workers are started.
+    int samples_done = 0;
+    if (!m_checkpoint_file.empty())
+        samples_done = setupCheckpoint();
+    else if (m_stream_file.empty())
+        m_framebuffer = std::make_unique<Framebuffer>(m_width, m_height, m_aovs);
+
+    if (m_worker_amount > 0)
+    {
+        // The workers build their own acceleration structure
+        std::vector<std::string> command = m_worker_command;
+        command.push_back("--seed");
+        command.push_back(std::to_string(m_seed));
+
+        m_coordinator = std::make_unique<Coordinator>(command);
+        if (!m_coordinator->start(m_worker_amount, m_width, m_height, m_aovs))
+            exit(1);
+
+        OUT("Rendering on " << m_coordinator->workers() << " worker processes");
+    }
+    else
     {
-        for (int y = 0; y < m_height; y++)
+        // First generate the acceleration structure
+        generate_bvh();
+    }
+
+    OUT("Rendering on " << m_thread_amount << " threads");
+    OUT("Image size: " << m_width << "x" << m_height);
+    OUT("Samples per pixel: " << m_samples_per_pixel);
+    OUT("Maximum ray bounces " << m_max_bounces);
+    OUT("Seed: " << m_seed);
+
+    if (m_pass_samples > 0)
+        OUT("Samples per pass: " << m_pass_samples);
+    if (m_time_budget > 0)
+        OUT("Time budget: " << m_time_budget << " seconds");
+
+    auto start_chrono = std::chrono::high_resolution_clock::now();
+
+    m_rendered_samples = (long)samples_done * m_width * m_height;
+    std::atomic<bool> finished = false;
+
+#if ENABLE_PROGRESS_INDICATOR
+    // Display the progress over all passes
+    std::thread progress([&]()
+                         {
+        const double total = (double)m_width * m_height * m_samples_per_pixel;
+        auto last_report = std::chrono::steady_clock::now();
+        while (!finished)
         {
-            for (auto &&buf : buffers)
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            if (std::chrono::steady_clock::now() - last_report >= std::chrono::milliseconds(3000))
             {
-                m_screen_buf->at(x)[y] += buf->at(x)[y];
+                OUT(m_rendered_samples / total * 100 << "% completed");
+                last_report = std::chrono::steady_clock::now();
             }
+        } });
+#endif
+
+    int pass_samples = m_pass_samples > 0 ? m_pass_samples : m_samples_per_pixel;
+    auto last_write = std::chrono::steady_clock::now();
+    auto last_checkpoint = std::chrono::steady_clock::now();
+
+    // A streamed render takes all samples of a band at once and has no
+    // framebuffer to render passes into
+    bool streamed = !m_stream_file.empty();
+    if (streamed)
+        samples_done = renderStreamed();
+
+    while (!streamed && samples_done < m_samples_per_pixel)
+    {
+        int pass_end = std::min(samples_done + pass_samples, m_samples_per_pixel);
+        if (!renderPass(RenderWorkBlock{0, 0, m_width, m_height, samples_done, pass_end}, *m_framebuffer))
+            break;
+
+        samples_done = pass_end;
+        auto now = std::chrono::steady_clock::now();
+
+        if (m_checkpoint && now - last_checkpoint >= std::chrono::milliseconds(static_cast<long>(m_checkpoint_interval * 1000)))
+        {
+            m_checkpoint->commit(m_samples_per_pixel, samples_done);
+            last_checkpoint = now;
+        }
+
+        // Write out the intermediate result so far, the final image is written by the caller
+        if (m_intermediate_file.empty() || samples_done >= m_samples_per_pixel)
+            continue;
+
+        if (now - last_write >= std::chrono::milliseconds(static_cast<long>(m_write_interval * 1000)))
+        {
+            writeToFile(m_intermediate_file);
+            last_write = now;
         }
     }
+
+    finished = true;
+#if ENABLE_PROGRESS_INDICATOR
+    progress.join();
 #endif
 
+    // Always leave a checkpoint behind, it is what a stopped render is resumed from
+    if (m_checkpoint)
+        m_checkpoint->commit(m_samples_per_pixel, samples_done);
+
+    // Let the workers exit
+    m_coordinator.reset();
+
+    if (samples_done < m_samples_per_pixel)
+        OUT("Render stopped early at " << samples_done << " full samples per pixel");
+
+    if (texture_cache)
+    {
+        uint64_t hits = texture_cache->hits();
+        uint64_t misses = texture_cache->misses();
+        OUT("Texture cache: " << hits << " hits, " << misses << " misses ("
+                              << 100.0 * hits / std::max<uint64_t>(hits + misses, 1) << "% hit rate), "
+                              << texture_cache->bytes() / double(1 << 20) << " of " << texture_cache->capacity() / (1 << 20) << " MB used");
+    }
+
     auto stop_chrono = std::chrono::high_resolution_clock::now();
     auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(stop_chrono - start_chrono);
     OUT("Rendering done, took: " << (double)duration.count() / 1000 << " seconds");
@@ -374,5 +763,34 @@ int Renderer::render()
 
 int Renderer::writeToFile(std::string file)
 {
-    return Bmp::write(m_screen_buf.get(), file, m_width, m_height);
-}
\ No newline at end of file
+    size_t extension = file.rfind('.');
+    if (extension == std::string::npos)
+        extension = file.size();
+
+    // An EXR image holds the AOVs as layers of the same file
+    if (file.substr(extension) == ".exr")
+        return Exr::write(*m_framebuffer, file, m_exr_compression, m_exr_half);
+
+    // Anything else is written as BMP
+    auto write = [&](const std::vector<uint8_t> &pixels, std::string name) {
+        if (file.substr(extension) == ".png")
+            return Png::write(pixels, name, m_width, m_height);
+        return Bmp::write(pixels, name, m_width, m_height);
+    };
+
+    std::vector<uint8_t> pixels;
+    m_framebuffer->display(pixels);
+    int result = write(pixels, file);
+
+    for (Aov aov : {AOV_ALBEDO, AOV_NORMAL, AOV_DEPTH, AOV_SAMPLES, AOV_VARIANCE})
+    {
+        if (!(m_aovs & aov))
+            continue;
+
+        m_framebuffer->display(aov, pixels);
+        std::string aov_file = file.substr(0, extension) + "_" + aovName(aov) + file.substr(extension);
+        result |= write(pixels, aov_file);
+    }
+
+    return result;
+}
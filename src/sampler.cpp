@@ -0,0 +1,293 @@
+#include <sampler.h>
+#include <random.h>
+
+#define BLUE_NOISE_SIZE 64
+#define BLUE_NOISE_SIGMA 1.9
+
+thread_local std::unique_ptr<Sampler> sampler = std::make_unique<RandomSampler>(0);
+
+static inline uint32_t mixBits(uint32_t x)
+{
+    // lowbias32 by Chris Wellons
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+static inline uint32_t hash(uint32_t a, uint32_t b)
+{
+    return mixBits(a ^ mixBits(b + 0x9e3779b9));
+}
+
+static inline uint32_t hash(uint32_t a, uint32_t b, uint32_t c)
+{
+    return hash(hash(a, b), c);
+}
+
+static inline uint32_t reverseBits(uint32_t x)
+{
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+    x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+    x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+    x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+    return x;
+}
+
+static inline uint32_t sobol(uint32_t index, int dimension)
+{
+    // The first dimension is the van der Corput sequence, the direction
+    // numbers of the second dimension follow from the polynomial x + 1.
+    if (dimension == 0)
+        return reverseBits(index);
+
+    uint32_t result = 0;
+    for (uint32_t v = 1u << 31; index; index >>= 1, v ^= v >> 1)
+    {
+        if (index & 1)
+            result ^= v;
+    }
+    return result;
+}
+
+static inline uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed)
+{
+    x += seed;
+    x ^= x * 0x6c50b47c;
+    x ^= x * 0xb82f1e52;
+    x ^= x * 0xc7afe638;
+    x ^= x * 0x8d22f6e6;
+    return x;
+}
+
+static inline uint32_t nestedUniformScramble(uint32_t x, uint32_t seed)
+{
+    return reverseBits(laineKarrasPermutation(reverseBits(x), seed));
+}
+
+static inline double toUnit(uint32_t x)
+{
+    return x * 0x1p-32;
+}
+
+static std::vector<float> generateBlueNoiseMask()
+{
+    // Void and cluster, see "The void-and-cluster method for dither array
+    // generation" by Robert Ulichney. The mask is toroidal so it can be tiled.
+    const int size = BLUE_NOISE_SIZE;
+    const int n = size * size;
+
+    std::vector<float> kernel(n);
+    for (int y = 0; y < size; y++)
+    {
+        for (int x = 0; x < size; x++)
+        {
+            int dx = std::min(x, size - x);
+            int dy = std::min(y, size - y);
+            kernel[y * size + x] = exp(-(dx * dx + dy * dy) / (2 * BLUE_NOISE_SIGMA * BLUE_NOISE_SIGMA));
+        }
+    }
+
+    std::vector<float> energy(n, 0);
+    std::vector<uint8_t> pattern(n, 0);
+
+    auto splat = [&](int p, float sign)
+    {
+        int px = p % size;
+        int py = p / size;
+        for (int y = 0; y < size; y++)
+        {
+            const float *row = &kernel[((y - py) & (size - 1)) * size];
+            for (int x = 0; x < size; x++)
+                energy[y * size + x] += sign * row[(x - px) & (size - 1)];
+        }
+    };
+
+    auto tightestCluster = [&]()
+    {
+        int best = -1;
+        for (int i = 0; i < n; i++)
+        {
+            if (pattern[i] && (best < 0 || energy[i] > energy[best]))
+                best = i;
+        }
+        return best;
+    };
+
+    auto largestVoid = [&]()
+    {
+        int best = -1;
+        for (int i = 0; i < n; i++)
+        {
+            if (!pattern[i] && (best < 0 || energy[i] < energy[best]))
+                best = i;
+        }
+        return best;
+    };
+
+    // Start from a random pattern and move points from the tightest clusters
+    // to the largest voids until that no longer changes anything.
+    RandomGenerator gen(BLUE_NOISE_SIZE);
+    int ones = n / 10;
+    for (int placed = 0; placed < ones;)
+    {
+        int p = gen.getUint64() % n;
+        if (pattern[p])
+            continue;
+
+        pattern[p] = 1;
+        splat(p, 1);
+        placed++;
+    }
+
+    while (true)
+    {
+        int cluster = tightestCluster();
+        pattern[cluster] = 0;
+        splat(cluster, -1);
+
+        int hole = largestVoid();
+        pattern[hole] = 1;
+        splat(hole, 1);
+
+        if (hole == cluster)
+            break;
+    }
+
+    std::vector<uint8_t> prototype = pattern;
+    std::vector<float> prototype_energy = energy;
+    std::vector<int> rank(n);
+
+    // Rank the points of the prototype by removing the tightest clusters first
+    for (int r = ones - 1; r >= 0; r--)
+    {
+        int cluster = tightestCluster();
+        pattern[cluster] = 0;
+        splat(cluster, -1);
+        rank[cluster] = r;
+    }
+
+    // The rest of the points are ranked by filling up the largest voids
+    pattern = prototype;
+    energy = prototype_energy;
+    for (int r = ones; r < n; r++)
+    {
+        int hole = largestVoid();
+        pattern[hole] = 1;
+        splat(hole, 1);
+        rank[hole] = r;
+    }
+
+    std::vector<float> mask(n);
+    for (int i = 0; i < n; i++)
+        mask[i] = (rank[i] + 0.5f) / n;
+
+    return mask;
+}
+
+static double blueNoise(int x, int y)
+{
+    static const std::vector<float> mask = generateBlueNoiseMask();
+    return mask[(y & (BLUE_NOISE_SIZE - 1)) * BLUE_NOISE_SIZE + (x & (BLUE_NOISE_SIZE - 1))];
+}
+
+std::unique_ptr<Sampler> Sampler::create(SamplerType type, uint32_t seed)
+{
+    switch (type)
+    {
+    case SamplerType::Sobol:
+        return std::make_unique<SobolSampler>(seed);
+    case SamplerType::BlueNoise:
+        return std::make_unique<BlueNoiseSampler>(seed);
+    default:
+        return std::make_unique<RandomSampler>(seed);
+    }
+}
+
+void Sampler::startPixelSample(int x, int y, int sample)
+{
+    m_x = x;
+    m_y = y;
+    m_pixel_hash = hash(m_seed, x, y);
+    m_sample = sample;
+    m_dimension = 0;
+}
+
+double RandomSampler::get1D()
+{
+    return toUnit(hash(m_pixel_hash, m_sample, m_dimension++));
+}
+
+std::pair<double, double> RandomSampler::get2D()
+{
+    uint32_t key = hash(m_pixel_hash, m_sample, m_dimension++);
+    return {toUnit(mixBits(key)), toUnit(mixBits(key ^ 0x5bd1e995))};
+}
+
+double SobolSampler::get1D()
+{
+    uint32_t seed = hash(m_pixel_hash, m_dimension++);
+    uint32_t index = nestedUniformScramble(m_sample, seed);
+    return toUnit(nestedUniformScramble(sobol(index, 0), mixBits(seed)));
+}
+
+std::pair<double, double> SobolSampler::get2D()
+{
+    // Both values use the same shuffled index, otherwise the two dimensions
+    // would no longer form a (0, 2) sequence.
+    uint32_t seed = hash(m_pixel_hash, m_dimension++);
+    uint32_t index = nestedUniformScramble(m_sample, seed);
+    uint32_t u = nestedUniformScramble(sobol(index, 0), hash(seed, 0));
+    uint32_t v = nestedUniformScramble(sobol(index, 1), hash(seed, 1));
+    return {toUnit(u), toUnit(v)};
+}
+
+double BlueNoiseSampler::get1D()
+{
+    uint32_t seed = hash(m_seed, m_dimension++);
+    uint32_t index = nestedUniformScramble(m_sample, seed);
+    double u = toUnit(nestedUniformScramble(sobol(index, 0), mixBits(seed)));
+
+    // Every dimension looks at a different part of the mask, else the
+    // dimensions would be correlated.
+    double offset = blueNoise(m_x + (seed & 0xff), m_y + (seed >> 8 & 0xff));
+    return fmod(u + offset, 1.0);
+}
+
+std::pair<double, double> BlueNoiseSampler::get2D()
+{
+    uint32_t seed = hash(m_seed, m_dimension++);
+    uint32_t index = nestedUniformScramble(m_sample, seed);
+    double u = toUnit(nestedUniformScramble(sobol(index, 0), hash(seed, 0)));
+    double v = toUnit(nestedUniformScramble(sobol(index, 1), hash(seed, 1)));
+
+    double offset_u = blueNoise(m_x + (seed & 0xff), m_y + (seed >> 8 & 0xff));
+    double offset_v = blueNoise(m_x + (seed >> 16 & 0xff), m_y + (seed >> 24));
+    return {fmod(u + offset_u, 1.0), fmod(v + offset_v, 1.0)};
+}
+
+Point3 sampleUnitDisk(double u, double v)
+{
+    // Concentric mapping by Shirley and Chiu
+    double a = 2 * u - 1;
+    double b = 2 * v - 1;
+    if (a == 0 && b == 0)
+        return Point3(0, 0, 0);
+
+    double r, phi;
+    if (fabs(a) > fabs(b))
+    {
+        r = a;
+        phi = pi / 4 * (b / a);
+    }
+    else
+    {
+        r = b;
+        phi = pi / 2 - pi / 4 * (a / b);
+    }
+
+    return Point3(r * cos(phi), r * sin(phi), 0);
+}
@@ -1,15 +1,28 @@
 #include <textures/image_texture.h>
 
-Color ImageTexture::value(double u, double v, const Point3 &p) const
+template <>
+ImageTexture<TexelSrgb8>::ImageTexture(const LdrImage &image)
 {
-    int i = static_cast<int>(u * m_color_array->width());
-    int j = static_cast<int>(v * m_color_array->height());
+    int width = image.width;
+    int height = image.height;
+    auto texels = std::make_shared<std::vector<TexelSrgb8>>((size_t)width * height);
 
-    if (u > 1 ||v > 1)
+    // The texels start at the bottom row, the image at the top. Gray images
+    // have one or two channels.
+#pragma omp parallel for
+    for (int y = 0; y < height; y++)
     {
-        WARN("Trying to get UV value out of texture range");
-        return Color();
+        for (int x = 0; x < width; x++)
+        {
+            const uint8_t *pixel = image.at(x, height - 1 - y);
+            TexelSrgb8 &texel = (*texels)[(size_t)y * width + x];
+            if (image.channels < 3)
+                texel = {pixel[0], pixel[0], pixel[0], image.channels == 2 ? pixel[1] : (uint8_t)255};
+            else
+                texel = {pixel[0], pixel[1], pixel[2], image.channels == 4 ? pixel[3] : (uint8_t)255};
+        }
     }
-    
-    return m_color_array->at(i)[j];
+
+    m_mipmap = MipMap<TexelSrgb8>(width, height, texels);
+    DEBUG("width: " << width << " height: " << height << " levels: " << m_mipmap.levels());
 }
\ No newline at end of file
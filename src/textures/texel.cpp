@@ -0,0 +1,176 @@
+#include <textures/texel.h>
+
+#include <algorithm>
+#include <cstring>
+
+static double srgbToLinear(double value)
+{
+    return value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+}
+
+SrgbTable::SrgbTable()
+{
+    for (int i = 0; i < 256; i++)
+        values[i] = srgbToLinear(i / 255.0);
+}
+
+const SrgbTable srgb8_to_linear;
+
+// The linear values half way between two 8 bit sRGB values
+static const std::vector<float> srgb8_bounds = []() {
+    std::vector<float> bounds(255);
+    for (int i = 0; i < 255; i++)
+        bounds[i] = srgbToLinear((i + 0.5) / 255.0);
+    return bounds;
+}();
+
+uint8_t linearToSrgb8(double value)
+{
+    return std::upper_bound(srgb8_bounds.begin(), srgb8_bounds.end(), (float)value) - srgb8_bounds.begin();
+}
+
+uint16_t floatToHalf(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    bits &= 0x7fffffff;
+
+    // Infinity and NaN, and numbers too large for a half
+    if (bits >= 0x7f800000)
+        return sign | 0x7c00 | (bits > 0x7f800000 ? 0x200 : 0);
+    if (bits >= 0x477ff000)
+        return sign | 0x7c00;
+
+    // Numbers below the smallest normal half are denormals (or zero)
+    if (bits < 0x38800000)
+        return sign | (uint16_t)std::lrint(std::fabs(value) * 16777216.0f);
+
+    // Round to the nearest even, a carry into the exponent is still right
+    uint32_t half = ((bits >> 23) - 112) << 10 | (bits & 0x7fffff) >> 13;
+    uint32_t rest = bits & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return sign | half;
+}
+
+float halfToFloat(uint16_t value)
+{
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1f;
+    uint32_t mantissa = value & 0x3ff;
+
+    if (exponent == 0)
+    {
+        float denormal = mantissa * (1.0f / 16777216.0f);
+        return sign ? -denormal : denormal;
+    }
+
+    uint32_t bits = exponent == 0x1f ? sign | 0x7f800000 | mantissa << 13
+                                     : sign | (exponent + 112) << 23 | mantissa << 13;
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+static uint16_t packColor565(const int *c)
+{
+    return (c[0] * 31 + 127) / 255 << 11 | (c[1] * 63 + 127) / 255 << 5 | (c[2] * 31 + 127) / 255;
+}
+
+// Picks the closest of the colors between the end points for every texel,
+// returns the squared error of the block
+static int encodeBc1Indices(TexelBc1 &block, const int srgb[16][3], const int *end0, const int *end1)
+{
+    block.color0 = packColor565(end0);
+    block.color1 = packColor565(end1);
+    block.indices = 0;
+
+    // Only the first order has two blends, blocks with a single color all
+    // use the first end point
+    if (block.color0 < block.color1)
+        std::swap(block.color0, block.color1);
+
+    int palette[4][3];
+    int palette_size = block.color0 == block.color1 ? 1 : 4;
+    for (int i = 0; i < palette_size; i++)
+    {
+        block.indices = i;
+        Color color = block.decode(0, 0);
+        for (int c = 0; c < 3; c++)
+            palette[i][c] = linearToSrgb8(color[c]);
+    }
+
+    int error = 0;
+    uint32_t indices = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        int best = 0;
+        int best_distance = INT32_MAX;
+        for (int p = 0; p < palette_size; p++)
+        {
+            int distance = 0;
+            for (int c = 0; c < 3; c++)
+                distance += (srgb[i][c] - palette[p][c]) * (srgb[i][c] - palette[p][c]);
+            if (distance < best_distance)
+            {
+                best = p;
+                best_distance = distance;
+            }
+        }
+        indices |= (uint32_t)best << (2 * i);
+        error += best_distance;
+    }
+
+    block.indices = indices;
+    return error;
+}
+
+TexelBc1 TexelBc1::encode(const Color *colors)
+{
+    int srgb[16][3];
+    int min[3] = {255, 255, 255};
+    int max[3] = {0, 0, 0};
+    int mean[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            srgb[i][c] = linearToSrgb8(colors[i][c]);
+            min[c] = std::min(min[c], srgb[i][c]);
+            max[c] = std::max(max[c], srgb[i][c]);
+            mean[c] += srgb[i][c];
+        }
+    }
+
+    // The end points are two corners of the bounding box of the colors. When
+    // green or blue go down as red goes up, the other diagonal of the box is
+    // the one that follows the colors.
+    int covariance[3] = {0, 0, 0};
+    for (int i = 0; i < 16; i++)
+        for (int c = 1; c < 3; c++)
+            covariance[c] += (srgb[i][0] * 16 - mean[0]) * (srgb[i][c] * 16 - mean[c]);
+    for (int c = 1; c < 3; c++)
+        if (covariance[c] < 0)
+            std::swap(min[c], max[c]);
+
+    TexelBc1 block;
+    int error = encodeBc1Indices(block, srgb, max, min);
+    if (error == 0)
+        return block;
+
+    // Moving the end points in a bit is better when the extremes are only a
+    // few outliers, but not for blocks of mostly two colors
+    int end0[3], end1[3];
+    for (int c = 0; c < 3; c++)
+    {
+        int inset = (max[c] - min[c]) / 16;
+        end0[c] = max[c] - inset;
+        end1[c] = min[c] + inset;
+    }
+
+    TexelBc1 inset;
+    if (encodeBc1Indices(inset, srgb, end0, end1) < error)
+        return inset;
+    return block;
+}
@@ -0,0 +1,172 @@
+#include <textures/texture_cache.h>
+
+#include <unistd.h>
+
+std::shared_ptr<TextureCache> texture_cache;
+
+// Every thread remembers the last tiles it used, most lookups hit one of
+// them without going through the shards. Their hits are counted in the
+// counter of the thread for the cache of the tile.
+#define TILE_MEMO_SIZE 8
+
+struct TileMemo
+{
+    uint64_t key = UINT64_MAX;
+    const TextureCache *cache = nullptr;
+    std::shared_ptr<const std::vector<uint8_t>> tile;
+    std::atomic<uint64_t> *hits = nullptr;
+};
+
+static thread_local TileMemo tile_memo[TILE_MEMO_SIZE];
+
+// The cache the thread last got a counter from, and that counter
+static thread_local const TextureCache *memo_hits_cache = nullptr;
+static thread_local std::atomic<uint64_t> *memo_hits = nullptr;
+
+static uint64_t hashKey(uint64_t key)
+{
+    return (key * 0x9E3779B97F4A7C15ull) >> 32;
+}
+
+TextureCache::TextureCache(size_t capacity) : m_capacity(capacity)
+{
+    m_file = std::tmpfile();
+    if (m_file == nullptr)
+    {
+        ERROR("Could not create the texture cache file");
+        exit(1);
+    }
+}
+
+TextureCache::~TextureCache()
+{
+    if (m_file != nullptr)
+        fclose(m_file);
+}
+
+uint64_t TextureCache::write(const void *bytes, size_t size)
+{
+    uint64_t offset = m_file_size;
+    if (pwrite(fileno(m_file), bytes, size, offset) != (ssize_t)size)
+    {
+        ERROR("Could not write to the texture cache file");
+        exit(1);
+    }
+
+    m_file_size += size;
+    return offset;
+}
+
+std::atomic<uint64_t> *TextureCache::memoHitCounter()
+{
+    if (memo_hits_cache != this)
+    {
+        std::lock_guard<std::mutex> lock(m_memo_mutex);
+        memo_hits = &m_memo_hits.emplace_back(0);
+        memo_hits_cache = this;
+    }
+    return memo_hits;
+}
+
+const uint8_t *TextureCache::tile(uint64_t key, uint64_t offset, size_t size)
+{
+    uint64_t hash = hashKey(key);
+    TileMemo &memo = tile_memo[hash % TILE_MEMO_SIZE];
+    if (memo.key == key && memo.cache == this)
+    {
+        // Only this thread writes the counter, it does not need an atomic add
+        memo.hits->store(memo.hits->load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return memo.tile->data();
+    }
+
+    Shard &shard = m_shards[(hash / TILE_MEMO_SIZE) % TEXTURE_CACHE_SHARDS];
+    std::shared_ptr<const std::vector<uint8_t>> data;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto found = shard.entries.find(key);
+        if (found != shard.entries.end())
+        {
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second);
+            shard.hits++;
+            data = found->second->tile;
+        }
+    }
+
+    // Tiles are read without holding the lock, another thread can read the
+    // same tile in the meantime
+    if (!data)
+    {
+        auto read = std::make_shared<std::vector<uint8_t>>(size);
+        if (pread(fileno(m_file), read->data(), size, offset) != (ssize_t)size)
+        {
+            ERROR("Could not read from the texture cache file");
+            exit(1);
+        }
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.misses++;
+
+        auto found = shard.entries.find(key);
+        if (found != shard.entries.end())
+        {
+            data = found->second->tile;
+        }
+        else
+        {
+            shard.lru.push_front({key, read});
+            shard.entries[key] = shard.lru.begin();
+            shard.bytes += size;
+            data = read;
+
+            // Every shard keeps at least the tile it just read
+            while (shard.bytes > m_capacity / TEXTURE_CACHE_SHARDS && shard.lru.size() > 1)
+            {
+                const Entry &last = shard.lru.back();
+                shard.bytes -= last.tile->size();
+                shard.entries.erase(last.key);
+                shard.lru.pop_back();
+            }
+        }
+    }
+
+    memo = {key, this, data, memoHitCounter()};
+    return data->data();
+}
+
+uint64_t TextureCache::hits()
+{
+    uint64_t hits = 0;
+    for (Shard &shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        hits += shard.hits;
+    }
+
+    std::lock_guard<std::mutex> lock(m_memo_mutex);
+    for (const std::atomic<uint64_t> &counter : m_memo_hits)
+        hits += counter.load(std::memory_order_relaxed);
+    return hits;
+}
+
+uint64_t TextureCache::misses()
+{
+    uint64_t misses = 0;
+    for (Shard &shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        misses += shard.misses;
+    }
+    return misses;
+}
+
+size_t TextureCache::bytes()
+{
+    size_t bytes = 0;
+    for (Shard &shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        bytes += shard.bytes;
+    }
+    return bytes;
+}